@@ -0,0 +1,164 @@
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <sys/stat.h>
+
+#include "opencv2/imgcodecs.hpp"
+
+#include "Benchmark.hpp"
+#include "EquivalenceCheck.hpp"
+#include "MemoryGovernor.hpp"
+
+/* Time of the last stage event of each thread */
+static thread_local std::chrono::steady_clock::time_point last_event;
+
+/* JSON string literal */
+static std::string jsonString(const std::string &s) {
+
+    std::ostringstream out;
+    out << "\"";
+    for (auto c : s) {
+        if ((c == '"') || (c == '\\')) {
+            out << '\\' << c;
+        } else if ((unsigned char)c < 0x20) {
+            out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << (int)c
+                << std::dec << std::setfill(' ');
+        } else {
+            out << c;
+        }
+    }
+    out << "\"";
+    return out.str();
+}
+
+IoCounters IoCounters::current() {
+
+    // Characters passed through read and write calls, cached reads included
+    IoCounters counters;
+    std::ifstream io("/proc/self/io");
+    std::string name;
+    uint64_t value = 0;
+    while (io >> name >> value) {
+        if (name == "rchar:") counters.read_bytes = value;
+        if (name == "wchar:") counters.written_bytes = value;
+    }
+    return counters;
+}
+
+StageProfiler::StageProfiler() :
+    start_resident_(0),
+    peak_resident_(0) {}
+
+void StageProfiler::reset() {
+    size_t resident = MemoryGovernor::residentBytes();
+    std::unique_lock<std::mutex> lock(mutex_);
+    stage_order_.clear();
+    stage_seconds_.clear();
+    start_resident_ = resident;
+    peak_resident_ = resident;
+}
+
+void StageProfiler::start() {
+    last_event = std::chrono::steady_clock::now();
+}
+
+void StageProfiler::stageDone(const std::string &stage) {
+
+    auto now = std::chrono::steady_clock::now();
+    double seconds = std::chrono::duration<double>(now - last_event).count();
+    last_event = now;
+    size_t resident = MemoryGovernor::residentBytes();
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (!stage_seconds_.count(stage)) stage_order_.push_back(stage);
+    stage_seconds_[stage] += seconds;
+    peak_resident_ = std::max(peak_resident_, resident);
+}
+
+std::vector<std::pair<std::string, double>> StageProfiler::stageSeconds() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    std::vector<std::pair<std::string, double>> stages;
+    for (auto& stage : stage_order_) {
+        stages.push_back(std::make_pair(stage, stage_seconds_[stage]));
+    }
+    return stages;
+}
+
+size_t StageProfiler::startResident() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return start_resident_;
+}
+
+size_t StageProfiler::peakResident() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    return peak_resident_;
+}
+
+bool writeBenchPlate(const BenchPlate &plate, std::string layer_pattern,
+                        std::vector<std::string> *wells) {
+
+    mkdir(plate.dir.c_str(), 0700);
+    wells->clear();
+    for (unsigned int w = 1; w <= plate.wells; w++) {
+        std::ostringstream well;
+        well << "well" << std::setw(2) << std::setfill('0') << w;
+        std::string well_dir = plate.dir + well.str() + "/";
+        mkdir(well_dir.c_str(), 0700);
+
+        // Every well is its own seed, so the plate is the same on each run
+        std::vector<cv::Mat> planes = EquivalenceCheck::syntheticWindow(
+                                        cv::Size(plate.frame_size, plate.frame_size),
+                                        plate.depth, w, plate.density);
+        for (unsigned int z = 0; z < plate.depth; z++) {
+            std::string name = layer_pattern;
+            std::size_t found = name.find("{dir}");
+            while (found != std::string::npos) {
+                name.replace(found, 5, well.str());
+                found = name.find("{dir}", found);
+            }
+            name.replace(name.find("{z}"), 3, std::to_string(z + 1));
+            if (!cv::imwrite(well_dir + name + ".tif", planes[z])) {
+                std::cerr << "Could not write the benchmark plane '"
+                            << well_dir + name << ".tif'" << std::endl;
+                return false;
+            }
+        }
+        wells->push_back(well_dir);
+    }
+    return true;
+}
+
+void writeBenchJson(const BenchPlate &plate, std::string label,
+                        const std::vector<BenchRun> &runs, std::ostream &out) {
+
+    out << "{" << std::endl;
+    out << "  \"label\": " << jsonString(label) << "," << std::endl;
+    out << "  \"plate\": {\"wells\": " << plate.wells << ", \"depth\": " << plate.depth
+        << ", \"frame_size\": " << plate.frame_size << ", \"density\": " << plate.density
+        << "}," << std::endl;
+    out << "  \"runs\": [" << std::endl;
+    for (size_t i = 0; i < runs.size(); i++) {
+        const BenchRun &run = runs[i];
+        double wells_per_hour = 3600.0*(plate.wells - run.failed)/std::max(run.seconds, 1e-6);
+        out << "    {\"threads\": " << run.threads << ", \"workers\": " << run.workers
+            << ", \"cv_threads\": " << run.opencv_threads
+            << ", \"seconds\": " << run.seconds
+            << ", \"wells_per_hour\": " << wells_per_hour
+            << ", \"failed\": " << run.failed
+            << ", \"start_rss_bytes\": " << run.start_resident
+            << ", \"peak_rss_growth_bytes\": " << run.peak_resident - run.start_resident
+            << ", \"bytes_read\": " << run.io.read_bytes
+            << ", \"bytes_written\": " << run.io.written_bytes
+            << ", \"stages\": {";
+        for (size_t s = 0; s < run.stages.size(); s++) {
+            out << (s ? ", " : "") << jsonString(run.stages[s].first) << ": "
+                << run.stages[s].second;
+        }
+        out << "}}" << ((i + 1 < runs.size()) ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
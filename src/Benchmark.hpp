@@ -0,0 +1,91 @@
+#ifndef BENCHMARK_HPP
+#define BENCHMARK_HPP
+
+/* Throughput benchmark
+   A deterministic synthetic plate is written to local disk and analyzed by
+   the full pipeline at several thread counts. Each run reports the wells
+   per hour, the time of every pipeline stage summed over the threads, the
+   growth of the resident memory from the start of the run to its peak and
+   the bytes read and written by the process, as one JSON document, so that
+   runs of different versions can be compared. The runs share one process,
+   so the growth and not the absolute resident memory is comparable:
+
+     {"label": ..., "plate": {...}, "runs": [{"threads": ..., "stages": {...}}]}
+ */
+
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/* Synthetic plate of a benchmark */
+struct BenchPlate {
+    std::string dir = "bench_plate/"; // Plate directory, the wells are rewritten
+    unsigned int wells = 4; // Well directories
+    unsigned int depth = 6; // Z planes per well
+    int frame_size = 1024; // Width and height of the planes
+    double density = 1.0; // Objects per frame, relative to the synthetic windows
+};
+
+/* Bytes read and written by the process, 0 when /proc/self/io is unreadable */
+struct IoCounters {
+    uint64_t read_bytes = 0;
+    uint64_t written_bytes = 0;
+
+    static IoCounters current();
+};
+
+/* Time between the stage events of each thread, and the resident memory 
+   at the reset and at its peak since */
+class StageProfiler {
+
+public:
+    StageProfiler();
+
+    /* Clear the stages and sample the starting resident memory */
+    void reset();
+
+    /* Start the clock of the calling thread */
+    void start();
+
+    /* Charge the time since the last event of the calling thread to a stage */
+    void stageDone(const std::string &stage);
+
+    /* Seconds per stage, in the order first reported */
+    std::vector<std::pair<std::string, double>> stageSeconds();
+
+    size_t startResident();
+
+    size_t peakResident();
+
+private:
+    std::mutex mutex_;
+    std::vector<std::string> stage_order_;
+    std::map<std::string, double> stage_seconds_;
+    size_t start_resident_;
+    size_t peak_resident_;
+};
+
+/* Measurements of one run of the benchmark */
+struct BenchRun {
+    unsigned int threads = 0;
+    unsigned int workers = 0;
+    unsigned int opencv_threads = 0;
+    double seconds = 0.0;
+    unsigned int failed = 0; // Wells that could not be processed
+    size_t start_resident = 0; // Resident memory when the run started
+    size_t peak_resident = 0;
+    IoCounters io; // Difference over the run
+    std::vector<std::pair<std::string, double>> stages;
+};
+
+/* Write the wells of the plate, the planes are named after the layer pattern */
+bool writeBenchPlate(const BenchPlate &plate, std::string layer_pattern,
+                        std::vector<std::string> *wells);
+
+void writeBenchJson(const BenchPlate &plate, std::string label,
+                        const std::vector<BenchRun> &runs, std::ostream &out);
+
+#endif
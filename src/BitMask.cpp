@@ -0,0 +1,261 @@
+#include <algorithm>
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "BitMask.hpp"
+
+/* 8 bits spread to 8 bytes, 0xff for each set bit, in little endian order */
+struct ByteSpread {
+    uint64_t bytes[256];
+
+    ByteSpread() {
+        for (int bits = 0; bits < 256; bits++) {
+            bytes[bits] = 0;
+            for (int i = 0; i < 8; i++) {
+                if (bits & (1 << i)) bytes[bits] |= 0xffULL << (8*i);
+            }
+        }
+    }
+};
+
+static const ByteSpread byte_spread;
+
+static int popcount(uint64_t word) {
+    return __builtin_popcountll(word);
+}
+
+/* Bits [begin, end) of a word, 0 <= begin < end <= 64 */
+static uint64_t bitRange(int begin, int end) {
+    uint64_t high = (end == 64) ? ~0ULL : ((1ULL << end) - 1);
+    return high & (~0ULL << begin);
+}
+
+BitMask::BitMask() {}
+
+BitMask::BitMask(cv::Size size) :
+    cols_(size.width),
+    rows_(size.height),
+    words_per_row_((size.width + 63)/64),
+    words_((size_t)words_per_row_*size.height, 0) {}
+
+BitMask::BitMask(const cv::Mat &mask) :
+    BitMask(mask.size()) {
+
+    CV_Assert(mask.type() == CV_8UC1);
+    for (int y = 0; y < rows_; y++) {
+        const uchar *ptr = mask.ptr<uchar>(y);
+        uint64_t *row = &words_[(size_t)y*words_per_row_];
+        int x = 0;
+#ifdef __SSE2__
+        // Sixteen pixels at a time, from the byte compare with zero
+        const __m128i zero = _mm_setzero_si128();
+        for (; x + 16 <= cols_; x += 16) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(ptr + x));
+            uint64_t bits = (uint16_t)~_mm_movemask_epi8(_mm_cmpeq_epi8(pixels, zero));
+            row[x >> 6] |= bits << (x & 63);
+        }
+#endif
+        for (; x < cols_; x++) {
+            row[x >> 6] |= (uint64_t)(ptr[x] != 0) << (x & 63);
+        }
+    }
+}
+
+cv::Mat BitMask::toMat() const {
+    cv::Mat mask(rows_, cols_, CV_8UC1);
+    for (int y = 0; y < rows_; y++) {
+        uchar *ptr = mask.ptr<uchar>(y);
+        const uint64_t *row = &words_[(size_t)y*words_per_row_];
+
+        // Eight pixels at a time from the spread table
+        int x = 0;
+        for (; x + 8 <= cols_; x += 8) {
+            uint64_t bytes = byte_spread.bytes[(row[x >> 6] >> (x & 63)) & 0xff];
+            memcpy(ptr + x, &bytes, 8);
+        }
+        for (; x < cols_; x++) {
+            ptr[x] = ((row[x >> 6] >> (x & 63)) & 1) ? 255 : 0;
+        }
+    }
+    return mask;
+}
+
+cv::Size BitMask::size() const {
+    return cv::Size(cols_, rows_);
+}
+
+bool BitMask::empty() const {
+    return words_.empty();
+}
+
+bool BitMask::get(int x, int y) const {
+    return (words_[(size_t)y*words_per_row_ + (x >> 6)] >> (x & 63)) & 1;
+}
+
+BitMask BitMask::operator&(const BitMask &other) const {
+    BitMask result = *this;
+    result &= other;
+    return result;
+}
+
+BitMask BitMask::operator|(const BitMask &other) const {
+    BitMask result = *this;
+    result |= other;
+    return result;
+}
+
+BitMask BitMask::operator~() const {
+    BitMask result = *this;
+    for (auto& word : result.words_) {
+        word = ~word;
+    }
+    result.clearPadding();
+    return result;
+}
+
+BitMask& BitMask::operator&=(const BitMask &other) {
+    CV_Assert(size() == other.size());
+    for (size_t i = 0; i < words_.size(); i++) {
+        words_[i] &= other.words_[i];
+    }
+    return *this;
+}
+
+BitMask& BitMask::operator|=(const BitMask &other) {
+    CV_Assert(size() == other.size());
+    for (size_t i = 0; i < words_.size(); i++) {
+        words_[i] |= other.words_[i];
+    }
+    return *this;
+}
+
+size_t BitMask::count() const {
+    size_t set = 0;
+    for (auto word : words_) {
+        set += popcount(word);
+    }
+    return set;
+}
+
+size_t BitMask::countRange(int y, int x_begin, int x_end) const {
+    x_begin = std::max(0, x_begin);
+    x_end = std::min(cols_, x_end);
+    if ((y < 0) || (y >= rows_) || (x_begin >= x_end)) return 0;
+
+    const uint64_t *row = &words_[(size_t)y*words_per_row_];
+    int first = x_begin >> 6, last = (x_end - 1) >> 6;
+    if (first == last) {
+        return popcount(row[first] & bitRange(x_begin & 63, x_end - first*64));
+    }
+    size_t set = popcount(row[first] & bitRange(x_begin & 63, 64));
+    for (int w = first + 1; w < last; w++) {
+        set += popcount(row[w]);
+    }
+    set += popcount(row[last] & bitRange(0, x_end - last*64));
+    return set;
+}
+
+size_t BitMask::countUnder(const cv::Mat &mask, cv::Point offset) const {
+    size_t set = 0;
+    for (int y = 0; y < mask.rows; y++) {
+        const uchar *ptr = mask.ptr<uchar>(y);
+        int x = 0;
+        while (x < mask.cols) {
+            while ((x < mask.cols) && !ptr[x]) x++;
+            int begin = x;
+            while ((x < mask.cols) && ptr[x]) x++;
+            if (x > begin) set += countRange(offset.y + y, offset.x + begin, offset.x + x);
+        }
+    }
+    return set;
+}
+
+int BitMask::nextPixel(int y, int x, bool set) const {
+    if (x >= cols_) return cols_;
+    const uint64_t *row = &words_[(size_t)y*words_per_row_];
+    int w = x >> 6;
+    uint64_t word = (set ? row[w] : ~row[w]) & (~0ULL << (x & 63));
+    while (!word) {
+        if (++w >= words_per_row_) return cols_;
+        word = set ? row[w] : ~row[w];
+    }
+    return std::min(cols_, w*64 + __builtin_ctzll(word));
+}
+
+int BitMask::label(std::vector<BitComponent> *components, cv::Mat *labels) const {
+
+    struct Run {
+        int y, begin, end; // Pixels [begin, end) of row y
+    };
+
+    // Runs of set pixels, row after row
+    std::vector<Run> runs;
+    std::vector<size_t> row_start(rows_ + 1, 0);
+    for (int y = 0; y < rows_; y++) {
+        row_start[y] = runs.size();
+        int x = nextPixel(y, 0, true);
+        while (x < cols_) {
+            int end = nextPixel(y, x, false);
+            Run run = {y, x, end};
+            runs.push_back(run);
+            x = nextPixel(y, end, true);
+        }
+    }
+    row_start[rows_] = runs.size();
+
+    // Union the runs that touch a run of the previous row, diagonals included
+    std::vector<int> parent(runs.size());
+    for (size_t i = 0; i < parent.size(); i++) {
+        parent[i] = (int)i;
+    }
+    auto find = [&parent](int i) {
+        while (parent[i] != i) {
+            parent[i] = parent[parent[i]];
+            i = parent[i];
+        }
+        return i;
+    };
+    for (int y = 1; y < rows_; y++) {
+        size_t prev = row_start[y-1], prev_end = row_start[y];
+        for (size_t i = row_start[y]; i < row_start[y+1]; i++) {
+            while ((prev < prev_end) && (runs[prev].end < runs[i].begin)) prev++;
+            for (size_t j = prev; (j < prev_end) && (runs[j].begin <= runs[i].end); j++) {
+                int a = find((int)i), b = find((int)j);
+                if (a != b) parent[std::max(a, b)] = std::min(a, b);
+            }
+        }
+    }
+
+    // Number the components in raster order of their first run
+    std::vector<int> component(runs.size(), -1);
+    components->clear();
+    if (labels) *labels = cv::Mat::zeros(rows_, cols_, CV_32SC1);
+    for (size_t i = 0; i < runs.size(); i++) {
+        int root = find((int)i);
+        if (component[root] < 0) {
+            component[root] = (int)components->size();
+            BitComponent created;
+            created.bound = cv::Rect(runs[i].begin, runs[i].y, 0, 0);
+            components->push_back(created);
+        }
+        BitComponent &current = (*components)[component[root]];
+        current.area += runs[i].end - runs[i].begin;
+        current.bound |= cv::Rect(runs[i].begin, runs[i].y,
+                                    runs[i].end - runs[i].begin, 1);
+        if (labels) {
+            int *ptr = labels->ptr<int>(runs[i].y);
+            std::fill(ptr + runs[i].begin, ptr + runs[i].end, component[root] + 1);
+        }
+    }
+    return (int)components->size();
+}
+
+void BitMask::clearPadding() {
+    if (!(cols_ & 63)) return;
+    uint64_t keep = bitRange(0, cols_ & 63);
+    for (int y = 0; y < rows_; y++) {
+        words_[(size_t)y*words_per_row_ + words_per_row_ - 1] &= keep;
+    }
+}
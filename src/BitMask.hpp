@@ -0,0 +1,80 @@
+#ifndef BIT_MASK_HPP
+#define BIT_MASK_HPP
+
+/* Bit-packed binary mask
+   One bit per pixel, each row padded to 64-bit words. AND, OR and NOT work
+   a word at a time and areas are counted with popcount, so the mask
+   intersections and coverage counts touch an eighth of the memory of the
+   0/255 8-bit masks. Masks are packed from and unpacked to 8-bit matrices
+   at the OpenCV boundary, sixteen pixels at a time with SSE2 and eight at
+   a time through a table, and the set pixels can be labeled directly from
+   the packed rows.
+ */
+
+#include <stdint.h>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+/* 8-connected component of a bit mask */
+struct BitComponent {
+    int area = 0; // Set pixels
+    cv::Rect bound;
+};
+
+class BitMask {
+
+public:
+    BitMask();
+
+    /* Cleared mask of the given size */
+    BitMask(cv::Size size);
+
+    /* Pack an 8-bit mask, the non zero pixels are set */
+    explicit BitMask(const cv::Mat &mask);
+
+    /* Unpack into a 0/255 8-bit mask */
+    cv::Mat toMat() const;
+
+    cv::Size size() const;
+
+    bool empty() const;
+
+    bool get(int x, int y) const;
+
+    BitMask operator&(const BitMask &other) const;
+
+    BitMask operator|(const BitMask &other) const;
+
+    BitMask operator~() const;
+
+    BitMask& operator&=(const BitMask &other);
+
+    BitMask& operator|=(const BitMask &other);
+
+    /* Number of set pixels */
+    size_t count() const;
+
+    /* Set pixels of row y in [x_begin, x_end) */
+    size_t countRange(int y, int x_begin, int x_end) const;
+
+    /* Set pixels under the non zero pixels of an 8-bit mask placed at offset */
+    size_t countUnder(const cv::Mat &mask, cv::Point offset) const;
+
+    /* Label the 8-connected components from the runs of the packed rows.
+       labels (CV_32S, 0 for the background) is filled when not NULL.
+       Returns the number of components. */
+    int label(std::vector<BitComponent> *components, cv::Mat *labels = NULL) const;
+
+private:
+    /* First pixel at or after x in row y that is set (or clear), cols if none */
+    int nextPixel(int y, int x, bool set) const;
+
+    void clearPadding();
+
+    int cols_ = 0;
+    int rows_ = 0;
+    int words_per_row_ = 0;
+    std::vector<uint64_t> words_;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "ContourStore.hpp"
+
+cv::Mat ContourView::mat() const {
+    if (!count) return cv::Mat();
+    return cv::Mat(count, 1, CV_32SC2, (void *)points);
+}
+
+void ContourStore::clear() {
+    points_.clear();
+    offsets_.assign(1, 0);
+    hierarchy_.clear();
+    types_.clear();
+    areas_.clear();
+}
+
+int ContourStore::append(const std::vector<std::vector<cv::Point>> &contours,
+                            const std::vector<cv::Vec4i> &hierarchy) {
+
+    int base_index = (int)size();
+    size_t point_cnt = points_.size();
+    for (auto& contour : contours) {
+        point_cnt += contour.size();
+    }
+    points_.reserve(point_cnt);
+    for (size_t i = 0; i < contours.size(); i++) {
+        points_.insert(points_.end(), contours[i].begin(), contours[i].end());
+        offsets_.push_back((int)points_.size());
+        cv::Vec4i node = (i < hierarchy.size()) ? hierarchy[i] : cv::Vec4i(-1, -1, -1, -1);
+        for (int k = 0; k < 4; k++) {
+            if (node[k] > -1) node[k] += base_index;
+        }
+        hierarchy_.push_back(node);
+    }
+    types_.resize(size(), HierarchyType::INVALID_CNTR);
+    areas_.resize(size(), 0.0);
+    return base_index;
+}
+
+int ContourStore::append(const std::vector<cv::Point> &contour,
+                            HierarchyType type, double area) {
+
+    int index = (int)size();
+    points_.insert(points_.end(), contour.begin(), contour.end());
+    offsets_.push_back((int)points_.size());
+    hierarchy_.push_back(cv::Vec4i(-1, -1, -1, -1));
+    types_.push_back(type);
+    areas_.push_back(area);
+    return index;
+}
+
+size_t ContourStore::size() const {
+    return hierarchy_.size();
+}
+
+ContourView ContourStore::contour(int index) const {
+    ContourView view;
+    view.count = offsets_[index+1] - offsets_[index];
+    if (view.count) view.points = &points_[offsets_[index]];
+    return view;
+}
+
+const std::vector<cv::Vec4i>& ContourStore::hierarchy() const {
+    return hierarchy_;
+}
+
+HierarchyType ContourStore::type(int index) const {
+    return types_[index];
+}
+
+void ContourStore::setType(int index, HierarchyType type) {
+    types_[index] = type;
+}
+
+double ContourStore::area(int index) const {
+    return areas_[index];
+}
+
+void ContourStore::setArea(int index, double area) {
+    areas_[index] = area;
+}
+
+std::vector<int> ContourStore::select(HierarchyType type) const {
+    std::vector<int> selected;
+    for (size_t i = 0; i < types_.size(); i++) {
+        if (types_[i] == type) selected.push_back((int)i);
+    }
+    return selected;
+}
+
+std::vector<int> ContourStore::indices() const {
+    std::vector<int> all(size());
+    for (size_t i = 0; i < all.size(); i++) {
+        all[i] = (int)i;
+    }
+    return all;
+}
+
+std::vector<cv::Mat> ContourStore::mats() const {
+    std::vector<cv::Mat> headers(size());
+    for (size_t i = 0; i < headers.size(); i++) {
+        headers[i] = contour((int)i).mat();
+    }
+    return headers;
+}
@@ -0,0 +1,75 @@
+#ifndef CONTOUR_STORE_HPP
+#define CONTOUR_STORE_HPP
+
+/* Contour store
+   Flat storage of the contours of one mask: the points of every contour in
+   a single buffer, with per contour offsets, hierarchy, validity and area.
+   The output of findContours is packed once, after that the stages work on
+   views into the buffer and index lists instead of copies of the contours.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+/* Hierarchy type */
+enum class HierarchyType : unsigned char {
+    INVALID_CNTR = 0,
+    CHILD_CNTR,
+    PARENT_CNTR
+};
+
+/* Points of one contour, valid until the store is appended to or cleared */
+struct ContourView {
+    const cv::Point *points = NULL;
+    int count = 0;
+
+    /* Matrix header over the points, for the OpenCV contour functions */
+    cv::Mat mat() const;
+};
+
+class ContourStore {
+
+public:
+    void clear();
+
+    /* Pack the output of findContours, the hierarchy is re-indexed to the
+       store and every contour starts invalid with a zero area. Returns the
+       index of the first appended contour. */
+    int append(const std::vector<std::vector<cv::Point>> &contours,
+                const std::vector<cv::Vec4i> &hierarchy);
+
+    /* Append one contour without parent, child or sibling */
+    int append(const std::vector<cv::Point> &contour, HierarchyType type, double area);
+
+    size_t size() const;
+
+    ContourView contour(int index) const;
+
+    const std::vector<cv::Vec4i>& hierarchy() const;
+
+    HierarchyType type(int index) const;
+
+    void setType(int index, HierarchyType type);
+
+    double area(int index) const;
+
+    void setArea(int index, double area);
+
+    /* Indices of the contours of the given type */
+    std::vector<int> select(HierarchyType type) const;
+
+    /* Indices of all the contours */
+    std::vector<int> indices() const;
+
+    /* Matrix headers over every contour, for drawContours */
+    std::vector<cv::Mat> mats() const;
+
+private:
+    std::vector<cv::Point> points_;
+    std::vector<int> offsets_ = std::vector<int>(1, 0); // size() + 1 entries
+    std::vector<cv::Vec4i> hierarchy_;
+    std::vector<HierarchyType> types_;
+    std::vector<double> areas_;
+};
+
+#endif
@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <iostream>
+#include <pthread.h>
+#include <sched.h>
+#include <thread>
+
+#include "opencv2/core/core.hpp"
+
+#include "CoreScheduler.hpp"
+
+CoreScheduler::CoreScheduler(ParallelPolicy policy, unsigned int cores, unsigned int workers,
+                                unsigned int opencv_threads, bool pin) :
+    policy_(policy),
+    cores_(cores ? cores : std::max(1u, std::thread::hardware_concurrency())),
+    pin_(pin) {
+
+    switch(policy_) {
+        case ParallelPolicy::OUTER: {
+            workers_ = workers ? workers : cores_;
+            opencv_threads_ = 1;
+        } break;
+
+        case ParallelPolicy::INNER: {
+            workers_ = 1;
+            opencv_threads_ = opencv_threads ? opencv_threads : cores_;
+        } break;
+
+        case ParallelPolicy::HYBRID:
+        default: {
+            // Given OpenCV threads set the worker count, and the other way round
+            if (opencv_threads) {
+                opencv_threads_ = std::min(opencv_threads, cores_);
+                workers_ = workers ? workers : std::max(1u, cores_/opencv_threads_);
+            } else if (workers) {
+                workers_ = workers;
+                opencv_threads_ = std::max(1u, cores_/workers_);
+            } else {
+                opencv_threads_ = std::min(2u, cores_);
+                workers_ = std::max(1u, cores_/opencv_threads_);
+            }
+        } break;
+    }
+}
+
+void CoreScheduler::apply() const {
+    cv::setNumThreads((int)opencv_threads_);
+}
+
+void CoreScheduler::enterWorker(unsigned int worker) const {
+
+    // A single worker shares every core with the OpenCV threads
+    if (!pin_ || (workers_ < 2)) return;
+
+    // Worker i owns the cores [i*k, (i+1)*k), wrapping around the node
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+    unsigned int share = (policy_ == ParallelPolicy::OUTER) ? 1 : opencv_threads_;
+    for (unsigned int i = 0; i < share; i++) {
+        CPU_SET((worker*share + i) % cores_, &cpu_set);
+    }
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpu_set), &cpu_set)) {
+        std::cerr << "Could not pin worker " << worker << " to its cores" << std::endl;
+    }
+}
+
+ThreadPool::WorkerStart CoreScheduler::workerStart() const {
+    CoreScheduler scheduler = *this;
+    return [scheduler](unsigned int worker) { scheduler.enterWorker(worker); };
+}
+
+ParallelPolicy CoreScheduler::policy() const {
+    return policy_;
+}
+
+unsigned int CoreScheduler::cores() const {
+    return cores_;
+}
+
+unsigned int CoreScheduler::workers() const {
+    return workers_;
+}
+
+unsigned int CoreScheduler::opencvThreads() const {
+    return opencv_threads_;
+}
+
+bool CoreScheduler::parsePolicy(std::string name, ParallelPolicy *policy) {
+    if (name == "outer") {
+        *policy = ParallelPolicy::OUTER;
+    } else if (name == "inner") {
+        *policy = ParallelPolicy::INNER;
+    } else if (name == "hybrid") {
+        *policy = ParallelPolicy::HYBRID;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+std::string CoreScheduler::policyName(ParallelPolicy policy) {
+    switch(policy) {
+        case ParallelPolicy::OUTER: return "outer";
+        case ParallelPolicy::INNER: return "inner";
+        case ParallelPolicy::HYBRID: return "hybrid";
+    }
+    return "";
+}
@@ -0,0 +1,64 @@
+#ifndef CORE_SCHEDULER_HPP
+#define CORE_SCHEDULER_HPP
+
+/* Core scheduler
+   Shares the cores between the pipeline workers (outer parallelism) and the
+   parallel_for_ of OpenCV inside each stage (inner parallelism), so that the
+   two do not oversubscribe the node:
+
+     outer   one worker per core, OpenCV runs single threaded
+     inner   a single worker, OpenCV uses every core
+     hybrid  cores/k workers with k OpenCV threads each
+
+   The OpenCV thread count is process wide, it is set once before the
+   workers start. Each worker may be pinned to its own share of the cores.
+ */
+
+#include <string>
+
+#include "ThreadPool.hpp"
+
+enum class ParallelPolicy : unsigned char {
+    OUTER = 0,
+    INNER,
+    HYBRID
+};
+
+class CoreScheduler {
+
+public:
+    /* Zero cores means every online core. Zero workers or OpenCV threads
+       are derived from the policy and the core count. */
+    CoreScheduler(ParallelPolicy policy, unsigned int cores = 0, unsigned int workers = 0,
+                    unsigned int opencv_threads = 0, bool pin = false);
+
+    /* Set the OpenCV thread count, before the workers start */
+    void apply() const;
+
+    /* Pin the calling worker thread to its cores, when pinning is on */
+    void enterWorker(unsigned int worker) const;
+
+    /* enterWorker as a thread pool start hook */
+    ThreadPool::WorkerStart workerStart() const;
+
+    ParallelPolicy policy() const;
+
+    unsigned int cores() const;
+
+    unsigned int workers() const;
+
+    unsigned int opencvThreads() const;
+
+    static bool parsePolicy(std::string name, ParallelPolicy *policy);
+
+    static std::string policyName(ParallelPolicy policy);
+
+private:
+    ParallelPolicy policy_;
+    unsigned int cores_;
+    unsigned int workers_;
+    unsigned int opencv_threads_;
+    bool pin_;
+};
+
+#endif
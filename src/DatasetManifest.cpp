@@ -0,0 +1,310 @@
+#include <algorithm>
+#include <dirent.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include "opencv2/imgcodecs.hpp"
+
+#include "DatasetManifest.hpp"
+#include "ThreadPool.hpp"
+
+#define MANIFEST_HEADER     "#neuron manifest"
+
+/* Directory path with the trailing '/' */
+static std::string dirPath(std::string dir) {
+    return (!dir.empty() && (dir.back() == '/')) ? dir : dir + "/";
+}
+
+/* Last component of a directory path */
+static std::string dirName(std::string dir) {
+    while (!dir.empty() && (dir.back() == '/')) dir.pop_back();
+    std::size_t found = dir.find_last_of("/");
+    return (found == std::string::npos) ? dir : dir.substr(found + 1);
+}
+
+static bool dirModified(std::string dir, long long *mtime) {
+    struct stat st;
+    if (stat(dir.c_str(), &st) == -1) return false;
+    *mtime = (long long) st.st_mtime;
+    return true;
+}
+
+static unsigned int readInt(const unsigned char *bytes, int count, bool big_endian) {
+    unsigned int value = 0;
+    for (int i = 0; i < count; i++) {
+        value |= (unsigned int) bytes[i] << (8*(big_endian ? count-1-i : i));
+    }
+    return value;
+}
+
+/* Size from the first image file directory of a TIFF */
+static bool tiffSize(FILE *file, bool big_endian, cv::Size *size) {
+    unsigned char bytes[12];
+    if ((fseek(file, 4, SEEK_SET) != 0) || (fread(bytes, 1, 4, file) != 4)) return false;
+    if ((fseek(file, readInt(bytes, 4, big_endian), SEEK_SET) != 0) ||
+                                    (fread(bytes, 1, 2, file) != 2)) return false;
+    unsigned int entry_cnt = readInt(bytes, 2, big_endian);
+    for (unsigned int i = 0; i < entry_cnt; i++) {
+        if (fread(bytes, 1, 12, file) != 12) return false;
+        unsigned int tag = readInt(bytes, 2, big_endian);
+        unsigned int type = readInt(bytes + 2, 2, big_endian);
+        int value = (int) readInt(bytes + 8, (type == 3) ? 2 : 4, big_endian);
+        if (tag == 256) size->width = value;
+        if (tag == 257) size->height = value;
+    }
+    return (size->width > 0) && (size->height > 0);
+}
+
+/* Size from the start of frame segment of a JPEG */
+static bool jpegSize(FILE *file, cv::Size *size) {
+    unsigned char bytes[7];
+    if (fseek(file, 2, SEEK_SET) != 0) return false;
+    while (true) {
+        int marker = fgetc(file);
+        if (marker != 0xFF) return false;
+        while (marker == 0xFF) marker = fgetc(file);
+        if ((marker == EOF) || (marker == 0xD9) || (marker == 0xDA)) return false;
+        if ((marker == 0x01) || ((marker >= 0xD0) && (marker <= 0xD7))) continue;
+        if (fread(bytes, 1, 2, file) != 2) return false;
+        unsigned int length = readInt(bytes, 2, true);
+        if ((marker >= 0xC0) && (marker <= 0xCF) &&
+                    (marker != 0xC4) && (marker != 0xC8) && (marker != 0xCC)) {
+            if (fread(bytes, 1, 5, file) != 5) return false;
+            size->height = (int) readInt(bytes + 1, 2, true);
+            size->width = (int) readInt(bytes + 3, 2, true);
+            return (size->width > 0) && (size->height > 0);
+        }
+        if ((length < 2) || (fseek(file, length - 2, SEEK_CUR) != 0)) return false;
+    }
+}
+
+/* Image size read from the file header, the image is decoded as a fallback */
+static bool imageSize(std::string path, cv::Size *size) {
+
+    FILE *file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    unsigned char magic[4] = {0, 0, 0, 0};
+    bool found = false;
+    if (fread(magic, 1, 4, file) == 4) {
+        if ((magic[0] == 'I') && (magic[1] == 'I') && (magic[2] == 42)) {
+            found = tiffSize(file, false, size);
+        } else if ((magic[0] == 'M') && (magic[1] == 'M') && (magic[3] == 42)) {
+            found = tiffSize(file, true, size);
+        } else if ((magic[0] == 0xFF) && (magic[1] == 0xD8)) {
+            found = jpegSize(file, size);
+        }
+    }
+    fclose(file);
+    if (found) return true;
+
+    cv::Mat img = cv::imread(path, cv::IMREAD_ANYDEPTH | cv::IMREAD_ANYCOLOR);
+    *size = img.size();
+    return !img.empty();
+}
+
+std::string StackEntry::baseName(size_t z) const {
+    return dir + planes[z];
+}
+
+DatasetManifest::DatasetManifest(std::string pattern) :
+    pattern_(pattern) {}
+
+bool DatasetManifest::validPattern(std::string pattern) {
+    std::size_t found = pattern.find("{z}");
+    return (found != std::string::npos) && (pattern.find("{z}", found + 3) == std::string::npos);
+}
+
+/* Plane name pattern of a directory, with its {dir} fields filled in */
+static std::string planeName(std::string dir, std::string pattern) {
+
+    std::size_t found = pattern.find("{dir}");
+    while (found != std::string::npos) {
+        pattern.replace(found, 5, dirName(dir));
+        found = pattern.find("{dir}", found);
+    }
+    return pattern;
+}
+
+int DatasetManifest::planeIndex(std::string dir, std::string pattern, std::string file, 
+                                    std::string *stem) {
+
+    // Plane names are <prefix><z digits><suffix>.<tif|jpg>
+    std::string name = planeName(dir, pattern);
+    std::size_t z_pos = name.find("{z}");
+    std::string prefix = name.substr(0, z_pos), suffix = name.substr(z_pos + 3);
+    std::size_t dot = file.find_last_of(".");
+    if (dot == std::string::npos) return -1;
+    std::string ext = file.substr(dot + 1);
+    if ((ext != "tif") && (ext != "jpg")) return -1;
+    *stem = file.substr(0, dot);
+    if ((stem->size() <= prefix.size() + suffix.size()) ||
+                (stem->compare(0, prefix.size(), prefix) != 0) ||
+                (stem->compare(stem->size() - suffix.size(), suffix.size(), suffix) != 0)) {
+        return -1;
+    }
+    std::string digits = stem->substr(prefix.size(),
+                                stem->size() - prefix.size() - suffix.size());
+    if (digits.find_first_not_of("0123456789") != std::string::npos) return -1;
+    return atoi(digits.c_str());
+}
+
+bool DatasetManifest::scanStack(std::string dir, std::string pattern, StackEntry *entry) {
+
+    entry->dir = dirPath(dir);
+    entry->size = cv::Size();
+    entry->planes.clear();
+    entry->error.clear();
+    if (!dirModified(entry->dir, &entry->mtime)) {
+        entry->error = "Could not open directory '" + entry->dir + "'";
+        return false;
+    }
+
+    DIR *read_dir = opendir(entry->dir.c_str());
+    if (!read_dir) {
+        entry->error = "Could not open directory '" + entry->dir + "'";
+        return false;
+    }
+    std::map<int, std::string> stems, files;
+    struct dirent *dir_entry = NULL;
+    while ((dir_entry = readdir(read_dir))) {
+        std::string file(dir_entry->d_name), stem;
+        int z = planeIndex(entry->dir, pattern, file, &stem);
+        if (z < 0) continue;
+        bool tiff = (file.compare(stem.size(), std::string::npos, ".tif") == 0);
+
+        // The layer reader takes the TIFF over the JPEG of the same plane
+        if (stems.count(z) && (stems[z] != stem)) {
+            entry->error = "Duplicate z plane " + std::to_string(z) + " in '" + entry->dir + "'";
+            closedir(read_dir);
+            return false;
+        }
+        stems[z] = stem;
+        if (!files.count(z) || tiff) files[z] = file;
+    }
+    closedir(read_dir);
+
+    // Planes 1 to N, all of the same size
+    if (stems.empty()) {
+        entry->error = "No z planes match '" + planeName(entry->dir, pattern) + "' in '" + 
+                                                                    entry->dir + "'";
+        return false;
+    }
+    int expected = 1;
+    for (auto& stem : stems) {
+        if (stem.first != expected) {
+            entry->error = "Missing z plane " + std::to_string(expected) +
+                                                    " in '" + entry->dir + "'";
+            return false;
+        }
+        cv::Size size;
+        if (!imageSize(entry->dir + files[stem.first], &size)) {
+            entry->error = "Could not read the plane '" + entry->dir + files[stem.first] + "'";
+            return false;
+        }
+        if (entry->planes.empty()) entry->size = size;
+        if (size != entry->size) {
+            entry->error = "Plane '" + entry->dir + files[stem.first] + "' is " +
+                std::to_string(size.width) + "x" + std::to_string(size.height) + ", expected " +
+                std::to_string(entry->size.width) + "x" + std::to_string(entry->size.height);
+            return false;
+        }
+        entry->planes.push_back(stem.second);
+        expected++;
+    }
+    return true;
+}
+
+bool DatasetManifest::load(std::string index_file) {
+
+    entries_.clear();
+    std::ifstream index(index_file);
+    if (!index.is_open()) return false;
+    std::string line;
+    if (!getline(index, line) || (line != std::string(MANIFEST_HEADER) + "\t" + pattern_)) {
+        return false;
+    }
+    while (getline(index, line)) {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (getline(iss, field, '\t')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 5) continue;
+        StackEntry entry;
+        entry.dir = fields[0];
+        entry.mtime = atoll(fields[1].c_str());
+        entry.size = cv::Size(atoi(fields[2].c_str()), atoi(fields[3].c_str()));
+        entry.error = fields[4];
+        entry.planes.assign(fields.begin() + 5, fields.end());
+        entries_[entry.dir] = entry;
+    }
+    return true;
+}
+
+bool DatasetManifest::save(std::string index_file) const {
+
+    // Replace the index in one step, a concurrent run reads the old or the new one
+    std::string temp_file = index_file + ".tmp";
+    std::ofstream index(temp_file, std::ios::out);
+    if (!index.is_open()) {
+        std::cerr << "Could not create the manifest file." << std::endl;
+        return false;
+    }
+    index << MANIFEST_HEADER << "\t" << pattern_ << std::endl;
+    for (auto& entry : entries_) {
+        const StackEntry &stack = entry.second;
+        index << stack.dir << "\t" << stack.mtime << "\t" << stack.size.width << "\t"
+              << stack.size.height << "\t" << stack.error;
+        for (auto& plane : stack.planes) {
+            index << "\t" << plane;
+        }
+        index << "\n";
+    }
+    index.close();
+    if (!index || (rename(temp_file.c_str(), index_file.c_str()) != 0)) {
+        std::cerr << "Could not write the manifest file." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void DatasetManifest::update(const std::vector<std::string> &dirs, unsigned int workers) {
+
+    // The index is only read while the workers run, each fills its own slot
+    std::vector<StackEntry> scanned(dirs.size());
+    std::vector<char> changed(dirs.size(), false);
+    {
+        ThreadPool pool(std::max(1u, workers));
+        for (size_t i = 0; i < dirs.size(); i++) {
+            pool.submit([&, i]() {
+                std::string dir = dirPath(dirs[i]);
+                auto indexed = entries_.find(dir);
+                long long mtime = 0;
+                if ((indexed != entries_.end()) && dirModified(dir, &mtime) &&
+                                                (mtime == indexed->second.mtime)) {
+                    return;
+                }
+                scanStack(dir, pattern_, &scanned[i]);
+                changed[i] = true;
+            });
+        }
+        pool.wait();
+    }
+    for (size_t i = 0; i < dirs.size(); i++) {
+        if (changed[i]) entries_[scanned[i].dir] = scanned[i];
+    }
+}
+
+const StackEntry* DatasetManifest::find(std::string dir) const {
+    auto entry = entries_.find(dirPath(dir));
+    return (entry == entries_.end()) ? NULL : &entry->second;
+}
+
+const std::string& DatasetManifest::pattern() const {
+    return pattern_;
+}
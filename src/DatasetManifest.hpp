@@ -0,0 +1,75 @@
+#ifndef DATASET_MANIFEST_HPP
+#define DATASET_MANIFEST_HPP
+
+/* Dataset manifest
+   Index of the z planes of the image directories. The directories are
+   scanned concurrently once, the plane names are matched against a layer
+   pattern and the plane sizes are read from the TIFF and JPEG headers, so
+   missing, duplicate or mismatched planes are reported before any image is
+   decoded. The index is saved as a text file, one tab separated line per
+   directory:
+
+     directory, mtime, width, height, error, plane name...
+
+   Later runs reuse the lines of the directories whose modification time
+   has not changed and rescan the others.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+#include "opencv2/core/core.hpp"
+
+#define DEFAULT_LAYER_PATTERN   "{dir}_z{z}c1+2+3" // Plane name without the extension
+#define MANIFEST_SCAN_WORKERS   16  // Concurrent directory scans, bound by file system latency
+
+/* Z planes of an image directory */
+struct StackEntry {
+    std::string dir; // Directory, with the trailing '/'
+    long long mtime = 0; // Modification time of the directory when scanned
+    cv::Size size; // Size shared by the planes
+    std::vector<std::string> planes; // Plane names without the extension, in z order
+    std::string error; // Why the stack cannot be processed, empty if it can
+
+    /* Plane path without the extension, as taken by the layer reader */
+    std::string baseName(size_t z) const;
+};
+
+class DatasetManifest {
+
+public:
+    /* {dir} in the pattern stands for the directory name, {z} for the
+       z index, with or without leading zeros */
+    DatasetManifest(std::string pattern = DEFAULT_LAYER_PATTERN);
+
+    /* Load a saved index, it is ignored when it was built with another pattern */
+    bool load(std::string index_file);
+
+    bool save(std::string index_file) const;
+
+    /* Scan the directories that are not indexed or changed since */
+    void update(const std::vector<std::string> &dirs,
+                    unsigned int workers = MANIFEST_SCAN_WORKERS);
+
+    /* Entry of a directory, NULL if it is not indexed */
+    const StackEntry* find(std::string dir) const;
+
+    const std::string& pattern() const;
+
+    /* Scan one directory, false if its planes cannot be processed */
+    static bool scanStack(std::string dir, std::string pattern, StackEntry *entry);
+
+    /* Z index of a file of a directory, -1 if its name does not match the 
+       pattern. The stem is the name without the extension. */
+    static int planeIndex(std::string dir, std::string pattern, std::string file, 
+                            std::string *stem);
+
+    /* Valid patterns hold exactly one {z} */
+    static bool validPattern(std::string pattern);
+
+private:
+    std::string pattern_;
+    std::map<std::string, StackEntry> entries_;
+};
+
+#endif
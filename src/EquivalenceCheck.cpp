@@ -0,0 +1,233 @@
+#include <chrono>
+#include <iomanip>
+#include <math.h>
+#include <utility>
+
+#include "EquivalenceCheck.hpp"
+#include "ReferencePipeline.hpp"
+
+typedef std::vector<std::pair<std::string, double>> MetricColumns;
+
+/* Flatten the metrics into named columns, in csv order */
+static MetricColumns metricColumns(const WindowMetrics &metrics) {
+    MetricColumns columns;
+    columns.push_back(std::make_pair("astrocyte count", (double)metrics.astrocyte_count));
+    columns.push_back(std::make_pair("neuron count", (double)metrics.neuron_count));
+    columns.push_back(std::make_pair("mean astrocyte proximity",
+                                        (double)metrics.mean_astrocyte_proximity));
+    columns.push_back(std::make_pair("stddev astrocyte proximity",
+                                        (double)metrics.stddev_astrocyte_proximity));
+    auto addBins = [&columns](std::string name, const AreaBins &bins) {
+        columns.push_back(std::make_pair(name + " count", (double)bins.count));
+        for (size_t i = 0; i < bins.bins.size(); i++) {
+            columns.push_back(std::make_pair(name + " bin " + std::to_string(i),
+                                                (double)bins.bins[i]));
+        }
+    };
+    addBins("red low", metrics.red_low);
+    addBins("red high", metrics.red_high);
+    addBins("green-red high", metrics.green_red_high);
+    addBins("green-red low", metrics.green_red_low);
+    addBins("green high", metrics.green_high);
+    addBins("green low", metrics.green_low);
+    columns.push_back(std::make_pair("neuron rows", (double)metrics.neurons.size()));
+    return columns;
+}
+
+/* Fraction of the pixels that differ, the variant is resized to the reference
+   and its samples of another depth are scaled by value_scale */
+static double maskDifference(cv::Mat reference, cv::Mat variant, double value_scale) {
+    if (reference.empty() && variant.empty()) return 0.0;
+    if (!reference.empty() && !variant.empty() && (reference.depth() != variant.depth()) && 
+                                        (reference.channels() == variant.channels())) {
+        variant.convertTo(variant, reference.type(), value_scale);
+    }
+    if (reference.empty() || variant.empty() || (reference.type() != variant.type())) {
+        return 1.0;
+    }
+    if (variant.size() != reference.size()) {
+        cv::resize(variant, variant, reference.size(), 0, 0, cv::INTER_NEAREST);
+    }
+    cv::Mat differ;
+    cv::compare(reference, variant, differ, cv::CMP_NE);
+    if (differ.channels() > 1) {
+        cv::Mat pixels = differ.reshape(1, (int)differ.total());
+        cv::reduce(pixels, differ, 1, cv::REDUCE_MAX);
+    }
+    return (double)countNonZero(differ)/reference.total();
+}
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(
+                std::chrono::steady_clock::now() - start).count();
+}
+
+EquivalenceCheck::EquivalenceCheck(SegmentationConfig variant, VerifyTolerance tolerance) :
+    variant_(variant),
+    tolerance_(tolerance) {}
+
+bool EquivalenceCheck::skipped(const std::string &name) const {
+    for (auto& prefix : tolerance_.skip) {
+        if (name.compare(0, prefix.size(), prefix) == 0) return true;
+    }
+    return false;
+}
+
+bool EquivalenceCheck::compareWindow(std::string window,
+                                        const std::vector<cv::Mat> &reference_planes,
+                                        const std::vector<cv::Mat> &variant_planes,
+                                        double reference_prepare_ms) {
+    VerifyResult result;
+    result.window = window;
+
+    WindowMetrics reference_metrics, variant_metrics;
+    WindowImages reference_images, variant_images;
+    auto start = std::chrono::steady_clock::now();
+    bool reference_ok = referenceAnalyzeWindow(reference_planes, &reference_metrics,
+                                                    &reference_images);
+    result.reference_ms = reference_prepare_ms + elapsedMs(start);
+    start = std::chrono::steady_clock::now();
+    bool variant_ok = variant_.analyzeWindow(variant_planes, &variant_metrics,
+                                                    &variant_images);
+    result.variant_ms = elapsedMs(start);
+    if (!reference_ok || !variant_ok) {
+        result.worst_column = reference_ok ? "variant failed" : "reference failed";
+        result.column_diff = 1.0;
+        results_.push_back(result);
+        return false;
+    }
+
+    // Every metric column, relative to the larger of the two values
+    MetricColumns reference_columns = metricColumns(reference_metrics);
+    MetricColumns variant_columns = metricColumns(variant_metrics);
+    if (reference_columns.size() != variant_columns.size()) {
+        result.column_diff = 1.0;
+        result.worst_column = "column layout";
+    } else {
+        for (size_t i = 0; i < reference_columns.size(); i++) {
+            if (skipped(reference_columns[i].first)) continue;
+            double a = reference_columns[i].second, b = variant_columns[i].second;
+            double diff = fabs(a - b)/std::max(1.0, std::max(fabs(a), fabs(b)));
+            if (diff > result.column_diff) {
+                result.column_diff = diff;
+                result.worst_column = reference_columns[i].first;
+            }
+        }
+    }
+
+    // Every output mask, matched by name, planes of another bit depth rescaled
+    double value_scale = 255.0/((1 << variant_.config().bit_depth) - 1);
+    std::vector<std::pair<std::string, cv::Mat>> reference_masks = reference_images.debug;
+    std::vector<std::pair<std::string, cv::Mat>> variant_masks = variant_images.debug;
+    reference_masks.push_back(std::make_pair("processed", reference_images.processed));
+    variant_masks.push_back(std::make_pair("processed", variant_images.processed));
+    for (auto& reference_mask : reference_masks) {
+        if (skipped(reference_mask.first)) continue;
+        cv::Mat variant_mask;
+        for (auto& candidate : variant_masks) {
+            if (candidate.first == reference_mask.first) variant_mask = candidate.second;
+        }
+        double diff = maskDifference(reference_mask.second, variant_mask, value_scale);
+        if (diff > result.mask_diff) {
+            result.mask_diff = diff;
+            result.worst_mask = reference_mask.first;
+        }
+    }
+
+    result.pass = (result.column_diff <= tolerance_.column) &&
+                                        (result.mask_diff <= tolerance_.mask);
+    results_.push_back(result);
+    return result.pass;
+}
+
+void EquivalenceCheck::report(std::ostream &out) {
+    double reference_total = 0.0, variant_total = 0.0;
+    unsigned int failed = 0;
+    out << std::left << std::setw(32) << "window" << std::right
+        << std::setw(12) << "ref ms" << std::setw(12) << "variant ms"
+        << std::setw(9) << "speedup" << std::setw(12) << "column diff"
+        << std::setw(12) << "mask diff" << "  result" << std::endl;
+    for (auto& result : results_) {
+        reference_total += result.reference_ms;
+        variant_total += result.variant_ms;
+        if (!result.pass) failed++;
+        out << std::left << std::setw(32) << result.window << std::right << std::fixed
+            << std::setprecision(1) << std::setw(12) << result.reference_ms
+            << std::setw(12) << result.variant_ms << std::setprecision(2)
+            << std::setw(9) << result.reference_ms/std::max(result.variant_ms, 1e-3)
+            << std::setprecision(4) << std::setw(12) << result.column_diff
+            << std::setw(12) << result.mask_diff << "  "
+            << (result.pass ? "ok" : "FAIL");
+        if (!result.pass) {
+            out << " (" << result.worst_column
+                << ((!result.worst_column.empty() && !result.worst_mask.empty()) ? ", " : "")
+                << result.worst_mask << ")";
+        }
+        out << std::endl;
+    }
+    out << std::setprecision(1) << results_.size() << " window(s), " << failed
+        << " failed, reference " << reference_total << " ms, variant "
+        << variant_total << " ms, tolerances column " << std::setprecision(4) << tolerance_.column
+        << " mask " << tolerance_.mask << std::endl;
+    out.unsetf(std::ios::fixed);
+}
+
+bool EquivalenceCheck::passed() {
+    for (auto& result : results_) {
+        if (!result.pass) return false;
+    }
+    return true;
+}
+
+std::vector<cv::Mat> EquivalenceCheck::syntheticWindow(cv::Size size, unsigned int layers,
+                                                        unsigned int seed, double density) {
+    cv::RNG rng(seed);
+    cv::Mat blue = cv::Mat::zeros(size, CV_8UC1);
+    cv::Mat green = cv::Mat::zeros(size, CV_8UC1);
+    cv::Mat red = cv::Mat::zeros(size, CV_8UC1);
+    int unit = std::max(8, std::min(size.width, size.height)/40);
+    auto objects = [density](int count) { return (int)round(count*density); };
+
+    // Axons across the frame (green)
+    for (int i = 0; i < objects(12); i++) {
+        cv::Point from(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::Point to(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::line(green, from, to, cv::Scalar(rng.uniform(120, 255)), rng.uniform(1, 4));
+    }
+
+    // Nuclei (blue), about half of them wrapped in green like neurons
+    for (int i = 0; i < objects(40); i++) {
+        cv::Point center(rng.uniform(unit, size.width - unit),
+                            rng.uniform(unit, size.height - unit));
+        cv::Size axes(rng.uniform(unit/2, unit*2), rng.uniform(unit/4, unit));
+        double angle = rng.uniform(0.0, 180.0);
+        if (rng.uniform(0, 2)) {
+            cv::ellipse(green, center, cv::Size(axes.width + unit/3, axes.height + unit/3), angle, 0, 360,
+                            cv::Scalar(rng.uniform(150, 255)), cv::FILLED);
+        }
+        cv::ellipse(blue, center, axes, angle, 0, 360,
+                        cv::Scalar(rng.uniform(150, 255)), cv::FILLED);
+    }
+
+    // Synapse puncta (red), low and high intensity
+    for (int i = 0; i < objects(400); i++) {
+        cv::Point center(rng.uniform(0, size.width), rng.uniform(0, size.height));
+        cv::circle(red, center, rng.uniform(1, 5), cv::Scalar(rng.uniform(90, 255)), cv::FILLED);
+    }
+    cv::Mat scene;
+    std::vector<cv::Mat> channels = {blue, green, red};
+    cv::merge(channels, scene);
+
+    // Each z plane is the scene with its own intensity falloff and noise, 
+    // the falloff levels off in deep stacks
+    std::vector<cv::Mat> planes;
+    for (unsigned int z = 0; z < layers; z++) {
+        cv::Mat plane, noise(size, CV_8UC3);
+        scene.convertTo(plane, CV_8UC3, std::max(0.2, 1.0 - 0.1*fabs((double)z - layers/2.0)));
+        rng.fill(noise, cv::RNG::UNIFORM, 0, 12);
+        cv::add(plane, noise, plane);
+        cv::GaussianBlur(plane, plane, cv::Size(3,3), 0, 0);
+        planes.push_back(plane);
+    }
+    return planes;
+}
@@ -0,0 +1,66 @@
+#ifndef EQUIVALENCE_CHECK_HPP
+#define EQUIVALENCE_CHECK_HPP
+
+/* Equivalence check
+   Runs the frozen reference pipeline and a variant segmenter (pyramid,
+   neuron roi, preview scale or any later engine) on the same windows,
+   compares every metric column and every output mask within the given
+   tolerances, and prints a side-by-side timing and correctness report.
+ */
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "NeuronSeg.hpp"
+
+struct VerifyTolerance {
+    double column = 0.0; // Relative difference allowed in each metric column
+    double mask = 0.0; // Fraction of pixels allowed to differ in each mask
+    std::vector<std::string> skip; // Name prefixes of the columns and masks not compared
+};
+
+struct VerifyResult {
+    std::string window;
+    double reference_ms = 0.0;
+    double variant_ms = 0.0;
+    double column_diff = 0.0; // Largest relative column difference
+    std::string worst_column;
+    double mask_diff = 0.0; // Largest fraction of differing mask pixels
+    std::string worst_mask;
+    bool pass = false;
+};
+
+class EquivalenceCheck {
+
+public:
+    EquivalenceCheck(SegmentationConfig variant, VerifyTolerance tolerance);
+
+    /* Compare one window, the reference planes are 8-bit and full resolution,
+       the variant planes may be decoded at another scale or bit depth.
+       The time spent preparing the reference planes is added to its run time. */
+    bool compareWindow(std::string window, const std::vector<cv::Mat> &reference_planes,
+                            const std::vector<cv::Mat> &variant_planes,
+                            double reference_prepare_ms = 0.0);
+
+    /* Side-by-side report of the compared windows */
+    void report(std::ostream &out);
+
+    /* True when every compared window is within the tolerances */
+    bool passed();
+
+    /* Synthetic window of nuclei, axons and synapses drawn from a seed, with
+       density times the default number of objects */
+    static std::vector<cv::Mat> syntheticWindow(cv::Size size, unsigned int layers,
+                                                    unsigned int seed, double density = 1.0);
+
+private:
+    bool skipped(const std::string &name) const;
+
+    NeuronSegmenter variant_;
+    VerifyTolerance tolerance_;
+    std::vector<VerifyResult> results_;
+};
+
+#endif
@@ -0,0 +1,271 @@
+#include <algorithm>
+#include <iostream>
+
+#include "MaskVolume.hpp"
+
+/* Append an unsigned LEB128 varint */
+static void putVarint(uint32_t value, std::string *out) {
+    while (value >= 0x80) {
+        out->push_back((char)((value & 0x7F) | 0x80));
+        value >>= 7;
+    }
+    out->push_back((char)value);
+}
+
+static void putUint32(uint32_t value, std::ofstream *file) {
+    unsigned char bytes[4] = {(unsigned char)value, (unsigned char)(value >> 8),
+                                (unsigned char)(value >> 16), (unsigned char)(value >> 24)};
+    file->write((const char *)bytes, 4);
+}
+
+/* Run-length encode the rows of a binary mask, background run first */
+static std::string encodeRuns(cv::Mat mask) {
+    std::string payload;
+    for (int row = 0; row < mask.rows; row++) {
+        const uchar *ptr = mask.ptr<uchar>(row);
+        bool foreground = false;
+        uint32_t run = 0;
+        for (int col = 0; col < mask.cols; col++) {
+            if ((ptr[col] != 0) != foreground) {
+                putVarint(run, &payload);
+                foreground = !foreground;
+                run = 0;
+            }
+            run++;
+        }
+        putVarint(run, &payload);
+    }
+    return payload;
+}
+
+MaskVolumeWriter::MaskVolumeWriter(std::vector<std::string> channels, unsigned int downsample,
+                                        std::string mesh_channel) :
+    channels_(channels),
+    downsample_(std::max(1u, downsample)),
+    mesh_index_(-1),
+    header_written_(false),
+    mesh_depth_(0),
+    mesh_first_z_(0),
+    mesh_last_z_(0),
+    mesh_vertices_(NULL),
+    mesh_faces_(NULL),
+    vertex_count_(0),
+    face_count_(0),
+    mesh_failed_(false) {
+
+    for (size_t i = 0; i < channels_.size(); i++) {
+        if (channels_[i] == mesh_channel) mesh_index_ = (int)i;
+    }
+}
+
+MaskVolumeWriter::~MaskVolumeWriter() {
+    discardMesh();
+}
+
+const std::vector<std::string>& MaskVolumeWriter::channels() const {
+    return channels_;
+}
+
+bool MaskVolumeWriter::open(std::string path) {
+    file_.open(path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!file_.is_open()) {
+        std::cerr << "Could not create the mask volume " << path << std::endl;
+        return false;
+    }
+    header_written_ = false;
+    discardMesh();
+    return true;
+}
+
+void MaskVolumeWriter::discardMesh() {
+    if (mesh_vertices_) fclose(mesh_vertices_);
+    if (mesh_faces_) fclose(mesh_faces_);
+    mesh_vertices_ = NULL;
+    mesh_faces_ = NULL;
+    mesh_previous_.release();
+    mesh_lower_.clear();
+    mesh_upper_.clear();
+    mesh_depth_ = 0;
+    vertex_count_ = 0;
+    face_count_ = 0;
+    mesh_failed_ = false;
+}
+
+void MaskVolumeWriter::writeHeader(cv::Size size) {
+    size_ = size;
+    file_.write("NSVOL001", 8);
+    putUint32((uint32_t)size.width, &file_);
+    putUint32((uint32_t)size.height, &file_);
+    putUint32(downsample_, &file_);
+    putUint32((uint32_t)channels_.size(), &file_);
+    for (auto& channel : channels_) {
+        unsigned char length = (unsigned char)std::min<size_t>(channel.size(), 255);
+        file_.put((char)length);
+        file_.write(channel.data(), length);
+    }
+    header_written_ = true;
+}
+
+bool MaskVolumeWriter::addSlice(unsigned int z, const std::vector<cv::Mat> &masks) {
+    if (!file_.is_open() || (masks.size() != channels_.size())) return false;
+
+    for (size_t i = 0; i < masks.size(); i++) {
+
+        // Downsampled pixels are set when most of their block is set
+        cv::Mat mask = masks[i];
+        if (downsample_ > 1) {
+            cv::resize(mask, mask, cv::Size(mask.cols/downsample_, mask.rows/downsample_),
+                            0, 0, cv::INTER_AREA);
+            cv::threshold(mask, mask, 127, 255, cv::THRESH_BINARY);
+        }
+        if (!header_written_) writeHeader(mask.size());
+        if (mask.size() != size_) {
+            std::cerr << "Mask volume slices must have the same size" << std::endl;
+            return false;
+        }
+
+        std::string payload = encodeRuns(mask);
+        putUint32(z, &file_);
+        putUint32((uint32_t)i, &file_);
+        putUint32((uint32_t)payload.size(), &file_);
+        file_.write(payload.data(), payload.size());
+
+        if (((int)i == mesh_index_) && !mesh_failed_) {
+            if (mesh_depth_ && (z <= mesh_last_z_)) {
+                std::cerr << "Mask volume mesh slices must arrive in z order, "
+                          << "the mesh is dropped" << std::endl;
+                mesh_failed_ = true;
+            } else {
+                if (!mesh_depth_) mesh_first_z_ = z;
+                mesh_last_z_ = z;
+                if (!meshSlice(mask)) mesh_failed_ = true;
+            }
+        }
+    }
+    return file_.good();
+}
+
+/* Index of the mesh vertex at corner (x, y) of z plane mesh_depth_ - 1 or
+   mesh_depth_, the planes below and above the newest slice */
+int MaskVolumeWriter::meshVertex(int x, int y, unsigned int plane) {
+    std::unordered_map<uint64_t, int> &indices = (plane == mesh_depth_) ? mesh_upper_
+                                                                        : mesh_lower_;
+    uint64_t key = (uint64_t)y*(size_.width + 1) + x;
+    auto found = indices.find(key);
+    if (found != indices.end()) return found->second;
+    int index = (int)vertex_count_++;
+    indices[key] = index;
+    float position[3] = {(float)(x*downsample_), (float)(y*downsample_),
+                            (float)(mesh_first_z_ + plane)};
+    fwrite(position, sizeof(float), 3, mesh_vertices_);
+    return index;
+}
+
+void MaskVolumeWriter::quad(int a, int b, int c, int d) {
+    int corners[4] = {a, b, c, d};
+    fputc(4, mesh_faces_);
+    fwrite(corners, sizeof(int), 4, mesh_faces_);
+    face_count_++;
+}
+
+bool MaskVolumeWriter::meshSlice(const cv::Mat &mask) {
+    if (!mesh_vertices_) {
+        mesh_vertices_ = tmpfile();
+        mesh_faces_ = tmpfile();
+        if (!mesh_vertices_ || !mesh_faces_) {
+            std::cerr << "Could not create the temporary mesh files" << std::endl;
+            return false;
+        }
+    }
+
+    // The vertices of the z plane between the previous slice and this one
+    // were the upper plane of the previous slice
+    mesh_lower_.swap(mesh_upper_);
+    mesh_upper_.clear();
+    mesh_depth_++;
+    unsigned int zi = mesh_depth_ - 1;
+    int width = size_.width, height = size_.height;
+    auto set = [&](const cv::Mat &slice, int x, int y) {
+        return !slice.empty() && (slice.at<uchar>(y, x) != 0);
+    };
+
+    // Faces between the previous slice and this one, an empty mask is the
+    // unset slice above the last
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool below = set(mesh_previous_, x, y), above = set(mask, x, y);
+            if (below && !above) quad(meshVertex(x, y, zi), meshVertex(x+1, y, zi),
+                                        meshVertex(x+1, y+1, zi), meshVertex(x, y+1, zi));
+            if (above && !below) quad(meshVertex(x, y, zi), meshVertex(x, y+1, zi),
+                                        meshVertex(x+1, y+1, zi), meshVertex(x+1, y, zi));
+        }
+    }
+    if (mask.empty()) return !ferror(mesh_vertices_) && !ferror(mesh_faces_);
+
+    // Side faces of this slice, between its set and unset pixels
+    auto voxel = [&](int x, int y) {
+        return (x >= 0) && (y >= 0) && (x < width) && (y < height) && set(mask, x, y);
+    };
+    for (int y = 0; y < height; y++) {
+        const uchar *ptr = mask.ptr<uchar>(y);
+        for (int x = 0; x < width; x++) {
+            if (!ptr[x]) continue;
+            if (!voxel(x-1, y)) quad(meshVertex(x, y, zi), meshVertex(x, y, zi+1),
+                                        meshVertex(x, y+1, zi+1), meshVertex(x, y+1, zi));
+            if (!voxel(x+1, y)) quad(meshVertex(x+1, y, zi), meshVertex(x+1, y+1, zi),
+                                        meshVertex(x+1, y+1, zi+1), meshVertex(x+1, y, zi+1));
+            if (!voxel(x, y-1)) quad(meshVertex(x, y, zi), meshVertex(x+1, y, zi),
+                                        meshVertex(x+1, y, zi+1), meshVertex(x, y, zi+1));
+            if (!voxel(x, y+1)) quad(meshVertex(x, y+1, zi), meshVertex(x, y+1, zi+1),
+                                        meshVertex(x+1, y+1, zi+1), meshVertex(x+1, y+1, zi));
+        }
+    }
+    mesh_previous_ = mask.clone();
+    return !ferror(mesh_vertices_) && !ferror(mesh_faces_);
+}
+
+bool MaskVolumeWriter::close(std::string mesh_path) {
+    if (!file_.is_open()) return false;
+    bool ok = file_.good();
+    file_.close();
+    if (ok && (mesh_index_ >= 0) && !mesh_path.empty() && mesh_depth_ && !mesh_failed_) {
+        ok = writeMesh(mesh_path);
+    }
+    discardMesh();
+    return ok;
+}
+
+/* Copy a temporary mesh file to the end of the mesh */
+static bool appendFile(FILE *source, std::ofstream *mesh) {
+    if (fflush(source) || fseek(source, 0, SEEK_SET)) return false;
+    std::vector<char> buffer(1 << 16);
+    size_t count;
+    while ((count = fread(buffer.data(), 1, buffer.size(), source)) > 0) {
+        mesh->write(buffer.data(), count);
+    }
+    return !ferror(source);
+}
+
+bool MaskVolumeWriter::writeMesh(std::string mesh_path) {
+
+    // Top faces of the last slice
+    if (!meshSlice(cv::Mat())) return false;
+
+    // Binary little endian PLY, the host is assumed little endian
+    std::ofstream mesh(mesh_path, std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!mesh.is_open()) {
+        std::cerr << "Could not create the mesh " << mesh_path << std::endl;
+        return false;
+    }
+    mesh << "ply\nformat binary_little_endian 1.0\n"
+         << "comment " << channels_[mesh_index_] << " mask, z in window units\n"
+         << "element vertex " << vertex_count_ << "\n"
+         << "property float x\nproperty float y\nproperty float z\n"
+         << "element face " << face_count_ << "\n"
+         << "property list uchar int vertex_indices\nend_header\n";
+    if (!appendFile(mesh_vertices_, &mesh) || !appendFile(mesh_faces_, &mesh)) {
+        std::cerr << "Could not read the temporary mesh files" << std::endl;
+        return false;
+    }
+    return mesh.good();
+}
@@ -0,0 +1,81 @@
+#ifndef MASK_VOLUME_HPP
+#define MASK_VOLUME_HPP
+
+/* Mask volume export
+   Writes the masks of the selected channels of every window of a directory
+   into one chunked file, each slice run-length encoded, optionally
+   downsampled in x and y. The file layout (little endian):
+
+     "NSVOL001", uint32 width, height, downsample, channel count,
+     per channel: uint8 name length, name
+     per slice: uint32 z, uint32 channel, uint32 payload bytes, payload
+
+   The payload holds, row after row, the alternating background and
+   foreground run lengths (background first) as LEB128 varints. A
+   voxel boundary mesh of one channel can be written as PLY. Its faces are
+   emitted as the slices arrive, in z order, to temporary files, so only the
+   previous slice of the mesh channel is kept.
+ */
+
+#include <fstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+class MaskVolumeWriter {
+
+public:
+    MaskVolumeWriter(std::vector<std::string> channels, unsigned int downsample = 1,
+                        std::string mesh_channel = "");
+    ~MaskVolumeWriter();
+
+    /* Create the volume file, the header is written with the first slice */
+    bool open(std::string path);
+
+    /* Append the masks of window z, in the order of the channels */
+    bool addSlice(unsigned int z, const std::vector<cv::Mat> &masks);
+
+    /* Finish the volume and write the mesh of the mesh channel, if any */
+    bool close(std::string mesh_path = "");
+
+    const std::vector<std::string>& channels() const;
+
+private:
+    void writeHeader(cv::Size size);
+
+    /* Emit the faces of the next mesh slice, an empty slice closes the mesh */
+    bool meshSlice(const cv::Mat &mask);
+
+    int meshVertex(int x, int y, unsigned int plane);
+
+    void quad(int a, int b, int c, int d);
+
+    bool writeMesh(std::string mesh_path);
+
+    void discardMesh();
+
+    std::vector<std::string> channels_;
+    unsigned int downsample_;
+    int mesh_index_;
+    std::ofstream file_;
+    bool header_written_;
+    cv::Size size_;
+    // Mesh state: the previous slice, the vertex indices of the z planes
+    // below and above the newest slice, and the vertex and face files
+    cv::Mat mesh_previous_;
+    unsigned int mesh_depth_;
+    unsigned int mesh_first_z_;
+    unsigned int mesh_last_z_;
+    std::unordered_map<uint64_t, int> mesh_lower_;
+    std::unordered_map<uint64_t, int> mesh_upper_;
+    FILE *mesh_vertices_;
+    FILE *mesh_faces_;
+    size_t vertex_count_;
+    size_t face_count_;
+    bool mesh_failed_;
+};
+
+#endif
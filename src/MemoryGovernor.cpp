@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <unistd.h>
+
+#include "MemoryGovernor.hpp"
+
+MemoryGovernor::MemoryGovernor() :
+    budget_(0),
+    reserved_(0),
+    peak_reserved_(0) {}
+
+void MemoryGovernor::setBudget(size_t budget) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        budget_ = budget;
+    }
+    released_cv_.notify_all();
+}
+
+void MemoryGovernor::acquire(size_t bytes) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    released_cv_.wait(lock, [this, bytes] {
+        return (!budget_) || (!reserved_) || (reserved_ + bytes <= budget_);
+    });
+    reserved_ += bytes;
+    if (reserved_ > peak_reserved_) peak_reserved_ = reserved_;
+}
+
+void MemoryGovernor::release(size_t bytes) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        reserved_ = (bytes < reserved_) ? reserved_ - bytes : 0;
+    }
+    released_cv_.notify_all();
+}
+
+void MemoryGovernor::sampleStage(std::string stage) {
+    size_t resident = residentBytes();
+    std::unique_lock<std::mutex> lock(mutex_);
+    auto entry = stage_peak_.find(stage);
+    if (entry == stage_peak_.end()) {
+        stage_order_.push_back(stage);
+        stage_peak_[stage] = resident;
+    } else if (resident > entry->second) {
+        entry->second = resident;
+    }
+}
+
+void MemoryGovernor::report(std::ostream &out) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    const double mb = 1024.0 * 1024.0;
+    out << "Peak resident memory per stage (MB):" << std::endl;
+    for (auto& stage : stage_order_) {
+        out << "  " << stage << ": " << stage_peak_[stage]/mb << std::endl;
+    }
+    out << "Peak reserved footprint (MB): " << peak_reserved_/mb;
+    if (budget_) out << " of a " << budget_/mb << " MB budget";
+    out << std::endl;
+}
+
+size_t MemoryGovernor::residentBytes() {
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (!file) return 0;
+    unsigned long size = 0, resident = 0;
+    int fields = fscanf(file, "%lu %lu", &size, &resident);
+    fclose(file);
+    if (fields != 2) return 0;
+    return (size_t) resident * (size_t) sysconf(_SC_PAGESIZE);
+}
+
+MemoryReservation::MemoryReservation(MemoryGovernor *governor, size_t bytes) :
+    governor_(governor),
+    bytes_(bytes) {
+    governor_->acquire(bytes_);
+}
+
+MemoryReservation::~MemoryReservation() {
+    governor_->release(bytes_);
+}
@@ -0,0 +1,69 @@
+#ifndef MEMORY_GOVERNOR_HPP
+#define MEMORY_GOVERNOR_HPP
+
+/* Memory governor
+   Admits work against a memory budget. A job reserves its estimated
+   footprint before it starts and blocks while the reservation would exceed
+   the budget, so concurrent workers back off instead of running the node
+   out of memory. A job larger than the whole budget is admitted alone.
+   The resident memory at the end of each pipeline stage is sampled and its
+   peak over all windows is reported.
+ */
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <ostream>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class MemoryGovernor {
+
+public:
+    MemoryGovernor();
+
+    /* Budget in bytes, 0 disables admission control */
+    void setBudget(size_t budget);
+
+    /* Block until the bytes fit in the budget, then reserve them */
+    void acquire(size_t bytes);
+
+    /* Return a reservation */
+    void release(size_t bytes);
+
+    /* Record the resident memory at the end of a stage */
+    void sampleStage(std::string stage);
+
+    /* Peak resident memory of each stage, in the order first sampled */
+    void report(std::ostream &out);
+
+    /* Current resident set size of the process in bytes */
+    static size_t residentBytes();
+
+private:
+    std::mutex mutex_;
+    std::condition_variable released_cv_;
+    size_t budget_;
+    size_t reserved_;
+    size_t peak_reserved_;
+    std::vector<std::string> stage_order_;
+    std::map<std::string, size_t> stage_peak_;
+};
+
+/* Reservation held for the lifetime of a job */
+class MemoryReservation {
+
+public:
+    MemoryReservation(MemoryGovernor *governor, size_t bytes);
+    ~MemoryReservation();
+
+private:
+    MemoryReservation(const MemoryReservation&);
+    MemoryReservation& operator=(const MemoryReservation&);
+
+    MemoryGovernor *governor_;
+    size_t bytes_;
+};
+
+#endif
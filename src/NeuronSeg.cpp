@@ -0,0 +1,1448 @@
+#include <algorithm>
+#include <climits>
+#include <iostream>
+#include <map>
+#include <math.h>
+#include <random>
+#include <sstream>
+#include <utility>
+
+#include "opencv2/photo/photo.hpp"
+
+#include "BitMask.hpp"
+#include "ContourStore.hpp"
+#include "NeuronSeg.hpp"
+#include "OverlapJoin.hpp"
+#include "OverlayRenderer.hpp"
+#include "ShapeDescriptors.hpp"
+#include "WatershedSegmentation.hpp"
+
+/* Channel type */
+enum class ChannelType : unsigned char {
+    BLUE = 0,
+    GREEN_LOW,
+    GREEN_HIGH,
+    GREEN_COMBINED,
+    ENHANCE_AXON,
+    RED_LOW,
+    RED_HIGH
+};
+
+/* Canny Edge Detection */
+static void CannyThreshold(cv::Mat src, cv::Mat *dst) {
+
+    cv::Mat detected_edges;
+    blur(src, detected_edges, cv::Size(3,3));
+    Canny(detected_edges, detected_edges, 0, 255, 3);
+    *dst = cv::Scalar::all(0);
+    src.copyTo(*dst, detected_edges);
+}
+
+/* Invert the intensities of a 8 or 16-bit image whose samples reach max_value */
+static void invertIntensity(cv::Mat src, double max_value, cv::Mat *dst) {
+
+    if (src.depth() == CV_8U) {
+        bitwise_not(src, *dst);
+    } else {
+        cv::subtract(cv::Scalar::all(max_value), src, *dst);
+    }
+}
+
+/* Intermediates of a window, keyed by the stage and the parameters they depend on */
+struct WindowCacheEntries {
+    std::map<std::string, cv::Mat> mats;
+    std::map<std::string, ContourStore> contours;
+    std::map<std::string, std::vector<ShapeDescriptor>> shapes;
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+};
+
+/* Cache key of a stage and the parameters it depends on */
+static std::string cacheKey(std::string stage, std::vector<double> params) {
+
+    std::ostringstream key;
+    key << stage;
+    for (auto param : params) {
+        key << " " << param;
+    }
+    return key.str();
+}
+
+/* Look up a cache entry, counting the hits and misses. The entry is
+   returned in place, NULL when it is missing. */
+template <typename T>
+static const T* findEntry(WindowCacheEntries *cache, const std::map<std::string, T> &entries, 
+                            const std::string &key) {
+
+    auto found = entries.find(key);
+    if (found == entries.end()) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    return &found->second;
+}
+
+/* Look up a cached image, the header shares the cached pixels */
+static bool findMat(WindowCacheEntries *cache, const std::string &key, cv::Mat *value) {
+
+    const cv::Mat *found = findEntry(cache, cache->mats, key);
+    if (found) *value = *found;
+    return found != NULL;
+}
+
+/* Enhance the image, a 8-bit window or a 16-bit one whose samples reach 
+   max_value. The thresholds are given on the 8-bit scale and the result 
+   is always a 0/255 8-bit mask. Each mask is binarized by its first 
+   comparison, only the blurred floor is kept at the source depth. The 
+   grayscale window and its blurred floor masks are shared through the 
+   cache when it is not NULL. */
+static bool enhanceImage(cv::Mat src, ChannelType channel_type, 
+                            const SegmentationConfig &config, cv::Mat *dst, 
+                            double max_value = 255.0, WindowCacheEntries *cache = NULL) {
+
+    // Thresholds on the 8-bit scale, and the all ones mask value of the depth
+    auto level = [max_value](double value) { return value*max_value/255.0; };
+    double ones = (src.depth() == CV_8U) ? 255.0 : 65535.0;
+
+    // Cached intermediates are named after the window they come from
+    std::string source = "green";
+    if (channel_type == ChannelType::BLUE) source = "blue";
+    if ((channel_type == ChannelType::RED_LOW) || (channel_type == ChannelType::RED_HIGH)) {
+        source = "red";
+    }
+
+    // Convert to grayscale
+    auto grayWindow = [&]() {
+        cv::Mat src_gray;
+        std::string key = source + " gray";
+        if (!cache || !findMat(cache, key, &src_gray)) {
+            cvtColor(src, src_gray, cv::COLOR_BGR2GRAY);
+            if (cache) cache->mats[key] = src_gray;
+        }
+        return src_gray;
+    };
+
+    // Blurred inverse of the samples above a floor, the base of every mask
+    auto floorMask = [&](double floor) {
+        cv::Mat blurred;
+        std::string key = cacheKey(source + " floor", {floor});
+        if (!cache || !findMat(cache, key, &blurred)) {
+            cv::Mat masked;
+            cv::threshold(grayWindow(), masked, level(floor), ones, cv::THRESH_TOZERO);
+            invertIntensity(masked, max_value, &masked);
+            cv::GaussianBlur(masked, blurred, cv::Size(3,3), 0, 0);
+            if (cache) cache->mats[key] = blurred;
+        }
+        return blurred;
+    };
+
+    // Enhance the image using Gaussian blur and thresholding
+    cv::Mat enhanced;
+    switch(channel_type) {
+        case ChannelType::BLUE: {
+            // Enhance the blue channel
+
+            // Create the inverted mask
+            cv::compare(floorMask(50), level(220), enhanced, cv::CMP_LE);
+        } break;
+
+        case ChannelType::GREEN_LOW: {
+            // Enhance the green channel low intensities
+
+            // Create the mask of the low intensity features, above the mask 
+            // and low levels and not above the ceiling
+            cv::Mat blurred = floorMask(config.green_floor);
+            cv::Mat ceiling;
+            cv::compare(blurred, level(std::max(config.green_mask_level, 1.0f)), enhanced, 
+                                                                cv::CMP_GT);
+            cv::compare(blurred, level(250), ceiling, cv::CMP_LE);
+            bitwise_and(enhanced, ceiling, enhanced);
+        } break;
+
+        case ChannelType::GREEN_HIGH: {
+            // Enhance the green channel high intensities
+
+            // Create the inverted mask
+            cv::compare(floorMask(config.green_floor), level(config.green_mask_level), 
+                                                                enhanced, cv::CMP_LE);
+        } break;
+
+        case ChannelType::GREEN_COMBINED: {
+            // Enhance the green channel (high and low combined)
+
+            // Create the inverted mask
+            cv::compare(floorMask(25), level(config.green_combined_level), enhanced, 
+                                                                cv::CMP_LE);
+        } break;
+
+        case ChannelType::ENHANCE_AXON: {
+            // Create and enhance the axon boundary mask, Canny works on 8-bit only
+            cv::Mat src_gray = grayWindow();
+            if (src_gray.depth() != CV_8U) {
+                src_gray.convertTo(src_gray, CV_8U, 255.0/max_value);
+            }
+            cv::Mat denoised;
+            cv::fastNlMeansDenoising(src_gray, denoised, 3.0);
+            cv::threshold(denoised, denoised, 5, 255, cv::THRESH_BINARY);
+            CannyThreshold(denoised, &enhanced);
+        } break;
+
+        case ChannelType::RED_LOW: {
+            // Enhance the red channel low intensities
+
+            // Create the mask of the low intensity features, above the mask 
+            // and low levels and not above the ceiling
+            cv::Mat blurred = floorMask(config.red_floor);
+            cv::Mat ceiling;
+            cv::compare(blurred, level(std::max(config.red_mask_level, config.red_low_level)), 
+                                                                enhanced, cv::CMP_GT);
+            cv::compare(blurred, level(config.red_low_ceiling), ceiling, cv::CMP_LE);
+            bitwise_and(enhanced, ceiling, enhanced);
+        } break;
+
+        case ChannelType::RED_HIGH: {
+            // Enhance the red channel higher intensities
+
+            // Create the inverted mask
+            cv::compare(floorMask(config.red_floor), level(config.red_mask_level), 
+                                                                enhanced, cv::CMP_LE);
+        } break;
+
+        default: {
+            std::cerr << "Invalid channel type" << std::endl;
+            return false;
+        }
+    }
+
+    *dst = enhanced;
+    return true;
+}
+
+/* Find the contours in the image and append them to the store, shifted by offset */
+static void contourCalc(cv::Mat src, ChannelType channel_type, 
+                    double min_area, cv::Mat *dst, ContourStore *contours, 
+                    cv::Point offset = cv::Point()) {
+
+    cv::Mat temp_src;
+    src.copyTo(temp_src);
+    std::vector<std::vector<cv::Point>> found;
+    std::vector<cv::Vec4i> found_hierarchy;
+    switch(channel_type) {
+        case ChannelType::BLUE: {
+            findContours(temp_src, found, found_hierarchy, cv::RETR_EXTERNAL, 
+                                                cv::CHAIN_APPROX_SIMPLE, offset);
+        } break;
+
+        case ChannelType::RED_LOW : 
+        case ChannelType::RED_HIGH: 
+        case ChannelType::GREEN_LOW: 
+        case ChannelType::GREEN_HIGH: {
+            findContours(temp_src, found, found_hierarchy, cv::RETR_CCOMP, 
+                                                cv::CHAIN_APPROX_SIMPLE, offset);
+        } break;
+
+        default: return;
+    }
+
+    *dst = cv::Mat::zeros(temp_src.size(), CV_8UC3);
+    if (!found.size()) return;
+
+    // Pack the contours once, every later stage works on views into the store
+    int base_index = contours->append(found, found_hierarchy);
+    const std::vector<cv::Vec4i> &hierarchy = contours->hierarchy();
+    std::vector<cv::Mat> contour_mats = contours->mats();
+
+    // Keep the contours whose size is >= than min_area
+    cv::RNG rng(12345);
+    for (int index = base_index; index < (int)contours->size(); index++) {
+        if (hierarchy[index][3] > -1) continue; // ignore child
+        double area_external = fabs(contourArea(contour_mats[index]));
+        if (area_external < min_area) continue;
+
+        std::vector<int> cntr_list;
+        cntr_list.push_back(index);
+
+        int index_hole = hierarchy[index][2];
+        double area_hole = 0.0;
+        while (index_hole > -1) {
+            double temp_area_hole = fabs(contourArea(contour_mats[index_hole]));
+            if (temp_area_hole) {
+                cntr_list.push_back(index_hole);
+                area_hole += temp_area_hole;
+            }
+            index_hole = hierarchy[index_hole][0];
+        }
+        double area_contour = area_external - area_hole;
+        if (area_contour >= min_area) {
+            contours->setType(cntr_list[0], HierarchyType::PARENT_CNTR);
+            contours->setArea(cntr_list[0], area_contour);
+            for (unsigned int i = 1; i < cntr_list.size(); i++) {
+                contours->setType(cntr_list[i], HierarchyType::CHILD_CNTR);
+            }
+            cv::Scalar color = cv::Scalar(rng.uniform(0, 255), rng.uniform(0,255), 
+                                            rng.uniform(0,255));
+            drawContours(*dst, contour_mats, index, color, cv::FILLED, cv::LINE_8, 
+                            hierarchy, INT_MAX, cv::Point(-offset.x, -offset.y));
+        }
+    }
+}
+
+/* Enhance the image only inside the given regions, the cache is used for the whole frame */
+static bool regionEnhanceImage(cv::Mat src, ChannelType channel_type, 
+                            const SegmentationConfig &config, std::vector<cv::Rect> regions, 
+                            double max_value, cv::Mat *dst, WindowCacheEntries *cache = NULL) {
+
+    // A single region covering the whole frame is a plain enhancement
+    if ((regions.size() == 1) && (regions[0] == cv::Rect(0, 0, src.cols, src.rows))) {
+        return enhanceImage(src, channel_type, config, dst, max_value, cache);
+    }
+
+    *dst = cv::Mat::zeros(src.size(), CV_8UC1);
+    for (auto& roi : regions) {
+        cv::Mat roi_enhanced;
+        if (!enhanceImage(src(roi), channel_type, config, &roi_enhanced, max_value)) {
+            return false;
+        }
+        roi_enhanced.copyTo((*dst)(roi));
+    }
+    return true;
+}
+
+/* Find the contours only inside the given regions */
+static void regionContourCalc(cv::Mat src, ChannelType channel_type, 
+                        double min_area, std::vector<cv::Rect> regions, 
+                        cv::Mat *dst, ContourStore *contours) {
+
+    // A single region covering the whole frame is a plain contour calculation
+    contours->clear();
+    if ((regions.size() == 1) && (regions[0] == cv::Rect(0, 0, src.cols, src.rows))) {
+        contourCalc(src, channel_type, min_area, dst, contours);
+        return;
+    }
+
+    // The regions append straight to the store, in frame coordinates
+    *dst = cv::Mat::zeros(src.size(), CV_8UC3);
+    for (auto& roi : regions) {
+        cv::Mat roi_segmented;
+        size_t contour_cnt = contours->size();
+        contourCalc(src(roi), channel_type, min_area, &roi_segmented, contours, roi.tl());
+        if (contours->size() == contour_cnt) continue;
+        roi_segmented.copyTo((*dst)(roi));
+    }
+}
+
+/* Merge the overlapping rectangles */
+static void mergeOverlappingRects(std::vector<cv::Rect> *rects) {
+
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (size_t i = 0; i < rects->size(); i++) {
+            for (size_t j = i+1; j < rects->size(); j++) {
+                if (((*rects)[i] & (*rects)[j]).area() > 0) {
+                    (*rects)[i] |= (*rects)[j];
+                    rects->erase(rects->begin() + j);
+                    merged = true;
+                    j--;
+                }
+            }
+        }
+    }
+}
+
+/* Coarse-to-fine nucleus detection on an image pyramid */
+static bool pyramidContourCalc(cv::Mat src, const SegmentationConfig &config, double min_area, 
+                            double max_value, cv::Mat *enhanced, cv::Mat *dst, ContourStore *contours) {
+
+    // Find the candidate nuclei on the downsampled level
+    cv::Mat coarse = src;
+    for (unsigned int i = 0; i < config.pyramid_levels; i++) {
+        cv::pyrDown(coarse, coarse);
+    }
+    int factor = 1 << config.pyramid_levels;
+    cv::Mat coarse_enhanced, coarse_segmented;
+    if (!enhanceImage(coarse, ChannelType::BLUE, config, &coarse_enhanced, max_value)) {
+        return false;
+    }
+    ContourStore coarse_contours;
+
+    // Halve the area threshold so that nuclei shrunk by the blur are not missed
+    contourCalc(coarse_enhanced, ChannelType::BLUE, min_area/(2.0*factor*factor), 
+                    &coarse_segmented, &coarse_contours);
+
+    // Map the candidates to padded full resolution regions
+    cv::Rect frame(0, 0, src.cols, src.rows);
+    int pad = 2*factor + 2;
+    std::vector<cv::Rect> rois;
+    for (auto index : coarse_contours.select(HierarchyType::PARENT_CNTR)) {
+        cv::Rect bound = boundingRect(coarse_contours.contour(index).mat());
+        cv::Rect roi(bound.x*factor - pad, bound.y*factor - pad, 
+                        bound.width*factor + 2*pad, bound.height*factor + 2*pad);
+        rois.push_back(roi & frame);
+    }
+    mergeOverlappingRects(&rois);
+
+    // Refine the contours only inside the full resolution regions
+    if (!regionEnhanceImage(src, ChannelType::BLUE, config, rois, max_value, enhanced)) {
+        return false;
+    }
+    regionContourCalc(*enhanced, ChannelType::BLUE, min_area, rois, dst, contours);
+    return true;
+}
+
+/* Regions made of the tiles that intersect the neuron rois */
+static std::vector<cv::Rect> neuronRoiRegions(cv::Size frame_size, 
+                                        std::vector<cv::Point2f> neuron_centers, 
+                                        float neuron_roi, int tile_size) {
+
+    // Mark the tiles that are within neuron_roi of any neuron center
+    int tiles_x = (frame_size.width + tile_size - 1)/tile_size;
+    int tiles_y = (frame_size.height + tile_size - 1)/tile_size;
+    cv::Mat tiles = cv::Mat::zeros(tiles_y, tiles_x, CV_8UC1);
+    for (auto& center : neuron_centers) {
+        int x_begin = std::max(0, (int)floor((center.x - neuron_roi)/tile_size));
+        int x_end = std::min(tiles_x-1, (int)floor((center.x + neuron_roi)/tile_size));
+        int y_begin = std::max(0, (int)floor((center.y - neuron_roi)/tile_size));
+        int y_end = std::min(tiles_y-1, (int)floor((center.y + neuron_roi)/tile_size));
+        for (int ty = y_begin; ty <= y_end; ty++) {
+            for (int tx = x_begin; tx <= x_end; tx++) {
+                // Distance from the center to the closest point of the tile
+                float dx = std::max(0.0f, std::max(tx*tile_size - center.x, 
+                                                    center.x - (tx+1)*tile_size));
+                float dy = std::max(0.0f, std::max(ty*tile_size - center.y, 
+                                                    center.y - (ty+1)*tile_size));
+                if (dx*dx + dy*dy <= neuron_roi*neuron_roi) {
+                    tiles.at<uchar>(ty, tx) = 255;
+                }
+            }
+        }
+    }
+
+    // Group the connected tiles into regions
+    std::vector<std::vector<cv::Point>> tile_groups;
+    findContours(tiles, tile_groups, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_SIMPLE);
+    cv::Rect frame(0, 0, frame_size.width, frame_size.height);
+    std::vector<cv::Rect> regions;
+    for (auto& group : tile_groups) {
+        cv::Rect bound = boundingRect(group);
+        cv::Rect region(bound.x*tile_size, bound.y*tile_size, 
+                            bound.width*tile_size, bound.height*tile_size);
+        regions.push_back(region & frame);
+    }
+    mergeOverlappingRects(&regions);
+    return regions;
+}
+
+/* Split the touching nuclei with a bounding box local watershed */
+static void splitTouchingNuclei(double min_area, ContourStore *contours) {
+
+    std::vector<int> nuclei = contours->select(HierarchyType::PARENT_CNTR);
+    WatershedSegmentation watershed(min_area);
+    std::vector<std::vector<std::vector<cv::Point>>> pieces;
+    watershed.apply(*contours, nuclei, &pieces);
+
+    // Replace each split nucleus by its pieces
+    for (size_t i = 0; i < pieces.size(); i++) {
+        if (pieces[i].empty()) continue;
+        contours->setType(nuclei[i], HierarchyType::INVALID_CNTR);
+        contours->setArea(nuclei[i], 0.0);
+        for (auto& piece : pieces[i]) {
+            contours->append(piece, HierarchyType::PARENT_CNTR, 
+                                fabs(contourArea(cv::Mat(piece))));
+        }
+    }
+}
+
+/* Classify Neurons and Astrocytes */
+static void classifyNeuronsAndAstrocytes(const ContourStore &blue_contours,
+                                    const std::vector<ShapeDescriptor> &blue_shapes,
+                                    const BitMask &blue_green_intersection,
+                                    const SegmentationConfig &config,
+                                    std::vector<int> *astrocytes,
+                                    std::vector<int> *neurons,
+                                    std::vector<ShapeDescriptor> *astrocyte_shapes,
+                                    std::vector<ShapeDescriptor> *neuron_shapes) {
+
+    for (auto i : blue_contours.select(HierarchyType::PARENT_CNTR)) {
+
+        // Eliminate small contours via contour arc calculation
+        ContourView contour = blue_contours.contour(i);
+        if ((blue_shapes[i].perimeter >= config.neuron_min_perimeter/config.scale) && 
+                                            (contour.count >= 5)) {
+
+            // Determine whether cell is a neuron by calculating blue-green coverage area,
+            // restricted to the region around the cell
+            cv::Rect roi = boundingRect(contour.mat());
+            std::vector<cv::Mat> specific_contour (1, contour.mat());
+            cv::Mat drawing = cv::Mat::zeros(roi.size(), CV_8UC1);
+            drawContours(drawing, specific_contour, -1, cv::Scalar::all(255), cv::FILLED, 
+                            cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point(-roi.x, -roi.y));
+            int contour_count_before = countNonZero(drawing);
+            int contour_count_after = (int)blue_green_intersection.countUnder(drawing, roi.tl());
+            float coverage_ratio = ((float)contour_count_after)/contour_count_before;
+            if (coverage_ratio < config.neuron_min_coverage) {
+                astrocytes->push_back(i);
+                astrocyte_shapes->push_back(blue_shapes[i]);
+            } else {
+                // Categorize as astrocytes if the aspect ratio of the blue contour is very low
+                if (blue_shapes[i].aspect_ratio <= config.astrocyte_max_aspect_ratio) {
+                    astrocytes->push_back(i);
+                    astrocyte_shapes->push_back(blue_shapes[i]);
+                } else {
+                    neurons->push_back(i);
+                    neuron_shapes->push_back(blue_shapes[i]);
+                }
+            }
+        }
+    }
+}
+
+/* Astrocytes-neurons separation metrics */
+static void neuronAstroSepMetrics(const std::vector<ShapeDescriptor> &astrocyte_shapes, 
+                                const std::vector<ShapeDescriptor> &neuron_shapes,
+                                float roi_factor,
+                                float *mean_astrocyte_proximity_cnt,
+                                float *stddev_astrocyte_proximity_cnt,
+                                std::vector<cv::Point2f> *neuron_centers,
+                                float *neuron_roi_radius) {
+
+    // Calculate the mid point of all astrocytes
+    std::vector<cv::Point2f> mc_astrocyte(astrocyte_shapes.size());
+    for (size_t i = 0; i < astrocyte_shapes.size(); i++) {
+        mc_astrocyte[i] = astrocyte_shapes[i].centroid;
+    }
+
+    // Calculate the mid point and diameter of all neurons
+    std::vector<cv::Point2f> mc_neuron(neuron_shapes.size());
+    std::vector<float> neuron_diameter(neuron_shapes.size());
+    for (size_t i = 0; i < neuron_shapes.size(); i++) {
+        mc_neuron[i] = neuron_shapes[i].centroid;
+        neuron_diameter[i] = neuron_shapes[i].diameter;
+    }
+    cv::Scalar mean_diameter, stddev_diameter;
+    cv::meanStdDev(neuron_diameter, mean_diameter, stddev_diameter);
+
+    // Compute the normal distribution parameters of astrocyte count per neuron
+    float neuron_roi = (roi_factor * mean_diameter.val[0])/2;
+    std::vector<float> count(neuron_shapes.size(), 0.0);
+    for (size_t i = 0; i < neuron_shapes.size(); i++) {
+        for (size_t j = 0; j < astrocyte_shapes.size(); j++) {
+            if (cv::norm(mc_neuron[i] - mc_astrocyte[j]) <= neuron_roi) {
+                count[i]++;
+            }
+        }
+    }
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(count, mean, stddev);
+    *mean_astrocyte_proximity_cnt = static_cast<float>(mean.val[0]);
+    *stddev_astrocyte_proximity_cnt = static_cast<float>(stddev.val[0]);
+    *neuron_centers = mc_neuron;
+    *neuron_roi_radius = neuron_roi;
+}
+
+/* Group synapse area into bins. With a core, only the contours whose
+   bounding box starts inside it are counted. */
+static void binSynapseArea(const ContourStore &contours, 
+                    double area_scale,
+                    unsigned int num_bins,
+                    unsigned int bin_area,
+                    AreaBins *contour_bins,
+                    cv::Rect core = cv::Rect()) {
+
+    contour_bins->bins.assign(num_bins, 0);
+    contour_bins->count = 0;
+    for (auto i : contours.select(HierarchyType::PARENT_CNTR)) {
+        if (!core.empty()) {
+            ContourView contour = contours.contour(i);
+            cv::Point anchor = contour.points[0];
+            for (int p = 1; p < contour.count; p++) {
+                anchor.x = std::min(anchor.x, contour.points[p].x);
+                anchor.y = std::min(anchor.y, contour.points[p].y);
+            }
+            if (!core.contains(anchor)) continue;
+        }
+        unsigned int area = static_cast<unsigned int>(round(contours.area(i) * area_scale));
+        unsigned int bin_index = (area/bin_area < num_bins) ? area/bin_area : num_bins-1;
+        contour_bins->bins[bin_index]++;
+        contour_bins->count++;
+    }
+}
+
+/* Group synapse area into bins for each neuron */
+static void binSynapseAreaPerNeuron(const ContourStore &contours, 
+                                double area_scale,
+                                unsigned int num_bins,
+                                unsigned int bin_area,
+                                const std::vector<cv::Point2f> &neuron_centers, 
+                                float neuron_roi,
+                                std::vector<AreaBins> *neuron_bins) {
+
+    // Assign each synapse to the nearest neuron within the roi
+    AreaBins empty;
+    empty.bins.assign(num_bins, 0);
+    neuron_bins->assign(neuron_centers.size(), empty);
+    for (auto i : contours.select(HierarchyType::PARENT_CNTR)) {
+        cv::Rect bound = boundingRect(contours.contour(i).mat());
+        cv::Point2f center(bound.x + bound.width/2.0f, bound.y + bound.height/2.0f);
+        int nearest = -1;
+        float nearest_dist = neuron_roi;
+        for (size_t j = 0; j < neuron_centers.size(); j++) {
+            float dist = (float) cv::norm(neuron_centers[j] - center);
+            if (dist <= nearest_dist) {
+                nearest = (int)j;
+                nearest_dist = dist;
+            }
+        }
+        if (nearest < 0) continue;
+        unsigned int area = static_cast<unsigned int>(round(contours.area(i) * area_scale));
+        unsigned int bin_index = (area/bin_area < num_bins) ? area/bin_area : num_bins-1;
+        (*neuron_bins)[nearest].bins[bin_index]++;
+        (*neuron_bins)[nearest].count++;
+    }
+}
+
+/* Bin the common regions of the overlapping red and green objects. With a
+   core, only the pairs whose common pixels start inside it are counted. */
+static void binOverlapArea(const std::vector<ObjectPair> &pairs, 
+                    double min_area,
+                    double area_scale,
+                    unsigned int num_bins,
+                    unsigned int bin_area,
+                    AreaBins *overlap_bins,
+                    cv::Rect core = cv::Rect()) {
+
+    overlap_bins->bins.assign(num_bins, 0);
+    overlap_bins->count = 0;
+    for (auto& pair : pairs) {
+        if (pair.area < min_area) continue;
+        if (!core.empty() && !core.contains(pair.anchor)) continue;
+        unsigned int area = static_cast<unsigned int>(round(pair.area * area_scale));
+        unsigned int bin_index = (area/bin_area < num_bins) ? area/bin_area : num_bins-1;
+        overlap_bins->bins[bin_index]++;
+        overlap_bins->count++;
+    }
+}
+
+/* Green overlap of each red object, from the red-green pairs */
+static void objectOverlaps(const std::vector<BitComponent> &red_objects, 
+                            const std::vector<ObjectPair> &pairs, 
+                            unsigned int scale, 
+                            std::vector<ObjectOverlap> *overlaps) {
+
+    double area_scale = scale * scale;
+    overlaps->assign(red_objects.size(), ObjectOverlap());
+    for (size_t i = 0; i < red_objects.size(); i++) {
+        const cv::Rect &bound = red_objects[i].bound;
+        (*overlaps)[i].center = cv::Point2f((bound.x + bound.width/2.0f) * scale, 
+                                            (bound.y + bound.height/2.0f) * scale);
+        (*overlaps)[i].area = (float)(red_objects[i].area * area_scale);
+    }
+    std::vector<int> largest(red_objects.size(), 0);
+    for (auto& pair : pairs) {
+        ObjectOverlap &overlap = (*overlaps)[pair.first - 1];
+        overlap.green_objects++;
+        overlap.overlap_area += (float)(pair.area * area_scale);
+        if (pair.area > largest[pair.first - 1]) {
+            largest[pair.first - 1] = pair.area;
+            overlap.green_object = pair.second - 1;
+        }
+    }
+}
+
+/* Red and green-red synapse bins of a sampled tile */
+struct SynapseTile {
+    size_t stratum = 0;
+    AreaBins bins[4]; // Red low, red high, green-red high, green-red low
+};
+
+/* Analyze the red and green-red channels of a tile and its halo. Only the
+   contours starting inside the tile are binned, so the contours crossing
+   the tile edges are counted once and not cut. */
+static bool analyzeSynapseTile(cv::Mat red_merge, cv::Mat green_enhanced, cv::Rect core, 
+                            int halo, const SegmentationConfig &config, double max_value, 
+                            double min_area, double area_scale, 
+                            std::vector<cv::Mat> *masks, SynapseTile *tile) {
+
+    unsigned int num_bins = config.synapse_area_bins;
+    unsigned int bin_area = config.synapse_bin_area;
+    cv::Rect frame(0, 0, red_merge.cols, red_merge.rows);
+    cv::Rect region = cv::Rect(core.x - halo, core.y - halo, 
+                                core.width + 2*halo, core.height + 2*halo) & frame;
+    cv::Mat red_low, red_high, green_red_high, green_red_low;
+    if (!enhanceImage(red_merge(region), ChannelType::RED_LOW, config, &red_low, max_value) || 
+            !enhanceImage(red_merge(region), ChannelType::RED_HIGH, config, &red_high, 
+                                                                        max_value)) {
+        return false;
+    }
+    cv::bitwise_and(green_enhanced(region), red_high, green_red_high);
+    cv::bitwise_and(green_enhanced(region), red_low, green_red_low);
+
+    std::vector<cv::Mat> tile_masks = {red_low, red_high, green_red_high, green_red_low};
+    ChannelType types[] = {ChannelType::RED_LOW, ChannelType::RED_HIGH};
+    cv::Rect tile_core(core.x - region.x, core.y - region.y, core.width, core.height);
+    for (int c = 0; c < 2; c++) {
+        ContourStore contours;
+        cv::Mat segmented;
+        contourCalc(tile_masks[c], types[c], min_area, &segmented, &contours, region.tl());
+        binSynapseArea(contours, area_scale, num_bins, bin_area, &tile->bins[c], core);
+    }
+
+    // Green-red common regions, joined from the red and green objects of the tile
+    cv::Mat green_labels;
+    std::vector<BitComponent> green_objects;
+    BitMask(green_enhanced(region)).label(&green_objects, &green_labels);
+    for (int c = 2; c < 4; c++) {
+        cv::Mat red_labels;
+        std::vector<BitComponent> red_objects;
+        std::vector<ObjectPair> pairs;
+        BitMask((c == 2) ? red_high : red_low).label(&red_objects, &red_labels);
+        overlapJoin(red_labels, green_labels, &pairs);
+        binOverlapArea(pairs, min_area, area_scale, num_bins, bin_area, &tile->bins[c], 
+                                                                            tile_core);
+    }
+    for (int c = 0; c < 4; c++) {
+        tile_masks[c](tile_core).copyTo((*masks)[c](core));
+    }
+    return true;
+}
+
+/* Stratified estimate of the frame bins of one channel from the sampled tiles */
+static void estimateBins(const std::vector<SynapseTile> &tiles, int channel, 
+                            const std::vector<size_t> &stratum_sizes, 
+                            unsigned int num_bins, AreaBins *estimate) {
+
+    size_t strata = stratum_sizes.size();
+    std::vector<double> sampled(strata, 0.0), sum(strata, 0.0), sum_sq(strata, 0.0);
+    std::vector<std::vector<double>> bin_sum(strata, std::vector<double>(num_bins, 0.0));
+    for (auto& tile : tiles) {
+        const AreaBins &bins = tile.bins[channel];
+        sampled[tile.stratum]++;
+        sum[tile.stratum] += bins.count;
+        sum_sq[tile.stratum] += (double)bins.count*bins.count;
+        for (unsigned int b = 0; b < num_bins; b++) {
+            bin_sum[tile.stratum][b] += bins.bins[b];
+        }
+    }
+
+    // Stratum totals, the variance shrinks to 0 as a stratum is fully sampled
+    double total = 0.0, variance = 0.0;
+    std::vector<double> bin_total(num_bins, 0.0);
+    for (size_t h = 0; h < strata; h++) {
+        if (!sampled[h]) continue;
+        double size = (double)stratum_sizes[h], mean = sum[h]/sampled[h];
+        total += size*mean;
+        for (unsigned int b = 0; b < num_bins; b++) {
+            bin_total[b] += size*bin_sum[h][b]/sampled[h];
+        }
+        if (sampled[h] > 1) {
+            double s2 = std::max(0.0, (sum_sq[h] - sampled[h]*mean*mean)/(sampled[h] - 1));
+            variance += size*size*(1.0 - sampled[h]/size)*s2/sampled[h];
+        }
+    }
+    estimate->count = (unsigned int)round(total);
+    estimate->count_ci = (float)(1.96*sqrt(variance));
+    estimate->bins.assign(num_bins, 0);
+    for (unsigned int b = 0; b < num_bins; b++) {
+        estimate->bins[b] = (unsigned int)round(bin_total[b]);
+    }
+}
+
+/* Estimate the red and green-red bins from a stratified random sample of
+   tiles. The sample of every stratum doubles until the red counts are
+   within the target relative error, the masks hold the sampled tiles. */
+static bool sampleSynapses(cv::Mat red_merge, cv::Mat green_enhanced, 
+                            const SegmentationConfig &config, double max_value, 
+                            double min_area, double area_scale, 
+                            std::vector<cv::Mat> *masks, WindowMetrics *metrics) {
+
+    // Tiles grouped into square strata, each visited in a random order
+    int tile_size = std::max(16, config.sample_tile_size/(int)config.scale);
+    int halo = std::max(2, SAMPLE_TILE_HALO/(int)config.scale);
+    int tiles_x = (red_merge.cols + tile_size - 1)/tile_size;
+    int tiles_y = (red_merge.rows + tile_size - 1)/tile_size;
+    int strata_x = (tiles_x + SAMPLE_STRATUM_TILES - 1)/SAMPLE_STRATUM_TILES;
+    int strata_y = (tiles_y + SAMPLE_STRATUM_TILES - 1)/SAMPLE_STRATUM_TILES;
+    cv::Rect frame(0, 0, red_merge.cols, red_merge.rows);
+    std::vector<std::vector<cv::Rect>> strata(strata_x*strata_y);
+    for (int ty = 0; ty < tiles_y; ty++) {
+        for (int tx = 0; tx < tiles_x; tx++) {
+            strata[(ty/SAMPLE_STRATUM_TILES)*strata_x + tx/SAMPLE_STRATUM_TILES].push_back(
+                    cv::Rect(tx*tile_size, ty*tile_size, tile_size, tile_size) & frame);
+        }
+    }
+    std::mt19937 rng(config.sample_seed);
+    std::vector<size_t> stratum_sizes, taken(strata.size(), 0), wanted;
+    for (auto& stratum : strata) {
+        std::shuffle(stratum.begin(), stratum.end(), rng);
+        stratum_sizes.push_back(stratum.size());
+        wanted.push_back(std::min((size_t)SAMPLE_MIN_TILES, stratum.size()));
+    }
+
+    masks->clear();
+    for (int c = 0; c < 4; c++) {
+        masks->push_back(cv::Mat::zeros(red_merge.size(), CV_8UC1));
+    }
+    unsigned int num_bins = config.synapse_area_bins;
+    AreaBins *estimates[] = {&metrics->red_low, &metrics->red_high, 
+                                &metrics->green_red_high, &metrics->green_red_low};
+    std::vector<SynapseTile> sampled;
+    size_t tile_cnt = (size_t)tiles_x*tiles_y;
+    while (true) {
+        for (size_t h = 0; h < strata.size(); h++) {
+            for (; taken[h] < wanted[h]; taken[h]++) {
+                SynapseTile tile;
+                tile.stratum = h;
+                if (!analyzeSynapseTile(red_merge, green_enhanced, strata[h][taken[h]], halo, 
+                                        config, max_value, min_area, area_scale, 
+                                        masks, &tile)) {
+                    return false;
+                }
+                sampled.push_back(tile);
+            }
+        }
+        for (int c = 0; c < 4; c++) {
+            estimateBins(sampled, c, stratum_sizes, num_bins, estimates[c]);
+        }
+
+        // The red low and high counts steer the sample size
+        float error = 0.0;
+        for (int c = 0; c < 2; c++) {
+            if (estimates[c]->count) {
+                error = std::max(error, estimates[c]->count_ci/estimates[c]->count);
+            }
+        }
+        if ((sampled.size() == tile_cnt) || (error <= config.sample_error)) break;
+        for (size_t h = 0; h < strata.size(); h++) {
+            wanted[h] = std::min(2*wanted[h], stratum_sizes[h]);
+        }
+    }
+    metrics->sampled_fraction = (float)sampled.size()/tile_cnt;
+    return true;
+}
+
+NeuronSegmenter::NeuronSegmenter(SegmentationConfig config) :
+    config_(config) {
+
+    if (!config_.scale) config_.scale = 1;
+}
+
+void NeuronSegmenter::setStageHook(StageHook hook) {
+    stage_hook_ = hook;
+}
+
+const SegmentationConfig& NeuronSegmenter::config() const {
+    return config_;
+}
+
+void NeuronSegmenter::stageDone(const std::string &stage) const {
+    if (stage_hook_) stage_hook_(stage);
+}
+
+WindowCache::WindowCache() :
+    entries_(new WindowCacheEntries()) {
+}
+
+WindowCache::~WindowCache() {
+}
+
+unsigned int WindowCache::hits() const {
+    return entries_->hits;
+}
+
+unsigned int WindowCache::misses() const {
+    return entries_->misses;
+}
+
+WindowCacheEntries& WindowCache::entries() {
+    return *entries_;
+}
+
+const std::vector<std::string>& windowMaskNames() {
+    static const std::vector<std::string> names = {"blue", "green", "axon",
+                                    "green_low", "green_high", "red_low", "red_high",
+                                    "green_red_low", "green_red_high"};
+    return names;
+}
+
+PlaneBuffer planeBuffer(const cv::Mat &plane) {
+    PlaneBuffer buffer;
+    buffer.data = plane.data;
+    buffer.width = plane.cols;
+    buffer.height = plane.rows;
+    buffer.stride = plane.step[0];
+    buffer.depth = plane.depth();
+    return buffer;
+}
+
+bool NeuronSegmenter::planeMasks(const cv::Mat &plane, const std::vector<std::string> &names,
+                                    std::vector<cv::Mat> *masks) const {
+
+    unsigned int layers = config_.z_layers;
+    int depth = (config_.bit_depth > 8) ? CV_16U : CV_8U;
+    double max_value = (double)((1 << std::min(16u, config_.bit_depth)) - 1);
+    if (plane.type() != CV_MAKETYPE(depth, 3)) {
+        std::cerr << "Planes must be " << ((depth == CV_8U) ? 8 : 16) 
+                    << "-bit BGR images" << std::endl;
+        return false;
+    }
+
+    // Blue, green and red windows of copies of the plane
+    std::vector<cv::Mat> merged(3);
+    std::vector<int> from_to;
+    for (unsigned int channel = 0; channel < 3; channel++) {
+        merged[channel].create(plane.size(), CV_MAKETYPE(depth, layers));
+        for (unsigned int z = 0; z < layers; z++) {
+            from_to.push_back(3*z + channel);
+            from_to.push_back(layers*channel + z);
+        }
+    }
+    cv::mixChannels(std::vector<cv::Mat>(layers, plane), merged, from_to);
+
+    // Each mask is enhanced once, the common regions from their green and red masks
+    static const std::map<std::string, std::pair<ChannelType, int>> channels = {
+        {"blue", {ChannelType::BLUE, 0}}, 
+        {"green", {ChannelType::GREEN_COMBINED, 1}}, 
+        {"axon", {ChannelType::ENHANCE_AXON, 1}}, 
+        {"green_low", {ChannelType::GREEN_LOW, 1}}, 
+        {"green_high", {ChannelType::GREEN_HIGH, 1}}, 
+        {"red_low", {ChannelType::RED_LOW, 2}}, 
+        {"red_high", {ChannelType::RED_HIGH, 2}}};
+    std::map<std::string, cv::Mat> enhanced;
+    std::function<bool(const std::string&)> enhance = [&](const std::string &name) {
+        if (enhanced.count(name)) return true;
+        cv::Mat mask;
+        if ((name == "green_red_low") || (name == "green_red_high")) {
+            std::string red = name.substr(6);
+            if (!enhance("green") || !enhance(red)) return false;
+            mask = (BitMask(enhanced["green"]) & BitMask(enhanced[red])).toMat();
+        } else if ((name == "blue") && config_.pyramid_levels) {
+            cv::Mat segmented;
+            ContourStore contours;
+            double nucleus_min_area = config_.nucleus_min_area/(config_.scale*config_.scale);
+            if (!pyramidContourCalc(merged[0], config_, nucleus_min_area, max_value, 
+                                        &mask, &segmented, &contours)) {
+                return false;
+            }
+        } else {
+            auto channel = channels.find(name);
+            if (channel == channels.end()) {
+                std::cerr << "Unknown mask '" << name << "'" << std::endl;
+                return false;
+            }
+            if (!enhanceImage(merged[channel->second.second], channel->second.first, 
+                                    config_, &mask, max_value)) {
+                return false;
+            }
+        }
+        enhanced[name] = mask;
+        return true;
+    };
+
+    masks->clear();
+    for (auto& name : names) {
+        if (!enhance(name)) return false;
+        masks->push_back(enhanced[name]);
+    }
+    return true;
+}
+
+bool NeuronSegmenter::analyzeWindow(const std::vector<PlaneBuffer> &planes,
+                                    WindowMetrics *metrics, WindowImages *images,
+                                    WindowCache *cache) const {
+
+    // Matrix headers over the caller's buffers, the pixels are not copied
+    std::vector<cv::Mat> wrapped;
+    for (auto& plane : planes) {
+        if (!plane.data) {
+            std::cerr << "Invalid plane buffer" << std::endl;
+            return false;
+        }
+        size_t sample_size = (plane.depth == CV_16U) ? 2 : 1;
+        size_t stride = plane.stride ? plane.stride : 3*sample_size*plane.width;
+        wrapped.push_back(cv::Mat(plane.height, plane.width, CV_MAKETYPE(plane.depth, 3),
+                                    (void *)plane.data, stride));
+    }
+    return analyzeWindow(wrapped, metrics, images, cache);
+}
+
+bool NeuronSegmenter::analyzeWindow(const std::vector<cv::Mat> &planes,
+                                    WindowMetrics *metrics, WindowImages *images,
+                                    WindowCache *window_cache) const {
+
+    // The merged window is enhanced as a color image, so 3 or 4 planes
+    unsigned int layers = config_.z_layers;
+    if ((layers < 3) || (layers > 4) || (planes.size() != layers)) {
+        std::cerr << "A window must hold 3 or 4 z planes" << std::endl;
+        return false;
+    }
+    // More than 8 significant bits are held in 16-bit samples
+    int depth = (config_.bit_depth > 8) ? CV_16U : CV_8U;
+    double max_value = (double)((1 << std::min(16u, config_.bit_depth)) - 1);
+    for (auto& plane : planes) {
+        if ((plane.type() != CV_MAKETYPE(depth, 3)) || (plane.size() != planes[0].size())) {
+            std::cerr << "Planes must be " << ((depth == CV_8U) ? 8 : 16) 
+                        << "-bit BGR images of the same size" << std::endl;
+            return false;
+        }
+    }
+
+    // Area and length thresholds are defined at full resolution
+    unsigned int scale = config_.scale;
+    double area_scale = scale * scale;
+    double nucleus_min_area = config_.nucleus_min_area/area_scale;
+    double synapse_min_area = config_.synapse_min_area/area_scale;
+    int ellipse_thickness = std::max(1, 4/(int)scale);
+    int outline_thickness = std::max(1, 2/(int)scale);
+
+    // Intermediate masks, returned only on request
+    std::string window_layers = std::to_string(layers) + "layers";
+    bool debug = config_.debug_images && images;
+    auto debugImage = [&](std::string name, cv::Mat image) {
+        if (debug) images->debug.push_back(std::make_pair(name, image));
+    };
+
+    // Shared intermediates, the segmented debug images are not cached
+    WindowCacheEntries *cache = (window_cache && !debug) ? &window_cache->entries() : NULL;
+    std::vector<cv::Rect> frame(1, cv::Rect(0, 0, planes[0].cols, planes[0].rows));
+    auto enhanceChannel = [&](cv::Mat merge, ChannelType type, 
+                                const std::vector<cv::Rect> &regions, 
+                                WindowCacheEntries *channel_cache, std::string key, 
+                                cv::Mat *enhanced) {
+        if (channel_cache && findMat(channel_cache, key, enhanced)) {
+            return true;
+        }
+        if (!regionEnhanceImage(merge, type, config_, regions, max_value, enhanced, 
+                                                                    channel_cache)) {
+            return false;
+        }
+        if (channel_cache) channel_cache->mats[key] = *enhanced;
+        return true;
+    };
+    // The contours are returned in place from the cache, or computed into
+    // computed and moved to the cache
+    auto channelContours = [&](cv::Mat enhanced, ChannelType type, 
+                                const std::vector<cv::Rect> &regions, 
+                                WindowCacheEntries *channel_cache, std::string key, 
+                                cv::Mat *segmented, 
+                                ContourStore *computed) -> const ContourStore& {
+        key = cacheKey(key, {synapse_min_area});
+        const ContourStore *found = channel_cache ? 
+                        findEntry(channel_cache, channel_cache->contours, key) : NULL;
+        if (found) return *found;
+        regionContourCalc(enhanced, type, synapse_min_area, regions, segmented, computed);
+        if (!channel_cache) return *computed;
+        return channel_cache->contours[key] = std::move(*computed);
+    };
+
+    /* Gather RGB channel information needed for feature extraction */
+
+    // Gather the blue, green and red windows straight from the planes, once 
+    // per window when they are cached
+    cv::Mat blue_merge, green_merge, red_merge;
+    std::string merge_key = cacheKey("merge", {(double)layers, (double)scale, 
+                                                (double)config_.bit_depth});
+    if (!cache || !findMat(cache, merge_key + " blue", &blue_merge) || 
+            !findMat(cache, merge_key + " green", &green_merge) || 
+            !findMat(cache, merge_key + " red", &red_merge)) {
+        blue_merge.create(planes[0].size(), CV_MAKETYPE(depth, layers));
+        green_merge.create(planes[0].size(), CV_MAKETYPE(depth, layers));
+        red_merge.create(planes[0].size(), CV_MAKETYPE(depth, layers));
+        std::vector<cv::Mat> merged = {blue_merge, green_merge, red_merge};
+        std::vector<int> from_to;
+        for (unsigned int channel = 0; channel < 3; channel++) {
+            for (unsigned int z = 0; z < layers; z++) {
+                from_to.push_back(3*z + channel);
+                from_to.push_back(layers*channel + z);
+            }
+        }
+        cv::mixChannels(planes, merged, from_to);
+        if (cache) {
+            cache->mats[merge_key + " blue"] = blue_merge;
+            cache->mats[merge_key + " green"] = green_merge;
+            cache->mats[merge_key + " red"] = red_merge;
+        }
+    }
+
+    // Blue channel
+    cv::Mat blue_enhanced, blue_segmented;
+    ContourStore blue_computed;
+    const ContourStore *blue_found = NULL;
+
+    debugImage("blue_" + window_layers, blue_merge);
+    std::string blue_key = cacheKey("blue", {(double)config_.pyramid_levels, 
+                                        (double)config_.split_nuclei, nucleus_min_area});
+    if (cache && findMat(cache, blue_key, &blue_enhanced)) {
+        blue_found = findEntry(cache, cache->contours, blue_key);
+    }
+    if (!blue_found) {
+        if (config_.pyramid_levels) {
+            if (!pyramidContourCalc(blue_merge, config_, nucleus_min_area, max_value, 
+                                        &blue_enhanced, &blue_segmented, &blue_computed)) {
+                return false;
+            }
+        } else {
+            if(!enhanceImage(blue_merge, ChannelType::BLUE, config_, &blue_enhanced, 
+                                                                    max_value)) {
+                return false;
+            }
+            contourCalc(blue_enhanced, ChannelType::BLUE, nucleus_min_area, &blue_segmented,
+                            &blue_computed);
+        }
+        if (config_.split_nuclei) {
+            splitTouchingNuclei(nucleus_min_area, &blue_computed);
+        }
+        blue_found = &blue_computed;
+        if (cache) {
+            cache->mats[blue_key] = blue_enhanced;
+            blue_found = &(cache->contours[blue_key] = std::move(blue_computed));
+        }
+    }
+    const ContourStore &contours_blue = *blue_found;
+    debugImage("blue_" + window_layers + "_enhanced", blue_enhanced);
+    debugImage("blue_" + window_layers + "_enhanced_segmented", blue_segmented);
+    stageDone("blue nuclei");
+
+    // Green channel
+    cv::Mat green_enhanced;
+    debugImage("green_" + window_layers, green_merge);
+    std::string green_key = cacheKey("green", {config_.green_combined_level});
+    if(!enhanceChannel(green_merge, ChannelType::GREEN_COMBINED, frame, cache, green_key, 
+                                                                    &green_enhanced)) {
+        return false;
+    }
+    debugImage("green_" + window_layers + "_enhanced", green_enhanced);
+
+    // Axon boundary mask
+    cv::Mat axon_enhanced;
+    if(!enhanceChannel(green_merge, ChannelType::ENHANCE_AXON, frame, cache, "axon", 
+                                                                    &axon_enhanced)) {
+        return false;
+    }
+    debugImage("axon_" + window_layers, axon_enhanced);
+
+    // Green channel - Low intensity
+    cv::Mat green_low_enhanced, green_low_segmented;
+    ContourStore green_low_computed;
+    std::string green_low_key = cacheKey("green_low", {config_.green_floor, 
+                                                        config_.green_mask_level});
+    if(!enhanceChannel(green_merge, ChannelType::GREEN_LOW, frame, cache, green_low_key, 
+                                                                    &green_low_enhanced)) {
+        return false;
+    }
+    debugImage("green_low_" + window_layers + "_enhanced", green_low_enhanced);
+    const ContourStore &contours_green_low = 
+                channelContours(green_low_enhanced, ChannelType::GREEN_LOW, frame, cache, 
+                                green_low_key, &green_low_segmented, &green_low_computed);
+    debugImage("green_low_" + window_layers + "_enhanced_segmented", green_low_segmented);
+
+    // Green channel - High intensity
+    cv::Mat green_high_enhanced, green_high_segmented;
+    ContourStore green_high_computed;
+    std::string green_high_key = cacheKey("green_high", {config_.green_floor, 
+                                                        config_.green_mask_level});
+    if(!enhanceChannel(green_merge, ChannelType::GREEN_HIGH, frame, cache, green_high_key, 
+                                                                    &green_high_enhanced)) {
+        return false;
+    }
+    debugImage("green_high_" + window_layers + "_enhanced", green_high_enhanced);
+    const ContourStore &contours_green_high = 
+                channelContours(green_high_enhanced, ChannelType::GREEN_HIGH, frame, cache, 
+                                green_high_key, &green_high_segmented, &green_high_computed);
+    debugImage("green_high_" + window_layers + "_enhanced_segmented", green_high_segmented);
+    stageDone("green axons");
+
+    /** Extract multi-dimensional features for analysis **/
+
+    // Blue-green channel intersection, on the bit-packed masks
+    BitMask green_bits(green_enhanced);
+    BitMask blue_green_intersection = BitMask(blue_enhanced) & green_bits;
+    if (debug) {
+        debugImage("green_" + window_layers + "_enhanced_blue_intersection",
+                                                    blue_green_intersection.toMat());
+    }
+
+    // Shape descriptors of the nuclei, shared by the classification,
+    // the separation metrics and the overlay
+    std::vector<int> blue_nuclei = contours_blue.select(HierarchyType::PARENT_CNTR);
+    std::vector<ShapeDescriptor> shapes_computed;
+    const std::vector<ShapeDescriptor> *shapes_found = 
+                                cache ? findEntry(cache, cache->shapes, blue_key) : NULL;
+    if (!shapes_found) {
+        computeShapeDescriptors(contours_blue, blue_nuclei, &shapes_computed);
+        shapes_found = &shapes_computed;
+        if (cache) shapes_found = &(cache->shapes[blue_key] = std::move(shapes_computed));
+    }
+    const std::vector<ShapeDescriptor> &blue_shapes = *shapes_found;
+
+    // Classify astrocytes and neurons
+    std::vector<int> astrocytes, neurons;
+    std::vector<ShapeDescriptor> astrocyte_shapes, neuron_shapes;
+    classifyNeuronsAndAstrocytes(contours_blue, blue_shapes,
+                                        blue_green_intersection, config_,
+                                        &astrocytes, &neurons,
+                                        &astrocyte_shapes, &neuron_shapes);
+    metrics->astrocyte_count = (unsigned int)astrocytes.size();
+    metrics->neuron_count = (unsigned int)neurons.size();
+
+    // Draw the categorized cells
+    if (debug) {
+        cv::Mat drawing_blue = cv::Mat::zeros(blue_enhanced.size(), CV_8UC1);
+        std::vector<cv::Mat> blue_mats = contours_blue.mats();
+        for (auto i : neurons) {
+            drawContours(drawing_blue, blue_mats, i, 255, cv::FILLED,
+                            cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
+        }
+        for (auto i : astrocytes) {
+            drawContours(drawing_blue, blue_mats, i, 100, cv::FILLED,
+                            cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
+        }
+        debugImage(window_layers + "_cells", drawing_blue);
+    }
+
+    // Calculate metrics for astrocytes-neurons separation
+    std::vector<cv::Point2f> neuron_centers;
+    float neuron_roi = 0.0;
+    neuronAstroSepMetrics(astrocyte_shapes, neuron_shapes, config_.neuron_roi_factor,
+                            &metrics->mean_astrocyte_proximity,
+                            &metrics->stddev_astrocyte_proximity,
+                            &neuron_centers, &neuron_roi);
+    stageDone("cell classification");
+
+    // Red channel
+    debugImage("red_" + window_layers, red_merge);
+    unsigned int num_bins = config_.synapse_area_bins;
+    unsigned int bin_area = config_.synapse_bin_area;
+    cv::Mat red_low_enhanced, red_high_enhanced;
+    cv::Mat green_red_high_intersection, green_red_low_intersection;
+    if (config_.sample_error > 0.0) {
+
+        // Estimate the synapse bins from a sample of the tiles
+        std::vector<cv::Mat> sampled_masks;
+        if (!sampleSynapses(red_merge, green_enhanced, config_, max_value, synapse_min_area,
+                                area_scale, &sampled_masks, metrics)) {
+            return false;
+        }
+        red_low_enhanced = sampled_masks[0];
+        red_high_enhanced = sampled_masks[1];
+        green_red_high_intersection = sampled_masks[2];
+        green_red_low_intersection = sampled_masks[3];
+        metrics->neurons.clear();
+        metrics->red_low_overlaps.clear();
+        metrics->red_high_overlaps.clear();
+        debugImage("red_low_" + window_layers + "_enhanced", red_low_enhanced);
+        debugImage("red_high_" + window_layers + "_enhanced", red_high_enhanced);
+        stageDone("red synapses");
+    } else {
+        metrics->sampled_fraction = 1.0;
+
+        // Restrict the synapse analysis to the tiles around the neurons, whose
+        // masks depend on the classification and are not cached
+        std::vector<cv::Rect> synapse_regions = frame;
+        WindowCacheEntries *red_cache = config_.neuron_roi ? NULL : cache;
+        if (config_.neuron_roi) {
+            synapse_regions = neuronRoiRegions(red_merge.size(), neuron_centers, neuron_roi,
+                                        std::max(16, config_.roi_tile_size/(int)scale));
+        }
+
+        // Red channel - Lower intensity
+        cv::Mat red_low_segmented;
+        ContourStore red_low_computed;
+
+        std::string red_low_key = cacheKey("red_low", {config_.red_floor, 
+                                config_.red_mask_level, config_.red_low_ceiling, 
+                                config_.red_low_level});
+        if(!enhanceChannel(red_merge, ChannelType::RED_LOW, synapse_regions, red_cache, 
+                                red_low_key, &red_low_enhanced)) {
+            return false;
+        }
+        debugImage("red_low_" + window_layers + "_enhanced", red_low_enhanced);
+        const ContourStore &contours_red_low = 
+                channelContours(red_low_enhanced, ChannelType::RED_LOW, synapse_regions, 
+                                red_cache, red_low_key, &red_low_segmented, &red_low_computed);
+        debugImage("red_low_" + window_layers + "_enhanced_segmented", red_low_segmented);
+
+        // Red channel - High intensity
+        cv::Mat red_high_segmented;
+        ContourStore red_high_computed;
+
+        std::string red_high_key = cacheKey("red_high", {config_.red_floor, 
+                                                        config_.red_mask_level});
+        if(!enhanceChannel(red_merge, ChannelType::RED_HIGH, synapse_regions, red_cache, 
+                                red_high_key, &red_high_enhanced)) {
+            return false;
+        }
+        debugImage("red_high_" + window_layers + "_enhanced", red_high_enhanced);
+        const ContourStore &contours_red_high = 
+                channelContours(red_high_enhanced, ChannelType::RED_HIGH, synapse_regions, 
+                                red_cache, red_high_key, &red_high_segmented, 
+                                &red_high_computed);
+        debugImage("red_high_" + window_layers + "_enhanced_segmented", red_high_segmented);
+
+        // Draw the red high-low regions after categorization
+        if (debug) {
+            cv::Mat drawing_red = cv::Mat::zeros(red_low_enhanced.size(), CV_8UC1);
+            std::vector<cv::Mat> red_high_mats = contours_red_high.mats();
+            for (size_t i = 0; i < red_high_mats.size(); i++) {
+                drawContours(drawing_red, red_high_mats, (int)i, 255,
+                                cv::FILLED, cv::LINE_8, contours_red_high.hierarchy());
+            }
+            std::vector<cv::Mat> red_low_mats = contours_red_low.mats();
+            for (size_t i = 0; i < red_low_mats.size(); i++) {
+                drawContours(drawing_red, red_low_mats, (int)i, 100,
+                                cv::FILLED, cv::LINE_8, contours_red_low.hierarchy());
+            }
+            debugImage(window_layers + "_red", drawing_red);
+        }
+
+        // Classify synapses per neuron
+        metrics->neurons.clear();
+        if (config_.neuron_roi) {
+            std::vector<AreaBins> red_low_neuron_bins, red_high_neuron_bins;
+            binSynapseAreaPerNeuron(contours_red_low, area_scale, num_bins, bin_area,
+                                        neuron_centers, neuron_roi, &red_low_neuron_bins);
+            binSynapseAreaPerNeuron(contours_red_high, area_scale, num_bins, bin_area,
+                                        neuron_centers, neuron_roi, &red_high_neuron_bins);
+            for (size_t i = 0; i < neuron_centers.size(); i++) {
+                NeuronSynapses neuron;
+                neuron.center = neuron_centers[i] * (float)scale;
+                neuron.red_low = red_low_neuron_bins[i];
+                neuron.red_high = red_high_neuron_bins[i];
+                metrics->neurons.push_back(neuron);
+            }
+        }
+
+        // Classify synapses
+        binSynapseArea(contours_red_low, area_scale,
+                            num_bins, bin_area, &metrics->red_low);
+        binSynapseArea(contours_red_high, area_scale,
+                            num_bins, bin_area, &metrics->red_high);
+        stageDone("red synapses");
+
+        // Green and red objects, the common regions are joined from their labels
+        cv::Mat green_labels;
+        std::string green_labels_key = cacheKey("green labels", {config_.green_combined_level});
+        if (!cache || !findMat(cache, green_labels_key, &green_labels)) {
+            std::vector<BitComponent> green_objects;
+            green_bits.label(&green_objects, &green_labels);
+            if (cache) cache->mats[green_labels_key] = green_labels;
+        }
+        auto joinGreenRed = [&](const BitMask &red_bits, std::vector<ObjectPair> *pairs, 
+                                    std::vector<ObjectOverlap> *overlaps) {
+            cv::Mat red_labels;
+            std::vector<BitComponent> red_objects;
+            red_bits.label(&red_objects, &red_labels);
+            overlapJoin(red_labels, green_labels, pairs);
+            overlaps->clear();
+            if (config_.colocalization) objectOverlaps(red_objects, *pairs, scale, overlaps);
+        };
+
+        // Green-red high channel intersection, kept packed unless the masks are returned
+        BitMask red_high_bits(red_high_enhanced);
+        if (images) {
+            green_red_high_intersection = (green_bits & red_high_bits).toMat();
+            debugImage("green_" + window_layers + "_enhanced_red_high_intersection",
+                                                        green_red_high_intersection);
+        }
+
+        // Calculate metrics for green-red high common regions
+        std::vector<ObjectPair> green_red_high_pairs;
+        joinGreenRed(red_high_bits, &green_red_high_pairs, &metrics->red_high_overlaps);
+        binOverlapArea(green_red_high_pairs, synapse_min_area, area_scale,
+                            num_bins, bin_area, &metrics->green_red_high);
+
+        // Green-red low channel intersection
+        BitMask red_low_bits(red_low_enhanced);
+        if (images) {
+            green_red_low_intersection = (green_bits & red_low_bits).toMat();
+            debugImage("green_" + window_layers + "_enhanced_red_low_intersection",
+                                                        green_red_low_intersection);
+        }
+
+        // Calculate metrics for green-red low common regions
+        std::vector<ObjectPair> green_red_low_pairs;
+        joinGreenRed(red_low_bits, &green_red_low_pairs, &metrics->red_low_overlaps);
+        binOverlapArea(green_red_low_pairs, synapse_min_area, area_scale,
+                            num_bins, bin_area, &metrics->green_red_low);
+
+        // Draw the green-red intersection areas after categorization, filled 
+        // from their contours as the reference pipeline draws them
+        if (debug) {
+            cv::Mat drawing_green_red = cv::Mat::zeros(green_enhanced.size(), CV_8UC1);
+            std::vector<std::pair<cv::Mat, int>> intersections = {
+                    {green_red_high_intersection, 255}, {green_red_low_intersection, 100}};
+            for (auto& intersection : intersections) {
+                cv::Mat segmented;
+                ContourStore contours;
+                contourCalc(intersection.first, ChannelType::RED_HIGH, synapse_min_area, 
+                                &segmented, &contours);
+                std::vector<cv::Mat> mats = contours.mats();
+                for (size_t i = 0; i < mats.size(); i++) {
+                    drawContours(drawing_green_red, mats, (int)i, intersection.second,
+                                    cv::FILLED, cv::LINE_8, contours.hierarchy());
+                }
+            }
+            debugImage(window_layers + "_green_red", drawing_green_red);
+        }
+    }
+
+    // Calculate the metrics for green regions
+    binSynapseArea(contours_green_high, area_scale,
+                        num_bins, bin_area, &metrics->green_high);
+    binSynapseArea(contours_green_low, area_scale,
+                        num_bins, bin_area, &metrics->green_low);
+    stageDone("green-red intersection");
+    if (!images) return true;
+
+    // Enhanced masks, in windowMaskNames() order
+    std::vector<cv::Mat> masks = {blue_enhanced, green_enhanced, axon_enhanced,
+                                    green_low_enhanced, green_high_enhanced,
+                                    red_low_enhanced, red_high_enhanced,
+                                    green_red_low_intersection, green_red_high_intersection};
+    images->masks.clear();
+    for (size_t i = 0; i < masks.size(); i++) {
+        images->masks.push_back(std::make_pair(windowMaskNames()[i], masks[i]));
+    }
+
+    /** Analyzed image - blue, green-red intersection (high and low) and red (high and low) **/
+
+    // Categorized cells and the green and red regions
+    OverlayRenderer overlay(blue_enhanced.size());
+    overlay.addFilledContours(contours_blue, neurons,
+                                cv::Scalar(255, OVERLAY_KEEP, OVERLAY_KEEP));
+    overlay.addFilledContours(contours_blue, astrocytes,
+                                cv::Scalar(100, OVERLAY_KEEP, OVERLAY_KEEP));
+    overlay.addLabelMap(green_high_enhanced, cv::Scalar(OVERLAY_KEEP, 255, OVERLAY_KEEP));
+    overlay.addLabelMap(green_low_enhanced, cv::Scalar(OVERLAY_KEEP, 255, OVERLAY_KEEP));
+    overlay.addLabelMap(red_high_enhanced, cv::Scalar(OVERLAY_KEEP, OVERLAY_KEEP, 255));
+    overlay.addLabelMap(red_low_enhanced, cv::Scalar(OVERLAY_KEEP, OVERLAY_KEEP, 100));
+
+    // Draw neuron boundaries
+    for (size_t i = 0; i < neuron_shapes.size(); i++) {
+        overlay.addEllipse(neuron_shapes[i].ellipse, cv::Scalar(0, 0, 255), ellipse_thickness);
+    }
+
+    // Draw astrocyte boundaries
+    for (size_t i = 0; i < astrocyte_shapes.size(); i++) {
+        overlay.addEllipse(astrocyte_shapes[i].ellipse, cv::Scalar(0, 255, 0), ellipse_thickness);
+    }
+
+    // Draw upper layer axon boundaries
+    overlay.addContourOutlines(contours_green_high, contours_green_high.indices(),
+                                cv::Scalar(255, 0, 128), outline_thickness);
+
+    // Rasterize the blue, green and red layers together
+    images->processed = overlay.render();
+
+    // Original image - blue, green and red, the caller's planes stay untouched
+    cv::Mat color_original = planes[0];
+    for (unsigned int i = 1; i < layers; i++) {
+        double beta = 1.0/(i+1);
+        cv::Mat blended;
+        addWeighted(color_original, 1.0 - beta, planes[i], beta, 0.0, blended);
+        color_original = blended;
+    }
+    images->original = color_original;
+    stageDone("overlay");
+    return true;
+}
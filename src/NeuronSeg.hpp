@@ -0,0 +1,185 @@
+#ifndef NEURON_SEG_HPP
+#define NEURON_SEG_HPP
+
+/* Neuron segmentation library (libneuronseg)
+   Analyzes one window of consecutive z planes: nuclei are classified into
+   neurons and astrocytes, and the synapse, axon and green-red common
+   regions are counted and binned by area. The planes are caller owned 8 or
+   16-bit BGR buffers that are read in place, the results are returned as structs and
+   nothing is read from or written to disk. A segmenter holds no mutable
+   state, so one instance may analyze windows from any number of threads.
+ */
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define NUM_Z_LAYERS            3   // Merge a certain number of z layers
+#define NUM_SYNAPSE_AREA_BINS   21  // Number of bins
+#define SYNAPSE_BIN_AREA        25  // Bin area
+#define NEURON_ROI_FACTOR       3   // Roi of neuron = roi_factor*mean_neuron_diameter
+#define ROI_TILE_SIZE           128 // Tile size for the neuron roi synapse analysis
+#define SAMPLE_TILE_SIZE        128 // Tile size for the sampled synapse analysis
+#define SAMPLE_TILE_HALO        16  // Margin analyzed around a sampled tile
+#define SAMPLE_STRATUM_TILES    4   // Strata are square blocks of this many tiles a side
+#define SAMPLE_MIN_TILES        2   // Tiles first sampled in each stratum
+
+/* Segmentation parameters, lengths and areas are at full resolution */
+struct SegmentationConfig {
+    unsigned int z_layers = NUM_Z_LAYERS; // Planes merged into one window
+    unsigned int scale = 1; // The planes are 1/scale of the full resolution
+    unsigned int bit_depth = 8; // Significant bits per sample, 12 and 16 use 16-bit planes
+    unsigned int pyramid_levels = 0; // Detect nuclei on a 1/2^levels pyramid level first
+    bool split_nuclei = false; // Split touching nuclei with a local watershed
+    bool neuron_roi = false; // Analyze synapses only in the tiles around the neurons
+    bool colocalization = false; // Report the green overlap of every red object
+    float neuron_roi_factor = NEURON_ROI_FACTOR; // Roi diameter over mean neuron diameter
+    int roi_tile_size = ROI_TILE_SIZE; // Tile size of the neuron roi regions
+    float sample_error = 0.0; // Target relative error of sampled synapse counts, 0 = exact
+    int sample_tile_size = SAMPLE_TILE_SIZE; // Tile size of the sampled synapse analysis
+    unsigned int sample_seed = 1; // Seed of the tile sampling
+    double nucleus_min_area = 100.0; // Smallest nucleus
+    double synapse_min_area = 1.0; // Smallest synapse, axon or common region
+    double neuron_min_perimeter = 250.0; // Smaller nuclei are not classified
+    float green_floor = 50.0; // Green samples below are background, on the 8-bit scale
+    float green_mask_level = 200.0; // Inverted, blurred level of the green low and high masks
+    float green_combined_level = 220.0; // Same, for the combined green mask
+    float red_floor = 80.0; // Red samples below are background, on the 8-bit scale
+    float red_mask_level = 220.0; // Inverted, blurred level of the red low and high masks
+    float red_low_ceiling = 240.0; // Upper level of the red low intensity regions
+    float red_low_level = 50.0; // Lower level of the red low intensity regions
+    float neuron_min_coverage = 0.25; // Blue-green coverage of a neuron nucleus
+    float astrocyte_max_aspect_ratio = 0.1; // Thinner nuclei are astrocytes
+    unsigned int synapse_area_bins = NUM_SYNAPSE_AREA_BINS; // Number of area bins
+    unsigned int synapse_bin_area = SYNAPSE_BIN_AREA; // Area covered by one bin
+    bool debug_images = false; // Return the intermediate masks as well
+};
+
+/* Caller owned 8 or 16-bit BGR plane, read without copying */
+struct PlaneBuffer {
+    const unsigned char *data = NULL;
+    int width = 0;
+    int height = 0;
+    size_t stride = 0; // Bytes per row, 0 for tightly packed rows
+    int depth = CV_8U; // CV_8U or CV_16U samples
+};
+
+/* Region count and area histogram of one region type */
+struct AreaBins {
+    unsigned int count = 0;
+    std::vector<unsigned int> bins;
+    float count_ci = 0.0; // 95% confidence half width of an estimated count
+};
+
+/* Synapses assigned to one neuron */
+struct NeuronSynapses {
+    cv::Point2f center; // Full resolution coordinates
+    AreaBins red_low, red_high;
+};
+
+/* Green overlap of one red object */
+struct ObjectOverlap {
+    cv::Point2f center; // Full resolution center of the bounding box
+    float area = 0.0; // Full resolution area
+    unsigned int green_objects = 0; // Green objects it overlaps
+    float overlap_area = 0.0; // Full resolution area shared with the green objects
+    int green_object = -1; // Green object with the largest overlap, -1 if none
+};
+
+/* Metrics of one window */
+struct WindowMetrics {
+    unsigned int astrocyte_count = 0;
+    unsigned int neuron_count = 0;
+    float mean_astrocyte_proximity = 0.0;
+    float stddev_astrocyte_proximity = 0.0;
+    AreaBins red_low, red_high;
+    AreaBins green_red_high, green_red_low;
+    AreaBins green_high, green_low;
+    std::vector<NeuronSynapses> neurons; // Filled when neuron_roi is set
+    std::vector<ObjectOverlap> red_low_overlaps; // Filled when colocalization is set
+    std::vector<ObjectOverlap> red_high_overlaps;
+    float sampled_fraction = 1.0; // Synapse tiles analyzed, below 1 the bins are estimates
+};
+
+/* Images of one window, all at the resolution of the planes */
+struct WindowImages {
+    cv::Mat processed; // Categorized cells over the green and red regions
+    cv::Mat original; // Blend of the planes, at the depth of the planes
+    std::vector<std::pair<std::string, cv::Mat>> debug; // Named intermediate masks
+    std::vector<std::pair<std::string, cv::Mat>> masks; // Enhanced 8-bit channel masks
+};
+
+/* Names of the enhanced channel masks, in WindowImages::masks order */
+const std::vector<std::string>& windowMaskNames();
+
+struct WindowCacheEntries;
+
+/* Intermediates of one window, shared by the segmenters of a parameter
+   sweep. Every entry is keyed by the parameters it depends on, so each
+   configuration reuses what an earlier one computed and recomputes only
+   what its own parameters change. The blue, green and red channel
+   windows are projected from the planes only once. A cache belongs to one
+   window of planes and is not shared between threads. */
+class WindowCache {
+
+public:
+    WindowCache();
+
+    ~WindowCache();
+
+    /* Entries reused and computed so far */
+    unsigned int hits() const;
+
+    unsigned int misses() const;
+
+    WindowCacheEntries& entries();
+
+private:
+    std::unique_ptr<WindowCacheEntries> entries_;
+};
+
+class NeuronSegmenter {
+
+public:
+    /* Called with the stage name when a pipeline stage completes */
+    typedef std::function<void(const std::string &stage)> StageHook;
+
+    NeuronSegmenter(SegmentationConfig config);
+
+    void setStageHook(StageHook hook);
+
+    const SegmentationConfig& config() const;
+
+    /* Analyze z_layers planes given in ring buffer order ((z-1) % z_layers).
+       The images are rendered only when images is not NULL, and the
+       intermediates are shared through cache when it is not NULL. */
+    bool analyzeWindow(const std::vector<PlaneBuffer> &planes,
+                        WindowMetrics *metrics, WindowImages *images = NULL,
+                        WindowCache *cache = NULL) const;
+
+    /* Same, for planes already wrapped in BGR matrices */
+    bool analyzeWindow(const std::vector<cv::Mat> &planes,
+                        WindowMetrics *metrics, WindowImages *images = NULL,
+                        WindowCache *cache = NULL) const;
+
+    /* Enhanced 8-bit masks of one plane, for the named windowMaskNames() 
+       masks only. The plane is projected as a window of copies of itself 
+       and only the channels the masks need are enhanced, over the whole 
+       plane, without the neuron roi or the sampled tiles. */
+    bool planeMasks(const cv::Mat &plane, const std::vector<std::string> &names,
+                        std::vector<cv::Mat> *masks) const;
+
+private:
+    void stageDone(const std::string &stage) const;
+
+    SegmentationConfig config_;
+    StageHook stage_hook_;
+};
+
+/* Wrap a BGR matrix as a plane buffer, without copying */
+PlaneBuffer planeBuffer(const cv::Mat &plane);
+
+#endif
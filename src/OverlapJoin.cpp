@@ -0,0 +1,44 @@
+#include <algorithm>
+#include <stdint.h>
+#include <unordered_map>
+
+#include "OverlapJoin.hpp"
+
+void overlapJoin(const cv::Mat &first, const cv::Mat &second, std::vector<ObjectPair> *pairs) {
+
+    CV_Assert((first.type() == CV_32SC1) && (second.type() == CV_32SC1) &&
+                                            (first.size() == second.size()));
+    pairs->clear();
+    std::unordered_map<uint64_t, size_t> index;
+    for (int y = 0; y < first.rows; y++) {
+        const int *first_row = first.ptr<int>(y);
+        const int *second_row = second.ptr<int>(y);
+
+        // Runs of the same pair skip the hash lookup
+        uint64_t last_key = 0;
+        size_t last = 0;
+        for (int x = 0; x < first.cols; x++) {
+            if (!first_row[x] || !second_row[x]) continue;
+            uint64_t key = ((uint64_t)(uint32_t)first_row[x] << 32) | (uint32_t)second_row[x];
+            if (key != last_key) {
+                auto found = index.find(key);
+                if (found == index.end()) {
+                    ObjectPair pair;
+                    pair.first = first_row[x];
+                    pair.second = second_row[x];
+                    pair.anchor = cv::Point(x, y);
+                    found = index.insert(std::make_pair(key, pairs->size())).first;
+                    pairs->push_back(pair);
+                }
+                last = found->second;
+                last_key = key;
+            }
+            ObjectPair &pair = (*pairs)[last];
+            pair.area++;
+            pair.anchor.x = std::min(pair.anchor.x, x);
+        }
+    }
+    std::sort(pairs->begin(), pairs->end(), [](const ObjectPair &a, const ObjectPair &b) {
+        return (a.first < b.first) || ((a.first == b.first) && (a.second < b.second));
+    });
+}
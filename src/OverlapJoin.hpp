@@ -0,0 +1,27 @@
+#ifndef OVERLAP_JOIN_HPP
+#define OVERLAP_JOIN_HPP
+
+/* Overlap join of two label maps
+   Finds every pair of objects of two label maps that share pixels, with
+   the number of shared pixels, in a single pass over the maps. The pairs
+   are hashed as they are met, so the cost follows the image size and the
+   number of overlapping pairs, not the number of objects. The shared
+   pixels of a pair are counted together even when they are not connected.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+/* Shared pixels of an object of the first map and one of the second */
+struct ObjectPair {
+    int first = 0; // Label in the first map
+    int second = 0; // Label in the second map
+    int area = 0; // Shared pixels
+    cv::Point anchor; // Top left corner of the bounding box of the shared pixels
+};
+
+/* Overlapping pairs of two CV_32S label maps of the same size, 0 is the
+   background. The pairs are sorted by first, then second label. */
+void overlapJoin(const cv::Mat &first, const cv::Mat &second, std::vector<ObjectPair> *pairs);
+
+#endif
@@ -0,0 +1,190 @@
+#include <algorithm>
+#include <functional>
+#include "OverlayRenderer.hpp"
+
+/* Render the bands of the overlay in parallel */
+class OverlayBody : public cv::ParallelLoopBody {
+
+public:
+    OverlayBody(std::function<void(int)> job) : job_(job) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int i = range.start; i < range.end; i++) {
+            job_(i);
+        }
+    }
+
+private:
+    std::function<void(int)> job_;
+};
+
+OverlayRenderer::OverlayRenderer(cv::Size size, int band_rows) : 
+    size_(size), band_rows_(band_rows) {}
+
+static bool touchesAllPlanes(cv::Scalar value) {
+    return (value[0] >= 0) && (value[1] >= 0) && (value[2] >= 0);
+}
+
+void OverlayRenderer::addLabelMap(cv::Mat mask, cv::Scalar value) {
+
+    Primitive primitive;
+    primitive.type = PrimitiveType::LABEL_MAP;
+    primitive.value = value;
+    primitive.thickness = 0;
+    primitive.mask = mask;
+    primitive.contours = NULL;
+    primitive.all_planes = touchesAllPlanes(value);
+    primitives_.push_back(primitive);
+}
+
+void OverlayRenderer::addFilledContours(const ContourStore &contours, 
+        const std::vector<int> &selected, cv::Scalar value) {
+
+    Primitive primitive;
+    primitive.type = PrimitiveType::FILLED_CONTOURS;
+    primitive.value = value;
+    primitive.thickness = 0;
+    primitive.contours = &contours;
+    primitive.selected = selected;
+    for (auto index : selected) {
+        primitive.bounds.push_back(cv::boundingRect(contours.contour(index).mat()));
+    }
+    primitive.all_planes = touchesAllPlanes(value);
+    primitives_.push_back(primitive);
+}
+
+void OverlayRenderer::addContourOutlines(const ContourStore &contours, 
+        const std::vector<int> &selected, cv::Scalar value, int thickness) {
+
+    Primitive primitive;
+    primitive.type = PrimitiveType::CONTOUR_OUTLINES;
+    primitive.value = value;
+    primitive.thickness = thickness;
+    primitive.contours = &contours;
+    primitive.selected = selected;
+    for (auto index : selected) {
+        cv::Rect bound = cv::boundingRect(contours.contour(index).mat());
+        primitive.bounds.push_back(cv::Rect(bound.x - thickness, bound.y - thickness, 
+                                bound.width + 2*thickness, bound.height + 2*thickness));
+    }
+    primitive.all_planes = touchesAllPlanes(value);
+    primitives_.push_back(primitive);
+}
+
+void OverlayRenderer::addEllipse(cv::RotatedRect ellipse, cv::Scalar value, int thickness) {
+
+    Primitive primitive;
+    primitive.type = PrimitiveType::ELLIPSE;
+    primitive.value = value;
+    primitive.thickness = thickness;
+    primitive.contours = NULL;
+    cv::Rect bound = ellipse.boundingRect();
+    primitive.bounds.push_back(cv::Rect(bound.x - thickness, bound.y - thickness, 
+                                bound.width + 2*thickness, bound.height + 2*thickness));
+    primitive.ellipse = ellipse;
+    primitive.all_planes = touchesAllPlanes(value);
+    primitives_.push_back(primitive);
+}
+
+void OverlayRenderer::drawPlane(const Primitive &primitive, cv::Rect band, 
+                                    cv::Mat *plane, cv::Scalar color) const {
+
+    cv::Point offset(0, -band.y);
+    switch(primitive.type) {
+        case PrimitiveType::LABEL_MAP: {
+            plane->setTo(color, primitive.mask(band));
+        } break;
+
+        case PrimitiveType::FILLED_CONTOURS:
+        case PrimitiveType::CONTOUR_OUTLINES: {
+            // Gather the contours that reach into the band and draw them in one call
+            std::vector<const cv::Point*> points;
+            std::vector<int> point_cnt;
+            for (size_t i = 0; i < primitive.bounds.size(); i++) {
+                if ((primitive.bounds[i] & band).area() == 0) continue;
+                ContourView contour = primitive.contours->contour(primitive.selected[i]);
+                if (!contour.count) continue;
+                points.push_back(contour.points);
+                point_cnt.push_back(contour.count);
+            }
+            if (points.empty()) break;
+            if (primitive.type == PrimitiveType::FILLED_CONTOURS) {
+                // Contours are filled one by one, overlaps must not cancel out
+                for (size_t i = 0; i < points.size(); i++) {
+                    cv::fillPoly(*plane, &points[i], &point_cnt[i], 1, color, 
+                                    cv::LINE_8, 0, offset);
+                }
+            } else {
+                // Outlines have no offset argument, shift them into one buffer
+                std::vector<cv::Point> shifted;
+                for (size_t i = 0; i < points.size(); i++) {
+                    for (int k = 0; k < point_cnt[i]; k++) {
+                        shifted.push_back(points[i][k] + offset);
+                    }
+                }
+                size_t start = 0;
+                for (size_t i = 0; i < points.size(); i++) {
+                    points[i] = &shifted[start];
+                    start += point_cnt[i];
+                }
+                cv::polylines(*plane, &points[0], &point_cnt[0], (int)points.size(), true, 
+                                color, primitive.thickness, cv::LINE_8);
+            }
+        } break;
+
+        case PrimitiveType::ELLIPSE: {
+            if ((primitive.bounds[0] & band).area() == 0) break;
+            cv::RotatedRect shifted = primitive.ellipse;
+            shifted.center.y -= band.y;
+            cv::ellipse(*plane, shifted, color, primitive.thickness, cv::LINE_8);
+        } break;
+    }
+}
+
+void OverlayRenderer::renderBand(cv::Range rows, cv::Mat *dst) const {
+
+    cv::Rect band(0, rows.start, size_.width, rows.end - rows.start);
+    cv::Mat color = (*dst)(band);
+
+    // Primitives touching a subset of planes are drawn per plane, those 
+    // touching all planes are drawn on the BGR band in a single call
+    std::vector<cv::Mat> planes(3);
+    for (auto& plane : planes) {
+        plane = cv::Mat::zeros(band.size(), CV_8UC1);
+    }
+    bool planes_current = true;
+    for (auto& primitive : primitives_) {
+        if (primitive.all_planes) {
+            if (planes_current) {
+                cv::merge(planes, color);
+                planes_current = false;
+            }
+            drawPlane(primitive, band, &color, primitive.value);
+        } else {
+            if (!planes_current) {
+                cv::split(color, planes);
+                planes_current = true;
+            }
+            for (int p = 0; p < 3; p++) {
+                if (primitive.value[p] < 0) continue;
+                drawPlane(primitive, band, &planes[p], cv::Scalar::all(primitive.value[p]));
+            }
+        }
+    }
+    if (planes_current) {
+        cv::merge(planes, color);
+    }
+}
+
+cv::Mat OverlayRenderer::render() {
+
+    cv::Mat dst(size_, CV_8UC3);
+    int band_cnt = (size_.height + band_rows_ - 1)/band_rows_;
+    OverlayBody body([&](int band_index) {
+        int begin = band_index * band_rows_;
+        int end = std::min(size_.height, begin + band_rows_);
+        renderBand(cv::Range(begin, end), &dst);
+    });
+    cv::parallel_for_(cv::Range(0, band_cnt), body);
+    return dst;
+}
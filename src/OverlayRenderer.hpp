@@ -0,0 +1,69 @@
+#ifndef OVERLAY_RENDERER_HPP
+#define OVERLAY_RENDERER_HPP
+
+/* Overlay renderer
+   Collects label maps and drawing primitives for the blue, green and red 
+   planes of the processed image, then rasterizes all three planes together 
+   in one parallel pass over horizontal bands of the image.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ContourStore.hpp"
+
+#define OVERLAY_KEEP    -1  // Plane value that leaves the plane untouched
+
+class OverlayRenderer {
+
+public:
+    OverlayRenderer(cv::Size size, int band_rows = 64);
+
+    /* Set value where the mask is non zero */
+    void addLabelMap(cv::Mat mask, cv::Scalar value);
+
+    /* Fill each selected contour, ignoring holes. The store must outlive render(). */
+    void addFilledContours(const ContourStore &contours, const std::vector<int> &selected, 
+                            cv::Scalar value);
+
+    /* Draw the outline of each selected contour */
+    void addContourOutlines(const ContourStore &contours, const std::vector<int> &selected, 
+                            cv::Scalar value, int thickness);
+
+    /* Draw the outline of an ellipse */
+    void addEllipse(cv::RotatedRect ellipse, cv::Scalar value, int thickness);
+
+    /* Rasterize the blue, green and red planes into a BGR image */
+    cv::Mat render();
+
+private:
+    enum class PrimitiveType : unsigned char {
+        LABEL_MAP = 0,
+        FILLED_CONTOURS,
+        CONTOUR_OUTLINES,
+        ELLIPSE
+    };
+
+    struct Primitive {
+        PrimitiveType type;
+        cv::Scalar value;
+        int thickness;
+        cv::Mat mask;
+        const ContourStore *contours;
+        std::vector<int> selected;
+        std::vector<cv::Rect> bounds;
+        cv::RotatedRect ellipse;
+        bool all_planes;
+    };
+
+    void renderBand(cv::Range rows, cv::Mat *dst) const;
+
+    void drawPlane(const Primitive &primitive, cv::Rect band, 
+                    cv::Mat *plane, cv::Scalar color) const;
+
+    cv::Size size_;
+    int band_rows_;
+    std::vector<Primitive> primitives_;
+};
+
+#endif
@@ -0,0 +1,123 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdlib.h>
+
+#include "ParameterSweep.hpp"
+
+/* Set a swept parameter of a configuration */
+static void setParameter(std::string name, double value, SegmentationConfig *config) {
+
+    float level = (float)value;
+    if (name == "green_floor") config->green_floor = level;
+    else if (name == "green_mask_level") config->green_mask_level = level;
+    else if (name == "green_combined_level") config->green_combined_level = level;
+    else if (name == "red_floor") config->red_floor = level;
+    else if (name == "red_mask_level") config->red_mask_level = level;
+    else if (name == "red_low_ceiling") config->red_low_ceiling = level;
+    else if (name == "red_low_level") config->red_low_level = level;
+    else if (name == "neuron_min_coverage") config->neuron_min_coverage = level;
+    else if (name == "astrocyte_max_aspect_ratio") config->astrocyte_max_aspect_ratio = level;
+    else if (name == "z_layers") config->z_layers = (unsigned int)value;
+}
+
+const std::vector<std::string>& ParameterSweep::parameterNames() {
+    static const std::vector<std::string> names = {"green_floor", "green_mask_level",
+                                    "green_combined_level", "red_floor", "red_mask_level",
+                                    "red_low_ceiling", "red_low_level", "neuron_min_coverage",
+                                    "astrocyte_max_aspect_ratio", "z_layers"};
+    return names;
+}
+
+bool ParameterSweep::addAxis(std::string spec) {
+
+    SweepAxis axis;
+    std::size_t found = spec.find("=");
+    axis.name = spec.substr(0, found);
+    const std::vector<std::string> &names = parameterNames();
+    if ((found == std::string::npos) ||
+                (std::find(names.begin(), names.end(), axis.name) == names.end())) {
+        std::cerr << "Unknown sweep parameter '" << axis.name << "'." << std::endl;
+        return false;
+    }
+    for (auto& other : axes_) {
+        if (other.name == axis.name) {
+            std::cerr << "Sweep parameter '" << axis.name << "' given twice." << std::endl;
+            return false;
+        }
+    }
+
+    std::istringstream values(spec.substr(found + 1));
+    std::string value;
+    while (getline(values, value, ',')) {
+        char *end = NULL;
+        double number = strtod(value.c_str(), &end);
+        if (value.empty() || *end || (number < 0.0) ||
+                ((axis.name == "z_layers") && (number != 3.0) && (number != 4.0))) {
+            std::cerr << "Invalid value '" << value << "' of sweep parameter '"
+                        << axis.name << "'." << std::endl;
+            return false;
+        }
+        axis.values.push_back(number);
+    }
+    if (axis.values.empty()) {
+        std::cerr << "Sweep parameter '" << axis.name << "' has no values." << std::endl;
+        return false;
+    }
+    axes_.push_back(axis);
+    return true;
+}
+
+size_t ParameterSweep::size() const {
+
+    if (axes_.empty()) return 0;
+    size_t points = 1;
+    for (auto& axis : axes_) {
+        points *= axis.values.size();
+    }
+    return points;
+}
+
+bool ParameterSweep::empty() const {
+    return axes_.empty();
+}
+
+std::vector<double> ParameterSweep::values(size_t point) const {
+
+    // The last parameter varies fastest
+    std::vector<double> point_values(axes_.size());
+    for (size_t i = axes_.size(); i-- > 0;) {
+        point_values[i] = axes_[i].values[point % axes_[i].values.size()];
+        point /= axes_[i].values.size();
+    }
+    return point_values;
+}
+
+SegmentationConfig ParameterSweep::config(size_t point, SegmentationConfig base) const {
+
+    std::vector<double> point_values = values(point);
+    for (size_t i = 0; i < axes_.size(); i++) {
+        setParameter(axes_[i].name, point_values[i], &base);
+    }
+    return base;
+}
+
+bool ParameterSweep::writeIndex(std::string path) const {
+
+    std::ofstream index(path, std::ios::out);
+    if (!index.is_open()) return false;
+    index << "grid point,";
+    for (auto& axis : axes_) {
+        index << axis.name << ",";
+    }
+    index << std::endl;
+    for (size_t point = 0; point < size(); point++) {
+        index << point << ",";
+        for (auto value : values(point)) {
+            index << value << ",";
+        }
+        index << std::endl;
+    }
+    return true;
+}
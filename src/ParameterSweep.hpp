@@ -0,0 +1,52 @@
+#ifndef PARAMETER_SWEEP_HPP
+#define PARAMETER_SWEEP_HPP
+
+/* Parameter sweep
+   Grid of segmentation parameters, the product of the values given for
+   each swept parameter. The grid points are numbered from 0, with the last
+   parameter varying fastest. Every window is analyzed at all the grid
+   points with one WindowCache, so each point recomputes only the stages
+   that depend on the parameters it changes.
+
+   The index file lists the grid points, one csv row each:
+
+     grid point, value of each swept parameter
+ */
+
+#include <string>
+#include <vector>
+#include "NeuronSeg.hpp"
+
+/* Values of one swept parameter */
+struct SweepAxis {
+    std::string name;
+    std::vector<double> values;
+};
+
+class ParameterSweep {
+
+public:
+    /* Names of the parameters that can be swept */
+    static const std::vector<std::string>& parameterNames();
+
+    /* Add a parameter given as "name=value,value,..." */
+    bool addAxis(std::string spec);
+
+    /* Number of grid points, 0 without any swept parameter */
+    size_t size() const;
+
+    bool empty() const;
+
+    /* Base configuration with the parameters of a grid point */
+    SegmentationConfig config(size_t point, SegmentationConfig base) const;
+
+    bool writeIndex(std::string path) const;
+
+private:
+    /* Value of each parameter at a grid point */
+    std::vector<double> values(size_t point) const;
+
+    std::vector<SweepAxis> axes_;
+};
+
+#endif
@@ -0,0 +1,447 @@
+#include <algorithm>
+#include <ctype.h>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <math.h>
+#include <sstream>
+#include <stdlib.h>
+
+#include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/imgcodecs.hpp"
+
+#include "PlateAggregator.hpp"
+
+#define PLATE_GROUP     "plate"
+
+/* Metric column values of a window, in metricNames order */
+static std::vector<double> metricValues(const WindowMetrics &metrics) {
+    return {
+        (double) metrics.astrocyte_count + metrics.neuron_count,
+        (double) metrics.astrocyte_count,
+        (double) metrics.neuron_count,
+        (double) metrics.mean_astrocyte_proximity,
+        (double) metrics.red_low.count + metrics.red_high.count,
+        (double) metrics.red_low.count,
+        (double) metrics.red_high.count,
+        (double) metrics.green_red_high.count,
+        (double) metrics.green_red_low.count,
+        (double) metrics.green_high.count,
+        (double) metrics.green_low.count
+    };
+}
+
+static void mergeProfiles(std::vector<std::vector<RunningStat>> *profile,
+                            const std::vector<std::vector<RunningStat>> &other) {
+    if (profile->size() < other.size()) {
+        profile->resize(other.size(),
+                std::vector<RunningStat>(PlateAggregator::metricNames().size()));
+    }
+    for (size_t z = 0; z < other.size(); z++) {
+        for (size_t i = 0; i < other[z].size(); i++) {
+            (*profile)[z][i].merge(other[z][i]);
+        }
+    }
+}
+
+void RunningStat::add(double value) {
+    n++;
+    double delta = value - mean;
+    mean += delta/n;
+    m2 += delta*(value - mean);
+}
+
+void RunningStat::merge(const RunningStat &other) {
+    if (!other.n) return;
+    if (!n) {
+        *this = other;
+        return;
+    }
+    uint64_t total = n + other.n;
+    double delta = other.mean - mean;
+    mean += delta*other.n/total;
+    m2 += other.m2 + delta*delta*((double) n*other.n/total);
+    n = total;
+}
+
+double RunningStat::variance() const {
+    return (n > 1) ? m2/(n - 1) : 0.0;
+}
+
+void WellAggregate::addWindow(unsigned int window_index, const WindowMetrics &window) {
+
+    std::vector<double> values = metricValues(window);
+    if (metrics.empty()) {
+        metrics.resize(values.size());
+        bins.assign(PlateAggregator::binNames().size(), 0);
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+        metrics[i].add(values[i]);
+    }
+
+    const AreaBins *channels[] = {&window.red_low, &window.red_high, &window.green_red_high,
+                                    &window.green_red_low, &window.green_high, &window.green_low};
+    for (unsigned int c = 0; c < 6; c++) {
+        size_t bin_cnt = std::min(channels[c]->bins.size(), (size_t) NUM_SYNAPSE_AREA_BINS);
+        for (size_t i = 0; i < bin_cnt; i++) {
+            bins[c*NUM_SYNAPSE_AREA_BINS + i] += channels[c]->bins[i];
+        }
+    }
+
+    if (profile.size() < window_index) {
+        profile.resize(window_index, std::vector<RunningStat>(values.size()));
+    }
+    for (size_t i = 0; i < values.size(); i++) {
+        profile[window_index-1][i].add(values[i]);
+    }
+}
+
+void WellAggregate::merge(const WellAggregate &other) {
+    if (metrics.empty()) {
+        metrics.resize(PlateAggregator::metricNames().size());
+        bins.assign(PlateAggregator::binNames().size(), 0);
+    }
+    for (size_t i = 0; i < other.metrics.size(); i++) {
+        metrics[i].merge(other.metrics[i]);
+    }
+    for (size_t i = 0; i < other.bins.size(); i++) {
+        bins[i] += other.bins[i];
+    }
+    mergeProfiles(&profile, other.profile);
+}
+
+const std::vector<std::string>& PlateAggregator::metricNames() {
+    static const std::vector<std::string> names = {
+        "total cell count", "astrocyte count", "neuron count",
+        "astrocytes per neuron - mean", "total synapse count",
+        "low intensity synapse count", "high intensity synapse count",
+        "green-red high intensity common area count",
+        "green-red low intensity common area count", "green high count", "green low count"
+    };
+    return names;
+}
+
+const std::vector<std::string>& PlateAggregator::binNames() {
+    static std::vector<std::string> names;
+    if (names.empty()) {
+        const std::string channels[] = {"low intensity synapse area", "high intensity synapse area",
+                                        "green-red high common area", "green-red low common area",
+                                        "green high area", "green low area"};
+        for (auto& channel : channels) {
+            for (unsigned int i = 0; i < NUM_SYNAPSE_AREA_BINS-1; i++) {
+                names.push_back(std::to_string(i*SYNAPSE_BIN_AREA) + " <= " + channel +
+                                    " < " + std::to_string((i+1)*SYNAPSE_BIN_AREA));
+            }
+            names.push_back(channel + " >= " +
+                                std::to_string((NUM_SYNAPSE_AREA_BINS-1)*SYNAPSE_BIN_AREA));
+        }
+    }
+    return names;
+}
+
+void PlateAggregator::addWell(std::string well, const WellAggregate &aggregate) {
+
+    // The window profile is kept for the plate as a whole
+    WellAggregate kept = aggregate;
+    mergeProfiles(&profile_, kept.profile);
+    kept.profile.clear();
+    wells_[well].merge(kept);
+}
+
+void PlateAggregator::merge(const PlateAggregator &other) {
+    for (auto& well : other.wells_) {
+        wells_[well.first].merge(well.second);
+    }
+    mergeProfiles(&profile_, other.profile_);
+}
+
+bool PlateAggregator::readSummary(std::string path) {
+
+    std::ifstream summary(path);
+    if (!summary.is_open()) {
+        std::cerr << "Could not open the summary '" << path << "'" << std::endl;
+        return false;
+    }
+    const std::vector<std::string> &metric_names = metricNames();
+    const std::vector<std::string> &bin_names = binNames();
+    PlateAggregator shard;
+    std::string line;
+    getline(summary, line);
+    while (getline(summary, line)) {
+        std::vector<std::string> fields;
+        std::istringstream iss(line);
+        std::string field;
+        while (getline(iss, field, ',')) {
+            fields.push_back(field);
+        }
+        if (fields.size() < 4) continue;
+        const std::string &group = fields[0], &kind = fields[1], &name = fields[2];
+
+        RunningStat stat;
+        stat.n = strtoull(fields[3].c_str(), NULL, 10);
+        if (fields.size() >= 6) {
+            stat.mean = strtod(fields[4].c_str(), NULL);
+            stat.m2 = (stat.n > 1) ? strtod(fields[5].c_str(), NULL)*(stat.n - 1) : 0.0;
+        }
+        int metric = (int) (std::find(metric_names.begin(), metric_names.end(), name) -
+                                                                metric_names.begin());
+
+        // The plate rows are recomputed from the wells, except for the profile
+        if ((kind.compare(0, 1, "z") == 0) && (group == PLATE_GROUP)) {
+            size_t window = strtoul(kind.substr(1).c_str(), NULL, 10);
+            if (!window || (metric == (int) metric_names.size())) continue;
+            if (shard.profile_.size() < window) {
+                shard.profile_.resize(window, std::vector<RunningStat>(metric_names.size()));
+            }
+            shard.profile_[window-1][metric] = stat;
+        } else if (group == PLATE_GROUP) {
+            continue;
+        } else if ((kind == "metric") && (metric < (int) metric_names.size())) {
+            WellAggregate &well = shard.wells_[group];
+            if (well.metrics.empty()) well.merge(WellAggregate());
+            well.metrics[metric] = stat;
+        } else if (kind == "bin") {
+            size_t bin = std::find(bin_names.begin(), bin_names.end(), name) - bin_names.begin();
+            if (bin == bin_names.size()) continue;
+            WellAggregate &well = shard.wells_[group];
+            if (well.metrics.empty()) well.merge(WellAggregate());
+            well.bins[bin] = stat.n;
+        }
+    }
+    merge(shard);
+    return true;
+}
+
+bool PlateAggregator::writeSummary(std::string path) const {
+
+    std::ofstream summary(path, std::ios::out);
+    if (!summary.is_open()) {
+        std::cerr << "Could not create the summary file." << std::endl;
+        return false;
+    }
+    const std::vector<std::string> &metric_names = metricNames();
+    const std::vector<std::string> &bin_names = binNames();
+    summary << std::setprecision(std::numeric_limits<double>::max_digits10);
+    summary << "group,kind,name,n,mean,variance" << std::endl;
+
+    auto writeGroup = [&](std::string group, const WellAggregate &aggregate) {
+        for (size_t i = 0; i < aggregate.metrics.size(); i++) {
+            summary << group << ",metric," << metric_names[i] << "," << aggregate.metrics[i].n
+                    << "," << aggregate.metrics[i].mean << ","
+                    << aggregate.metrics[i].variance() << std::endl;
+        }
+        for (size_t i = 0; i < aggregate.bins.size(); i++) {
+            summary << group << ",bin," << bin_names[i] << "," << aggregate.bins[i] << std::endl;
+        }
+    };
+
+    WellAggregate plate;
+    for (auto& well : wells_) {
+        plate.merge(well.second);
+    }
+    writeGroup(PLATE_GROUP, plate);
+    for (size_t z = 0; z < profile_.size(); z++) {
+        for (size_t i = 0; i < profile_[z].size(); i++) {
+            summary << PLATE_GROUP << ",z" << z+1 << "," << metric_names[i] << ","
+                    << profile_[z][i].n << "," << profile_[z][i].mean << ","
+                    << profile_[z][i].variance() << std::endl;
+        }
+    }
+    for (auto& well : wells_) {
+        writeGroup(well.first, well.second);
+    }
+    return true;
+}
+
+bool PlateAggregator::writeHeatmap(std::string path) const {
+
+    if (wells_.empty()) return false;
+    const std::vector<std::string> &metric_names = metricNames();
+    int rows = (int) metric_names.size(), cols = (int) wells_.size();
+
+    // Z-score of each well mean against the other wells, per metric
+    cv::Mat levels(rows, cols, CV_8UC1);
+    for (int r = 0; r < rows; r++) {
+        std::vector<uchar> well_levels = wellLevels(r);
+        for (int c = 0; c < cols; c++) {
+            levels.at<uchar>(r, c) = well_levels[c];
+        }
+    }
+    cv::Mat cells;
+    cv::resize(levels, levels, cv::Size(cols*HEATMAP_CELL_SIZE, rows*HEATMAP_CELL_SIZE),
+                                                                0, 0, cv::INTER_NEAREST);
+    cv::applyColorMap(levels, cells, cv::COLORMAP_JET);
+
+    // Metric names to the right, well names below and written downwards
+    double font_scale = 0.45;
+    int baseline = 0, label_width = 0, well_width = 0;
+    for (auto& name : metric_names) {
+        label_width = std::max(label_width, cv::getTextSize(name, cv::FONT_HERSHEY_SIMPLEX,
+                                                    font_scale, 1, &baseline).width);
+    }
+    for (auto& well : wells_) {
+        well_width = std::max(well_width, cv::getTextSize(well.first, cv::FONT_HERSHEY_SIMPLEX,
+                                                    font_scale, 1, &baseline).width);
+    }
+    cv::Mat heatmap(cells.rows + well_width + 16, cells.cols + label_width + 16, CV_8UC3,
+                                                            cv::Scalar(255, 255, 255));
+    cells.copyTo(heatmap(cv::Rect(0, 0, cells.cols, cells.rows)));
+    for (int r = 0; r < rows; r++) {
+        cv::putText(heatmap, metric_names[r],
+                    cv::Point(cells.cols + 8, (r+1)*HEATMAP_CELL_SIZE - HEATMAP_CELL_SIZE/3),
+                    cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(0, 0, 0));
+    }
+    int c = 0;
+    for (auto& well : wells_) {
+        cv::Mat label(HEATMAP_CELL_SIZE, well_width + 8, CV_8UC3, cv::Scalar(255, 255, 255));
+        cv::putText(label, well.first, cv::Point(8, HEATMAP_CELL_SIZE - HEATMAP_CELL_SIZE/3),
+                    cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(0, 0, 0));
+        cv::transpose(label, label);
+        cv::flip(label, label, 1);
+        label.copyTo(heatmap(cv::Rect(c++*HEATMAP_CELL_SIZE, cells.rows,
+                                                    label.cols, label.rows)));
+    }
+    if (!cv::imwrite(path, heatmap)) {
+        std::cerr << "Could not write the heatmap." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool PlateAggregator::writePlateMap(std::string path) const {
+
+    // Plate positions of the wells, the smallest standard plate holding them
+    std::vector<cv::Point> positions;
+    int rows = 0, cols = 0;
+    for (auto& well : wells_) {
+        cv::Point position(-1, -1);
+        if (platePosition(well.first, &position.y, &position.x)) {
+            rows = std::max(rows, position.y + 1);
+            cols = std::max(cols, position.x + 1);
+        }
+        positions.push_back(position);
+    }
+    if (!rows) return true;
+    const cv::Size plates[] = {cv::Size(12, 8), cv::Size(24, 16), cv::Size(48, 32)};
+    for (auto& plate : plates) {
+        if ((rows <= plate.height) && (cols <= plate.width)) {
+            rows = plate.height;
+            cols = plate.width;
+            break;
+        }
+    }
+
+    // One panel per metric, row letters to the left and column numbers above
+    const std::vector<std::string> &metric_names = metricNames();
+    double font_scale = 0.4;
+    int margin = HEATMAP_CELL_SIZE;
+    cv::Size panel((cols + 1)*HEATMAP_CELL_SIZE, (rows + 2)*HEATMAP_CELL_SIZE);
+    int panel_rows = ((int)metric_names.size() + PLATE_MAP_COLUMNS - 1)/PLATE_MAP_COLUMNS;
+    cv::Mat plate_map(panel_rows*panel.height + margin, 
+                        PLATE_MAP_COLUMNS*panel.width + margin, CV_8UC3, 
+                        cv::Scalar(255, 255, 255));
+    for (size_t m = 0; m < metric_names.size(); m++) {
+        cv::Point origin((int)(m % PLATE_MAP_COLUMNS)*panel.width + margin/2, 
+                            (int)(m / PLATE_MAP_COLUMNS)*panel.height + margin/2);
+        cv::putText(plate_map, metric_names[m], 
+                    origin + cv::Point(HEATMAP_CELL_SIZE, HEATMAP_CELL_SIZE*2/3), 
+                    cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(0, 0, 0));
+        cv::Point grid = origin + cv::Point(HEATMAP_CELL_SIZE, 2*HEATMAP_CELL_SIZE);
+        for (int c = 0; c < cols; c++) {
+            cv::putText(plate_map, std::to_string(c + 1), 
+                        grid + cv::Point(c*HEATMAP_CELL_SIZE + 2, -4), 
+                        cv::FONT_HERSHEY_SIMPLEX, font_scale*0.8, cv::Scalar(0, 0, 0));
+        }
+        for (int r = 0; r < rows; r++) {
+            std::string row_name = (r < 26) ? std::string(1, (char)('A' + r)) : 
+                            std::string(1, 'A') + (char)('A' + r - 26);
+            cv::putText(plate_map, row_name, 
+                        grid + cv::Point(-HEATMAP_CELL_SIZE + 2, 
+                                            (r + 1)*HEATMAP_CELL_SIZE - HEATMAP_CELL_SIZE/3), 
+                        cv::FONT_HERSHEY_SIMPLEX, font_scale, cv::Scalar(0, 0, 0));
+        }
+
+        // Wells without data are left gray
+        cv::rectangle(plate_map, cv::Rect(grid, cv::Size(cols*HEATMAP_CELL_SIZE, 
+                                                            rows*HEATMAP_CELL_SIZE)), 
+                        cv::Scalar(200, 200, 200), cv::FILLED);
+        std::vector<uchar> well_levels = wellLevels(m);
+        cv::Mat levels(1, (int)well_levels.size(), CV_8UC1, well_levels.data());
+        cv::Mat colors;
+        cv::applyColorMap(levels, colors, cv::COLORMAP_JET);
+        for (size_t w = 0; w < positions.size(); w++) {
+            if (positions[w].x < 0) continue;
+            cv::Rect cell(grid + positions[w]*HEATMAP_CELL_SIZE, 
+                            cv::Size(HEATMAP_CELL_SIZE, HEATMAP_CELL_SIZE));
+            cv::Vec3b color = colors.at<cv::Vec3b>(0, (int)w);
+            cv::rectangle(plate_map, cell, cv::Scalar(color[0], color[1], color[2]), 
+                            cv::FILLED);
+        }
+        for (int r = 0; r <= rows; r++) {
+            cv::line(plate_map, grid + cv::Point(0, r*HEATMAP_CELL_SIZE), 
+                        grid + cv::Point(cols*HEATMAP_CELL_SIZE, r*HEATMAP_CELL_SIZE), 
+                        cv::Scalar(255, 255, 255));
+        }
+        for (int c = 0; c <= cols; c++) {
+            cv::line(plate_map, grid + cv::Point(c*HEATMAP_CELL_SIZE, 0), 
+                        grid + cv::Point(c*HEATMAP_CELL_SIZE, rows*HEATMAP_CELL_SIZE), 
+                        cv::Scalar(255, 255, 255));
+        }
+    }
+    if (!cv::imwrite(path, plate_map)) {
+        std::cerr << "Could not write the plate map." << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool PlateAggregator::platePosition(std::string well, int *row, int *col) {
+
+    // One or two row letters and a column number, not inside a longer word
+    bool found = false;
+    for (size_t i = 0; i < well.size(); i++) {
+        if ((i > 0) && isalnum((unsigned char)well[i-1])) continue;
+        size_t letters = 0;
+        while ((i + letters < well.size()) && isupper((unsigned char)well[i + letters])) {
+            letters++;
+        }
+        if ((letters < 1) || (letters > 2)) continue;
+        size_t digits = 0;
+        while ((i + letters + digits < well.size()) && 
+                    isdigit((unsigned char)well[i + letters + digits])) {
+            digits++;
+        }
+        size_t end = i + letters + digits;
+        if ((digits < 1) || (digits > 2) || 
+                ((end < well.size()) && isalnum((unsigned char)well[end]))) {
+            continue;
+        }
+        int column = atoi(well.substr(i + letters, digits).c_str());
+        if (column < 1) continue;
+        *row = (letters == 1) ? (well[i] - 'A') : (26 + well[i+1] - 'A');
+        *col = column - 1;
+        found = true;
+    }
+    return found;
+}
+
+std::vector<uchar> PlateAggregator::wellLevels(size_t metric) const {
+    RunningStat across;
+    for (auto& well : wells_) {
+        across.add(well.second.metrics[metric].mean);
+    }
+    double sd = sqrt(across.variance());
+    std::vector<uchar> levels;
+    for (auto& well : wells_) {
+        double score = (sd > 0.0) ? (well.second.metrics[metric].mean - across.mean)/sd : 0.0;
+        score = std::max(-HEATMAP_Z_RANGE, std::min(HEATMAP_Z_RANGE, score));
+        levels.push_back(
+                cv::saturate_cast<uchar>((score + HEATMAP_Z_RANGE)*255.0/(2*HEATMAP_Z_RANGE)));
+    }
+    return levels;
+}
+
+bool PlateAggregator::empty() const {
+    return wells_.empty();
+}
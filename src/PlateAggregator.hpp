@@ -0,0 +1,99 @@
+#ifndef PLATE_AGGREGATOR_HPP
+#define PLATE_AGGREGATOR_HPP
+
+/* Plate aggregation
+   Running statistics of the window metrics, updated as the windows are
+   analyzed instead of re-parsing the output csv file. Each directory (a
+   well) keeps the Welford mean and variance of every metric column and
+   its merged synapse area bins. The plate keeps the wells and the profile
+   of every metric against the window index. All parts merge exactly, so
+   the workers fill their own well aggregates and shards of a plate can be
+   combined from their summary files.
+
+   The summary is a csv file with one row per statistic:
+
+     group, kind (metric, bin or z<window index>), name, n, mean, variance
+
+   where group is the well name or "plate", and n is the bin count for the
+   bin rows. The window profile is written for the plate only. The heatmap
+   has one row per metric and one column per well (in the summary order),
+   colored by the z-score of the well means. The plate map lays the same
+   z-scores out on the plate grid, one panel per metric, for the wells
+   whose name holds a plate position such as B07.
+ */
+
+#include <map>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "NeuronSeg.hpp"
+
+#define HEATMAP_CELL_SIZE   24  // Pixels per heatmap cell
+#define HEATMAP_Z_RANGE     2.5 // Z-scores mapped to the ends of the color map
+#define PLATE_MAP_COLUMNS   3   // Metric panels side by side in the plate map
+
+/* Welford mean and variance, merged with the parallel formula */
+struct RunningStat {
+    uint64_t n = 0;
+    double mean = 0.0;
+    double m2 = 0.0; // Sum of the squared differences to the mean
+
+    void add(double value);
+
+    void merge(const RunningStat &other);
+
+    /* Sample variance, 0 below 2 values */
+    double variance() const;
+};
+
+/* Windows of one well */
+struct WellAggregate {
+    std::vector<RunningStat> metrics; // One per metric name
+    std::vector<uint64_t> bins; // Area bins of each synapse channel, back to back
+    std::vector<std::vector<RunningStat>> profile; // [window index - 1][metric]
+
+    void addWindow(unsigned int window_index, const WindowMetrics &metrics);
+
+    void merge(const WellAggregate &other);
+};
+
+class PlateAggregator {
+
+public:
+    /* Names of the aggregated metric columns */
+    static const std::vector<std::string>& metricNames();
+
+    /* Names of the merged area bins */
+    static const std::vector<std::string>& binNames();
+
+    /* Merge the windows of a well, wells of the same name are combined */
+    void addWell(std::string well, const WellAggregate &aggregate);
+
+    void merge(const PlateAggregator &other);
+
+    /* Merge the summary of another shard of the plate */
+    bool readSummary(std::string path);
+
+    bool writeSummary(std::string path) const;
+
+    bool writeHeatmap(std::string path) const;
+
+    /* Plate grid of the well z-scores, written only when a well name holds
+       a plate position */
+    bool writePlateMap(std::string path) const;
+
+    /* Row and column (from 0) of a plate position in a well name, the last
+       one found, such as plate3_B07 or C12 */
+    static bool platePosition(std::string well, int *row, int *col);
+
+    bool empty() const;
+
+private:
+    /* Z-score color levels of the well means of a metric, in well order */
+    std::vector<uchar> wellLevels(size_t metric) const;
+
+    std::map<std::string, WellAggregate> wells_; // Well metrics and bins
+    std::vector<std::vector<RunningStat>> profile_; // Plate profile
+};
+
+#endif
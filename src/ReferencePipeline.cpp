@@ -0,0 +1,546 @@
+#include <iostream>
+#include <math.h>
+#include "opencv2/photo/photo.hpp"
+
+#include "ReferencePipeline.hpp"
+
+// The frozen functions are private to this file, apart from their library 
+// counterparts of the same name
+namespace {
+
+/* Channel type */
+enum class ChannelType : unsigned char {
+    BLUE = 0,
+    GREEN_LOW,
+    GREEN_HIGH,
+    GREEN_COMBINED,
+    ENHANCE_AXON,
+    RED_LOW,
+    RED_HIGH
+};
+
+/* Hierarchy type */
+enum class HierarchyType : unsigned char {
+    INVALID_CNTR = 0,
+    CHILD_CNTR,
+    PARENT_CNTR
+};
+
+/* Canny Edge Detection */
+void CannyThreshold(cv::Mat src, cv::Mat *dst) {
+
+    cv::Mat detected_edges;
+    blur(src, detected_edges, cv::Size(3,3));
+    Canny(detected_edges, detected_edges, 0, 255, 3);
+    *dst = cv::Scalar::all(0);
+    src.copyTo(*dst, detected_edges);
+}
+
+/* Enhance the image */
+bool enhanceImage(cv::Mat src, ChannelType channel_type, cv::Mat *dst) {
+
+    // Convert to grayscale
+    cv::Mat src_gray;
+    cvtColor (src, src_gray, cv::COLOR_BGR2GRAY);
+
+    // Enhance the image using Gaussian blur and thresholding
+    cv::Mat enhanced;
+    switch(channel_type) {
+        case ChannelType::BLUE: {
+            // Enhance the blue channel
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
+
+            // Invert the mask
+            bitwise_not(enhanced, enhanced);
+        } break;
+
+        case ChannelType::GREEN_LOW: {
+            // Enhance the green channel low intensities
+            cv::Mat green_low = src_gray;
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 200, 255, cv::THRESH_BINARY);
+
+            // Enhance the low intensity features
+            cv::Mat green_low_gauss;
+            cv::GaussianBlur(green_low, green_low_gauss, cv::Size(3,3), 0, 0);
+            bitwise_and(green_low_gauss, enhanced, enhanced);
+            cv::threshold(enhanced, enhanced, 250, 255, cv::THRESH_TOZERO_INV);
+            cv::threshold(enhanced, enhanced, 1, 255, cv::THRESH_BINARY);
+        } break;
+
+        case ChannelType::GREEN_HIGH: {
+            // Enhance the green channel high intensities
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 200, 255, cv::THRESH_BINARY);
+
+            // Invert the mask
+            bitwise_not(enhanced, enhanced);
+        } break;
+
+        case ChannelType::GREEN_COMBINED: {
+            // Enhance the green channel (high and low combined)
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 25, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
+
+            // Invert the mask
+            bitwise_not(enhanced, enhanced);
+        } break;
+
+        case ChannelType::ENHANCE_AXON: {
+            // Create and enhance the axon boundary mask
+
+            cv::fastNlMeansDenoising(src_gray, src_gray, 3.0);
+            cv::threshold(src_gray, src_gray, 5, 255, cv::THRESH_BINARY);
+            CannyThreshold(src_gray, &enhanced);
+        } break;
+
+        case ChannelType::RED_LOW: {
+            // Enhance the red channel low intensities
+            cv::Mat red_low = src_gray;
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 80, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
+
+            // Enhance the low intensity features
+            cv::Mat red_low_gauss;
+            cv::GaussianBlur(red_low, red_low_gauss, cv::Size(3,3), 0, 0);
+            bitwise_and(red_low_gauss, enhanced, enhanced);
+            cv::threshold(enhanced, enhanced, 240, 255, cv::THRESH_TOZERO_INV);
+            cv::threshold(enhanced, enhanced, 50, 255, cv::THRESH_BINARY);
+        } break;
+
+        case ChannelType::RED_HIGH: {
+            // Enhance the red channel higher intensities
+
+            // Create the mask
+            cv::threshold(src_gray, src_gray, 80, 255, cv::THRESH_TOZERO);
+            bitwise_not(src_gray, src_gray);
+            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
+            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
+
+            // Invert the mask
+            bitwise_not(enhanced, enhanced);
+        } break;
+
+        default: {
+            std::cerr << "Invalid channel type" << std::endl;
+            return false;
+        }
+    }
+    *dst = enhanced;
+    return true;
+}
+
+/* Find the contours in the image */
+void contourCalc(cv::Mat src, ChannelType channel_type, 
+                    double min_area, cv::Mat *dst, 
+                    std::vector<std::vector<cv::Point>> *contours, 
+                    std::vector<cv::Vec4i> *hierarchy, 
+                    std::vector<HierarchyType> *validity_mask, 
+                    std::vector<double> *parent_area) {
+
+    cv::Mat temp_src;
+    src.copyTo(temp_src);
+    switch(channel_type) {
+        case ChannelType::BLUE: {
+            findContours(temp_src, *contours, *hierarchy, cv::RETR_EXTERNAL, 
+                                                        cv::CHAIN_APPROX_SIMPLE);
+        } break;
+
+        case ChannelType::RED_LOW : 
+        case ChannelType::RED_HIGH: 
+        case ChannelType::GREEN_LOW: 
+        case ChannelType::GREEN_HIGH: {
+            findContours(temp_src, *contours, *hierarchy, cv::RETR_CCOMP, 
+                                                        cv::CHAIN_APPROX_SIMPLE);
+        } break;
+
+        default: return;
+    }
+
+    *dst = cv::Mat::zeros(temp_src.size(), CV_8UC3);
+    if (!contours->size()) return;
+    validity_mask->assign(contours->size(), HierarchyType::INVALID_CNTR);
+    parent_area->assign(contours->size(), 0.0);
+
+    // Keep the contours whose size is >= than min_area
+    cv::RNG rng(12345);
+    for (int index = 0 ; index < (int)contours->size(); index++) {
+        if ((*hierarchy)[index][3] > -1) continue; // ignore child
+        auto cntr_external = (*contours)[index];
+        double area_external = fabs(contourArea(cv::Mat(cntr_external)));
+        if (area_external < min_area) continue;
+
+        std::vector<int> cntr_list;
+        cntr_list.push_back(index);
+
+        int index_hole = (*hierarchy)[index][2];
+        double area_hole = 0.0;
+        while (index_hole > -1) {
+            std::vector<cv::Point> cntr_hole = (*contours)[index_hole];
+            double temp_area_hole = fabs(contourArea(cv::Mat(cntr_hole)));
+            if (temp_area_hole) {
+                cntr_list.push_back(index_hole);
+                area_hole += temp_area_hole;
+            }
+            index_hole = (*hierarchy)[index_hole][0];
+        }
+        double area_contour = area_external - area_hole;
+        if (area_contour >= min_area) {
+            (*validity_mask)[cntr_list[0]] = HierarchyType::PARENT_CNTR;
+            (*parent_area)[cntr_list[0]] = area_contour;
+            for (unsigned int i = 1; i < cntr_list.size(); i++) {
+                (*validity_mask)[cntr_list[i]] = HierarchyType::CHILD_CNTR;
+            }
+            cv::Scalar color = cv::Scalar(rng.uniform(0, 255), rng.uniform(0,255), 
+                                            rng.uniform(0,255));
+            drawContours(*dst, *contours, index, color, cv::FILLED, cv::LINE_8, *hierarchy);
+        }
+    }
+}
+
+/* Classify Neurons and Astrocytes */
+void classifyNeuronsAndAstrocytes(std::vector<std::vector<cv::Point>> blue_contours,
+                                    std::vector<HierarchyType> blue_contour_mask,
+                                    cv::Mat blue_green_intersection,
+                                    std::vector<std::vector<cv::Point>> *astrocyte_contours,
+                                    std::vector<std::vector<cv::Point>> *neuron_contours) {
+
+    for (size_t i = 0; i < blue_contours.size(); i++) {
+
+        if (blue_contour_mask[i] != HierarchyType::PARENT_CNTR) continue;
+
+        // Eliminate small contours via contour arc calculation
+        if ((arcLength(blue_contours[i], true) >= 250) && (blue_contours[i].size() >= 5)) {
+
+            // Determine whether cell is a neuron by calculating blue-green coverage area
+            std::vector<std::vector<cv::Point>> specific_contour (1, blue_contours[i]);
+            cv::Mat drawing = cv::Mat::zeros(blue_green_intersection.size(), CV_8UC1);
+            drawContours(drawing, specific_contour, -1, cv::Scalar::all(255), cv::FILLED, 
+                            cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
+            int contour_count_before = countNonZero(drawing);
+            cv::Mat contour_intersection;
+            bitwise_and(drawing, blue_green_intersection, contour_intersection);
+            int contour_count_after = countNonZero(contour_intersection);
+            float coverage_ratio = ((float)contour_count_after)/contour_count_before;
+            if (coverage_ratio < 0.25) {
+                astrocyte_contours->push_back(blue_contours[i]);
+            } else {
+                // Calculate the aspect ratio of the blue contour,
+                // categorize as astrocytes if aspect ratio is very low.
+                cv::RotatedRect min_area_rect = minAreaRect(cv::Mat(blue_contours[i]));
+                float aspect_ratio = float(min_area_rect.size.width)/min_area_rect.size.height;
+                if (aspect_ratio > 1.0) {
+                    aspect_ratio = 1.0/aspect_ratio;
+                }
+                if (aspect_ratio <= 0.1) {
+                    astrocyte_contours->push_back(blue_contours[i]);
+                } else {
+                    neuron_contours->push_back(blue_contours[i]);
+                }
+            }
+        }
+    }
+}
+
+/* Astrocytes-neurons separation metrics */
+void neuronAstroSepMetrics(std::vector<std::vector<cv::Point>> astrocyte_contours, 
+                                std::vector<std::vector<cv::Point>> neuron_contours,
+                                float *mean_astrocyte_proximity_cnt,
+                                float *stddev_astrocyte_proximity_cnt) {
+
+    // Calculate the mid point of all astrocytes
+    std::vector<cv::Point2f> mc_astrocyte(astrocyte_contours.size());
+    for (size_t i = 0; i < astrocyte_contours.size(); i++) {
+        cv::Moments mu = moments(astrocyte_contours[i], true);
+        mc_astrocyte[i] = cv::Point2f(static_cast<float>(mu.m10/mu.m00), 
+                                            static_cast<float>(mu.m01/mu.m00));
+    }
+
+    // Calculate the mid point and diameter of all neurons
+    std::vector<cv::Point2f> mc_neuron(neuron_contours.size());
+    std::vector<float> neuron_diameter(neuron_contours.size());
+    for (size_t i = 0; i < neuron_contours.size(); i++) {
+        cv::Moments mu = moments(neuron_contours[i], true);
+        mc_neuron[i] = cv::Point2f(static_cast<float>(mu.m10/mu.m00), 
+                                            static_cast<float>(mu.m01/mu.m00));
+        cv::RotatedRect min_area_rect = minAreaRect(cv::Mat(neuron_contours[i]));
+        neuron_diameter[i] = (float) sqrt(pow(min_area_rect.size.width, 2) + 
+                                                pow(min_area_rect.size.height, 2));
+    }
+    cv::Scalar mean_diameter, stddev_diameter;
+    cv::meanStdDev(neuron_diameter, mean_diameter, stddev_diameter);
+
+    // Compute the normal distribution parameters of astrocyte count per neuron
+    float neuron_roi = (NEURON_ROI_FACTOR * mean_diameter.val[0])/2;
+    std::vector<float> count(neuron_contours.size(), 0.0);
+    for (size_t i = 0; i < neuron_contours.size(); i++) {
+        for (size_t j = 0; j < astrocyte_contours.size(); j++) {
+            if (cv::norm(mc_neuron[i] - mc_astrocyte[j]) <= neuron_roi) {
+                count[i]++;
+            }
+        }
+    }
+    cv::Scalar mean, stddev;
+    cv::meanStdDev(count, mean, stddev);
+    *mean_astrocyte_proximity_cnt = static_cast<float>(mean.val[0]);
+    *stddev_astrocyte_proximity_cnt = static_cast<float>(stddev.val[0]);
+}
+
+/* Group synapse area into bins */
+void binSynapseArea(std::vector<HierarchyType> contour_mask, 
+                    std::vector<double> contour_area, 
+                    AreaBins *contour_bins) {
+
+    std::vector<unsigned int> count(NUM_SYNAPSE_AREA_BINS, 0);
+    contour_bins->count = 0;
+    for (size_t i = 0; i < contour_mask.size(); i++) {
+        if (contour_mask[i] != HierarchyType::PARENT_CNTR) continue;
+        unsigned int area = static_cast<unsigned int>(round(contour_area[i]));
+        unsigned int bin_index = (area/SYNAPSE_BIN_AREA < NUM_SYNAPSE_AREA_BINS) ? 
+                                        area/SYNAPSE_BIN_AREA : NUM_SYNAPSE_AREA_BINS-1;
+        count[bin_index]++;
+    }
+
+    for (size_t i = 0; i < count.size(); i++) {
+        contour_bins->count += count[i];
+    }
+    contour_bins->bins = count;
+}
+
+/* Contours of one channel, as the original segmenter held them */
+struct ChannelContours {
+    std::vector<std::vector<cv::Point>> contours;
+    std::vector<cv::Vec4i> hierarchy;
+    std::vector<HierarchyType> mask;
+    std::vector<double> area;
+};
+
+} // namespace
+
+bool referenceAnalyzeWindow(const std::vector<cv::Mat> &planes,
+                                WindowMetrics *metrics, WindowImages *images) {
+
+    if (planes.size() != NUM_Z_LAYERS) {
+        std::cerr << "A reference window must hold " << NUM_Z_LAYERS << " z planes" 
+                    << std::endl;
+        return false;
+    }
+    for (auto& plane : planes) {
+        if ((plane.type() != CV_8UC3) || (plane.size() != planes[0].size())) {
+            std::cerr << "Reference planes must be 8-bit BGR images of the same size" 
+                        << std::endl;
+            return false;
+        }
+    }
+    std::vector<cv::Mat> blue(NUM_Z_LAYERS), green(NUM_Z_LAYERS), red(NUM_Z_LAYERS);
+    for (unsigned int z = 0; z < NUM_Z_LAYERS; z++) {
+        std::vector<cv::Mat> channel(3);
+        cv::split(planes[z], channel);
+        blue[z] = channel[0];
+        green[z] = channel[1];
+        red[z] = channel[2];
+    }
+    std::string window_layers = std::to_string(NUM_Z_LAYERS) + "layers";
+    auto debugImage = [&](std::string name, cv::Mat image) {
+        images->debug.push_back(std::make_pair(name, image.clone()));
+    };
+    images->debug.clear();
+
+    // Blue channel
+    cv::Mat blue_merge, blue_enhanced, blue_segmented;
+    ChannelContours blue_contours;
+    cv::merge(blue, blue_merge);
+    debugImage("blue_" + window_layers, blue_merge);
+    if (!enhanceImage(blue_merge, ChannelType::BLUE, &blue_enhanced)) return false;
+    debugImage("blue_" + window_layers + "_enhanced", blue_enhanced);
+    contourCalc(blue_enhanced, ChannelType::BLUE, 100.0, &blue_segmented, 
+                    &blue_contours.contours, &blue_contours.hierarchy, &blue_contours.mask, 
+                    &blue_contours.area);
+    debugImage("blue_" + window_layers + "_enhanced_segmented", blue_segmented);
+
+    // Green channel
+    cv::Mat green_merge, green_enhanced;
+    cv::merge(green, green_merge);
+    debugImage("green_" + window_layers, green_merge);
+    if (!enhanceImage(green_merge, ChannelType::GREEN_COMBINED, &green_enhanced)) return false;
+    debugImage("green_" + window_layers + "_enhanced", green_enhanced);
+
+    // Axon boundary mask
+    cv::Mat axon_enhanced;
+    if (!enhanceImage(green_merge, ChannelType::ENHANCE_AXON, &axon_enhanced)) return false;
+    debugImage("axon_" + window_layers, axon_enhanced);
+
+    // Green, red low and high intensity channels
+    cv::Mat red_merge;
+    cv::merge(red, red_merge);
+    debugImage("red_" + window_layers, red_merge);
+    auto channelContours = [&](std::string name, cv::Mat merge, ChannelType type, 
+                                cv::Mat *enhanced, ChannelContours *contours) {
+        cv::Mat segmented;
+        if (!enhanceImage(merge, type, enhanced)) return false;
+        debugImage(name + "_" + window_layers + "_enhanced", *enhanced);
+        contourCalc(*enhanced, type, 1.0, &segmented, &contours->contours, 
+                        &contours->hierarchy, &contours->mask, &contours->area);
+        debugImage(name + "_" + window_layers + "_enhanced_segmented", segmented);
+        return true;
+    };
+    cv::Mat green_low_enhanced, green_high_enhanced, red_low_enhanced, red_high_enhanced;
+    ChannelContours green_low_contours, green_high_contours;
+    ChannelContours red_low_contours, red_high_contours;
+    if (!channelContours("green_low", green_merge, ChannelType::GREEN_LOW, 
+                            &green_low_enhanced, &green_low_contours) || 
+            !channelContours("green_high", green_merge, ChannelType::GREEN_HIGH, 
+                            &green_high_enhanced, &green_high_contours) || 
+            !channelContours("red_low", red_merge, ChannelType::RED_LOW, 
+                            &red_low_enhanced, &red_low_contours) || 
+            !channelContours("red_high", red_merge, ChannelType::RED_HIGH, 
+                            &red_high_enhanced, &red_high_contours)) {
+        return false;
+    }
+
+    // Draw the red high-low regions after categorization
+    cv::Mat drawing_red = cv::Mat::zeros(red_low_enhanced.size(), CV_8UC1);
+    for (size_t i = 0; i < red_high_contours.contours.size(); i++) {
+        drawContours(drawing_red, red_high_contours.contours, (int)i, 255, 
+                        cv::FILLED, cv::LINE_8, red_high_contours.hierarchy);
+    }
+    for (size_t i = 0; i < red_low_contours.contours.size(); i++) {
+        drawContours(drawing_red, red_low_contours.contours, (int)i, 100, 
+                        cv::FILLED, cv::LINE_8, red_low_contours.hierarchy);
+    }
+    debugImage(window_layers + "_red", drawing_red);
+
+    // Blue-green channel intersection
+    cv::Mat blue_green_intersection;
+    bitwise_and(blue_enhanced, green_enhanced, blue_green_intersection);
+    debugImage("green_" + window_layers + "_enhanced_blue_intersection", 
+                                                        blue_green_intersection);
+
+    // Classify astrocytes and neurons
+    std::vector<std::vector<cv::Point>> astrocyte_contours, neuron_contours;
+    classifyNeuronsAndAstrocytes(blue_contours.contours, blue_contours.mask, 
+                                    blue_green_intersection, 
+                                    &astrocyte_contours, &neuron_contours);
+    metrics->astrocyte_count = (unsigned int)astrocyte_contours.size();
+    metrics->neuron_count = (unsigned int)neuron_contours.size();
+
+    // Draw the categorized cells
+    cv::Mat drawing_blue = cv::Mat::zeros(blue_enhanced.size(), CV_8UC1);
+    for (size_t i = 0; i < neuron_contours.size(); i++) {
+        drawContours(drawing_blue, neuron_contours, (int)i, 255, cv::FILLED, 
+                        cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
+    }
+    for (size_t i = 0; i < astrocyte_contours.size(); i++) {
+        drawContours(drawing_blue, astrocyte_contours, (int)i, 100, cv::FILLED, 
+                        cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
+    }
+    debugImage(window_layers + "_cells", drawing_blue);
+
+    // Calculate metrics for astrocytes-neurons separation
+    neuronAstroSepMetrics(astrocyte_contours, neuron_contours, 
+                            &metrics->mean_astrocyte_proximity, 
+                            &metrics->stddev_astrocyte_proximity);
+
+    // Classify synapses
+    binSynapseArea(red_low_contours.mask, red_low_contours.area, &metrics->red_low);
+    binSynapseArea(red_high_contours.mask, red_high_contours.area, &metrics->red_high);
+
+    // Green-red common regions, from the contours of the intersections
+    cv::Mat drawing_green_red = cv::Mat::zeros(green_enhanced.size(), CV_8UC1);
+    auto commonRegions = [&](std::string name, cv::Mat red_enhanced, ChannelType type, 
+                                int color, AreaBins *bins) {
+        cv::Mat intersection, segmented;
+        ChannelContours contours;
+        bitwise_and(green_enhanced, red_enhanced, intersection);
+        debugImage("green_" + window_layers + "_enhanced_" + name + "_intersection", 
+                                                                    intersection);
+        contourCalc(intersection, type, 1.0, &segmented, &contours.contours, 
+                        &contours.hierarchy, &contours.mask, &contours.area);
+        binSynapseArea(contours.mask, contours.area, bins);
+        for (size_t i = 0; i < contours.contours.size(); i++) {
+            drawContours(drawing_green_red, contours.contours, (int)i, color, 
+                            cv::FILLED, cv::LINE_8, contours.hierarchy);
+        }
+    };
+    commonRegions("red_high", red_high_enhanced, ChannelType::RED_HIGH, 255, 
+                        &metrics->green_red_high);
+    commonRegions("red_low", red_low_enhanced, ChannelType::RED_LOW, 100, 
+                        &metrics->green_red_low);
+    debugImage(window_layers + "_green_red", drawing_green_red);
+
+    // Calculate the metrics for green regions
+    binSynapseArea(green_high_contours.mask, green_high_contours.area, &metrics->green_high);
+    binSynapseArea(green_low_contours.mask, green_low_contours.area, &metrics->green_low);
+
+    cv::Mat drawing_green = cv::Mat::zeros(green_high_enhanced.size(), CV_8UC1);
+    for (size_t i = 0; i < green_high_contours.contours.size(); i++) {
+        drawContours(drawing_green, green_high_contours.contours, (int)i, 255, 
+                            cv::FILLED, cv::LINE_8, green_high_contours.hierarchy);
+    }
+    for (size_t i = 0; i < green_low_contours.contours.size(); i++) {
+        drawContours(drawing_green, green_low_contours.contours, (int)i, 255, 
+                            cv::FILLED, cv::LINE_8, green_low_contours.hierarchy);
+    }
+
+    /** Analyzed image - blue, green-red intersection (high and low) and red (high and low) **/
+
+    // Draw neuron boundaries
+    for (size_t i = 0; i < neuron_contours.size(); i++) {
+        cv::RotatedRect min_ellipse = fitEllipse(cv::Mat(neuron_contours[i]));
+        ellipse(drawing_blue, min_ellipse, 0, 4, 8);
+        ellipse(drawing_green, min_ellipse, 0, 4, 8);
+        ellipse(drawing_red, min_ellipse, 255, 4, 8);
+    }
+
+    // Draw astrocyte boundaries
+    for (size_t i = 0; i < astrocyte_contours.size(); i++) {
+        cv::RotatedRect min_ellipse = fitEllipse(cv::Mat(astrocyte_contours[i]));
+        ellipse(drawing_blue, min_ellipse, 0, 4, 8);
+        ellipse(drawing_green, min_ellipse, 255, 4, 8);
+        ellipse(drawing_red, min_ellipse, 0, 4, 8);
+    }
+
+    // Draw upper layer axon boundaries
+    for (size_t i = 0; i < green_high_contours.contours.size(); i++) {
+        drawContours(drawing_blue, green_high_contours.contours, (int)i, 255, 
+                            2, cv::LINE_8, green_high_contours.hierarchy);
+        drawContours(drawing_green, green_high_contours.contours, (int)i, 0, 
+                            2, cv::LINE_8, green_high_contours.hierarchy);
+        drawContours(drawing_red, green_high_contours.contours, (int)i, 128, 
+                            2, cv::LINE_8, green_high_contours.hierarchy);
+    }
+
+    // Merge the modified red, blue and green layers
+    std::vector<cv::Mat> merge_analysis = {drawing_blue, drawing_green, drawing_red};
+    cv::merge(merge_analysis, images->processed);
+
+    // Original image - blue, green and red
+    cv::Mat color_original = planes[0].clone();
+    for (unsigned int i = 1; i < NUM_Z_LAYERS; i++) {
+        double beta = 1.0/(i+1);
+        addWeighted(color_original, 1.0 - beta, planes[i], beta, 0.0, color_original);
+    }
+    images->original = color_original;
+    return true;
+}
@@ -0,0 +1,24 @@
+#ifndef REFERENCE_PIPELINE_HPP
+#define REFERENCE_PIPELINE_HPP
+
+/* Reference pipeline
+   The window analysis of the original single file segmenter, frozen as it
+   was before the segmentation library was split out. It shares no code
+   with libneuronseg, so the equivalence check catches a change of any
+   engine (contours, shape descriptors, overlay, bit masks, overlap join)
+   instead of comparing the library with itself. It analyzes 8-bit, full
+   resolution windows of NUM_Z_LAYERS planes with the default parameters.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "NeuronSeg.hpp"
+
+/* Analyze NUM_Z_LAYERS 8-bit BGR planes given in ring buffer order. The
+   metrics, the processed image and the intermediate masks are filled under
+   the names the library gives them. */
+bool referenceAnalyzeWindow(const std::vector<cv::Mat> &planes,
+                                WindowMetrics *metrics, WindowImages *images);
+
+#endif
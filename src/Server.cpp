@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <condition_variable>
+#include <ctype.h>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <unistd.h>
+
+#include "Server.hpp"
+
+/* Value of a flat JSON object member */
+struct JsonValue {
+    std::string text;
+    std::vector<std::string> items;
+    bool is_array = false;
+};
+
+static void skipSpace(const std::string &s, size_t *pos) {
+    while ((*pos < s.size()) && isspace((unsigned char)s[*pos])) (*pos)++;
+}
+
+static bool parseString(const std::string &s, size_t *pos, std::string *value) {
+    if ((*pos >= s.size()) || (s[*pos] != '"')) return false;
+    (*pos)++;
+    value->clear();
+    while (*pos < s.size()) {
+        char c = s[(*pos)++];
+        if (c == '"') return true;
+        if (c == '\\') {
+            if (*pos >= s.size()) return false;
+            char e = s[(*pos)++];
+            switch(e) {
+                case 'n': value->push_back('\n'); break;
+                case 't': value->push_back('\t'); break;
+                case 'r': value->push_back('\r'); break;
+                case 'b': value->push_back('\b'); break;
+                case 'f': value->push_back('\f'); break;
+                default: value->push_back(e); break;
+            }
+        } else {
+            value->push_back(c);
+        }
+    }
+    return false;
+}
+
+static bool parseScalar(const std::string &s, size_t *pos, std::string *value) {
+    skipSpace(s, pos);
+    if ((*pos < s.size()) && (s[*pos] == '"')) return parseString(s, pos, value);
+    size_t begin = *pos;
+    while ((*pos < s.size()) && (s[*pos] != ',') && (s[*pos] != '}') && 
+                (s[*pos] != ']') && !isspace((unsigned char)s[*pos])) {
+        (*pos)++;
+    }
+    *value = s.substr(begin, *pos - begin);
+    return !value->empty();
+}
+
+/* Parse a flat JSON object of scalars and arrays of scalars */
+static bool parseJsonObject(const std::string &s, std::map<std::string, JsonValue> *object) {
+    size_t pos = 0;
+    skipSpace(s, &pos);
+    if ((pos >= s.size()) || (s[pos++] != '{')) return false;
+    skipSpace(s, &pos);
+    if ((pos < s.size()) && (s[pos] == '}')) return true;
+    while (pos < s.size()) {
+        std::string key;
+        skipSpace(s, &pos);
+        if (!parseString(s, &pos, &key)) return false;
+        skipSpace(s, &pos);
+        if ((pos >= s.size()) || (s[pos++] != ':')) return false;
+        skipSpace(s, &pos);
+        JsonValue value;
+        if ((pos < s.size()) && (s[pos] == '[')) {
+            pos++;
+            value.is_array = true;
+            skipSpace(s, &pos);
+            while ((pos < s.size()) && (s[pos] != ']')) {
+                std::string item;
+                if (!parseScalar(s, &pos, &item)) return false;
+                value.items.push_back(item);
+                skipSpace(s, &pos);
+                if ((pos < s.size()) && (s[pos] == ',')) pos++;
+                skipSpace(s, &pos);
+            }
+            if (pos >= s.size()) return false;
+            pos++;
+        } else if (!parseScalar(s, &pos, &value.text)) {
+            return false;
+        }
+        (*object)[key] = value;
+        skipSpace(s, &pos);
+        if (pos >= s.size()) return false;
+        char c = s[pos++];
+        if (c == '}') return true;
+        if (c != ',') return false;
+    }
+    return false;
+}
+
+static std::string jsonEscape(const std::string &s) {
+    std::string escaped;
+    for (auto c : s) {
+        switch(c) {
+            case '"':  escaped += "\\\""; break;
+            case '\\': escaped += "\\\\"; break;
+            case '\n': escaped += "\\n"; break;
+            case '\t': escaped += "\\t"; break;
+            case '\r': escaped += "\\r"; break;
+            default: {
+                if ((unsigned char)c < 0x20) {
+                    char code[8];
+                    snprintf(code, sizeof(code), "\\u%04x", c);
+                    escaped += code;
+                } else {
+                    escaped.push_back(c);
+                }
+            }
+        }
+    }
+    return escaped;
+}
+
+Server::Server(unsigned int workers, JobStart start_job, DirProcessor process_dir, 
+                ThreadPool::WorkerStart worker_start) : 
+    pool_(workers, worker_start), start_job_(start_job), process_dir_(process_dir), 
+    job_seq_(0), shutdown_(false) {}
+
+bool Server::handleLine(std::string line, Reply reply) {
+
+    if (line.find_first_not_of(" \t\r") == std::string::npos) return true;
+
+    std::map<std::string, JsonValue> object;
+    if (!parseJsonObject(line, &object)) {
+        reply("{\"status\":\"error\",\"message\":\"invalid json\"}");
+        return true;
+    }
+    if (object.count("command")) {
+        if (object["command"].text == "shutdown") {
+            shutdown_ = true;
+            reply("{\"status\":\"shutdown\"}");
+            return false;
+        }
+        reply("{\"status\":\"error\",\"message\":\"unknown command '" + 
+                    jsonEscape(object["command"].text) + "'\"}");
+        return true;
+    }
+    if (shutdown_) {
+        reply("{\"status\":\"error\",\"message\":\"shutting down\"}");
+        return true;
+    }
+
+    ServerJob job;
+    job.id = object.count("id") ? object["id"].text : "job" + std::to_string(++job_seq_);
+    job.path = object["path"].text;
+    job.list_file = object["list"].text;
+    job.dirs = object["dirs"].items;
+    job.out_file = object["output"].text;
+    job.err_file = object["errors"].text;
+    job.priority = object.count("priority") ? atoi(object["priority"].text.c_str()) : 0;
+    submitJob(job, reply);
+    return true;
+}
+
+void Server::submitJob(ServerJob job, Reply reply) {
+
+    std::string error;
+    if (!start_job_(&job, &error)) {
+        reply("{\"job\":\"" + jsonEscape(job.id) + "\",\"status\":\"error\",\"message\":\"" + 
+                    jsonEscape(error) + "\"}");
+        return;
+    }
+    reply("{\"job\":\"" + jsonEscape(job.id) + "\",\"status\":\"accepted\",\"dirs\":" + 
+                std::to_string(job.dirs.size()) + "}");
+    if (job.dirs.empty()) {
+        reply("{\"job\":\"" + jsonEscape(job.id) + "\",\"status\":\"done\",\"failed\":0}");
+        return;
+    }
+
+    // Directories of a job are processed concurrently, the last one reports the job
+    struct JobState {
+        ServerJob job;
+        std::atomic<unsigned int> remaining;
+        std::atomic<unsigned int> failed;
+        std::mutex err_mutex;
+    };
+    std::shared_ptr<JobState> state(new JobState());
+    state->job = job;
+    state->remaining = (unsigned int)job.dirs.size();
+    state->failed = 0;
+
+    for (auto& dir : job.dirs) {
+        pool_.submit([this, state, dir, reply]() {
+            // A failing directory must not take the server down
+            bool ok = false;
+            try {
+                ok = process_dir_(state->job, dir);
+            } catch (std::exception &e) {
+                std::cerr << "Job '" << state->job.id << "' failed on '" << dir 
+                          << "': " << e.what() << std::endl;
+            }
+            if (!ok) {
+                state->failed++;
+                if (!state->job.err_file.empty()) {
+                    std::lock_guard<std::mutex> lock(state->err_mutex);
+                    std::ofstream err_stream(state->job.err_file, std::ios::app);
+                    err_stream << dir << std::endl;
+                }
+            }
+            reply("{\"job\":\"" + jsonEscape(state->job.id) + "\",\"dir\":\"" + 
+                        jsonEscape(dir) + "\",\"status\":\"" + (ok ? "ok" : "error") + "\"}");
+            if (--state->remaining == 0) {
+                reply("{\"job\":\"" + jsonEscape(state->job.id) + 
+                            "\",\"status\":\"done\",\"failed\":" + 
+                            std::to_string(state->failed.load()) + "}");
+            }
+        }, job.priority);
+    }
+}
+
+int Server::serveStream(std::istream &in, std::ostream &out) {
+
+    std::shared_ptr<std::mutex> out_mutex(new std::mutex());
+    Reply reply = [&out, out_mutex](std::string message) {
+        std::lock_guard<std::mutex> lock(*out_mutex);
+        out << message << std::endl;
+    };
+
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!handleLine(line, reply)) break;
+    }
+    pool_.wait();
+    return 0;
+}
+
+int Server::serveSocket(std::string socket_path) {
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        std::cerr << "Could not create the server socket." << std::endl;
+        return -1;
+    }
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path)) {
+        std::cerr << "Server socket path is too long." << std::endl;
+        close(listen_fd);
+        return -1;
+    }
+    strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+    unlink(socket_path.c_str());
+    if ((bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) || 
+                                                (listen(listen_fd, 16) < 0)) {
+        std::cerr << "Could not listen on '" << socket_path << "'." << std::endl;
+        close(listen_fd);
+        return -1;
+    }
+
+    // Replies are serialized per connection. The replies of the queued jobs 
+    // hold their connection, so its socket is closed once the client has 
+    // hung up and the last of its jobs has replied.
+    struct Connection {
+        int fd;
+        std::mutex mutex;
+        ~Connection() { close(fd); }
+    };
+
+    // One detached reader thread per client, counted so that the teardown 
+    // can wait for them
+    struct Readers {
+        std::mutex mutex;
+        std::condition_variable done_cv;
+        unsigned int active = 0;
+        std::vector<std::weak_ptr<Connection>> connections;
+    };
+    std::shared_ptr<Readers> readers(new Readers());
+
+    while (!shutdown_) {
+        int client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) break;
+
+        std::shared_ptr<Connection> connection(new Connection());
+        connection->fd = client_fd;
+        {
+            std::lock_guard<std::mutex> lock(readers->mutex);
+            auto closed = std::remove_if(readers->connections.begin(), 
+                                            readers->connections.end(), 
+                                            [](const std::weak_ptr<Connection> &c) { 
+                                                return c.expired(); });
+            readers->connections.erase(closed, readers->connections.end());
+            readers->connections.push_back(connection);
+            readers->active++;
+        }
+        std::thread([this, connection, readers, listen_fd]() {
+            Reply reply = [connection](std::string message) {
+                std::lock_guard<std::mutex> lock(connection->mutex);
+                message.push_back('\n');
+                send(connection->fd, message.c_str(), message.size(), MSG_NOSIGNAL);
+            };
+            std::string pending;
+            char buffer[4096];
+            ssize_t len = 0;
+            bool serving = true;
+            while (serving && ((len = recv(connection->fd, buffer, sizeof(buffer), 0)) > 0)) {
+                pending.append(buffer, len);
+                size_t newline = 0;
+                while (serving && ((newline = pending.find('\n')) != std::string::npos)) {
+                    std::string line = pending.substr(0, newline);
+                    pending.erase(0, newline + 1);
+                    if (!handleLine(line, reply)) {
+                        // Wake up the accept loop so that it sees the shutdown
+                        ::shutdown(listen_fd, SHUT_RDWR);
+                        serving = false;
+                    }
+                }
+            }
+            std::lock_guard<std::mutex> lock(readers->mutex);
+            readers->active--;
+            readers->done_cv.notify_all();
+        }).detach();
+    }
+
+    // Drain the queued jobs, then disconnect the clients and wait for their readers
+    shutdown_ = true;
+    pool_.wait();
+    {
+        std::unique_lock<std::mutex> lock(readers->mutex);
+        for (auto& weak_connection : readers->connections) {
+            std::shared_ptr<Connection> connection = weak_connection.lock();
+            if (connection) ::shutdown(connection->fd, SHUT_RDWR);
+        }
+        readers->done_cv.wait(lock, [&readers] { return !readers->active; });
+    }
+    close(listen_fd);
+    unlink(socket_path.c_str());
+    return 0;
+}
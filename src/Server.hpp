@@ -0,0 +1,70 @@
+#ifndef SERVER_HPP
+#define SERVER_HPP
+
+/* Segmentation server
+   Long running mode that keeps the worker pool warm across jobs. The
+   threads persist and the directories are processed as in batch mode. Jobs
+   are newline delimited JSON objects, read from stdin or from a local Unix
+   socket:
+
+     {"id": "plate7", "path": "data/", "list": "plate7.txt", 
+      "output": "plate7.csv", "errors": "plate7.err", "priority": 1}
+
+   "dirs": ["dir_a", "dir_b"] may be given instead of "list". A JSON line is 
+   streamed back as each directory finishes and when the whole job is done. 
+   {"command": "shutdown"} drains the queued jobs and stops the server.
+   The socket of a client is closed once it has hung up and its last job
+   has replied.
+ */
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "ThreadPool.hpp"
+
+struct ServerJob {
+    std::string id;
+    std::string path;
+    std::string list_file;
+    std::vector<std::string> dirs;
+    std::string out_file;
+    std::string err_file;
+    int priority = 0;
+};
+
+class Server {
+
+public:
+    /* Prepare a job (resolve the directories, create the output files) */
+    typedef std::function<bool(ServerJob *job, std::string *error)> JobStart;
+
+    /* Process one directory of a job */
+    typedef std::function<bool(const ServerJob &job, std::string dir)> DirProcessor;
+
+    Server(unsigned int workers, JobStart start_job, DirProcessor process_dir, 
+            ThreadPool::WorkerStart worker_start = ThreadPool::WorkerStart());
+
+    /* Serve the jobs read from a stream until end of input */
+    int serveStream(std::istream &in, std::ostream &out);
+
+    /* Serve the jobs of every client of a Unix socket until shutdown */
+    int serveSocket(std::string socket_path);
+
+private:
+    typedef std::function<void(std::string)> Reply;
+
+    bool handleLine(std::string line, Reply reply);
+
+    void submitJob(ServerJob job, Reply reply);
+
+    ThreadPool pool_;
+    JobStart start_job_;
+    DirProcessor process_dir_;
+    std::atomic<unsigned int> job_seq_;
+    std::atomic<bool> shutdown_;
+};
+
+#endif
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <math.h>
+#include "ShapeDescriptors.hpp"
+
+ShapeDescriptor shapeDescriptor(ContourView contour) {
+
+    ShapeDescriptor shape;
+    size_t n = contour.count;
+    if (!n) return shape;
+
+    // Moments up to second order and the perimeter via Green's theorem
+    double a00 = 0.0, a10 = 0.0, a01 = 0.0, a20 = 0.0, a11 = 0.0, a02 = 0.0;
+    double sum_x = 0.0, sum_y = 0.0, perimeter = 0.0;
+    double xi_1 = contour.points[n-1].x, yi_1 = contour.points[n-1].y;
+    for (size_t i = 0; i < n; i++) {
+        double xi = contour.points[i].x, yi = contour.points[i].y;
+        double dxy = xi_1*yi - xi*yi_1;
+        double xii_1 = xi_1 + xi, yii_1 = yi_1 + yi;
+        a00 += dxy;
+        a10 += dxy*xii_1;
+        a01 += dxy*yii_1;
+        a20 += dxy*(xi_1*xii_1 + xi*xi);
+        a11 += dxy*(xi_1*(yii_1 + yi_1) + xi*(yii_1 + yi));
+        a02 += dxy*(yi_1*yii_1 + yi*yi);
+        perimeter += sqrt((xi - xi_1)*(xi - xi_1) + (yi - yi_1)*(yi - yi_1));
+        sum_x += xi;
+        sum_y += yi;
+        xi_1 = xi;
+        yi_1 = yi;
+    }
+    shape.perimeter = (n > 1) ? perimeter : 0.0;
+
+    double sign = (a00 < 0.0) ? -1.0 : 1.0;
+    double m00 = sign*a00/2.0, m10 = sign*a10/6.0, m01 = sign*a01/6.0;
+    double m20 = sign*a20/12.0, m11 = sign*a11/24.0, m02 = sign*a02/12.0;
+    shape.area = m00;
+    if (m00 > 0.0) {
+        double cx = m10/m00, cy = m01/m00;
+        shape.centroid = cv::Point2f((float)cx, (float)cy);
+        shape.mu20 = m20 - m10*cx;
+        shape.mu11 = m11 - m10*cy;
+        shape.mu02 = m02 - m01*cy;
+
+        // Equivalent ellipse from the eigen decomposition of the covariance
+        double a = shape.mu20/m00, b = shape.mu11/m00, c = shape.mu02/m00;
+        double root = sqrt((a - c)*(a - c)/4.0 + b*b);
+        double lambda_major = std::max(0.0, (a + c)/2.0 + root);
+        double lambda_minor = std::max(0.0, (a + c)/2.0 - root);
+        double angle = 0.5*atan2(2.0*b, a - c)*180.0/CV_PI;
+        shape.ellipse = cv::RotatedRect(shape.centroid, 
+                                        cv::Size2f((float)(4.0*sqrt(lambda_major)), 
+                                                    (float)(4.0*sqrt(lambda_minor))), 
+                                        (float)angle);
+    } else {
+        // Degenerate contour, fall back to the mean of the points
+        shape.centroid = cv::Point2f((float)(sum_x/n), (float)(sum_y/n));
+        shape.ellipse = cv::RotatedRect(shape.centroid, cv::Size2f(0.0f, 0.0f), 0.0f);
+    }
+
+    // Oriented aspect ratio and diameter
+    shape.min_area_rect = cv::minAreaRect(contour.mat());
+    float width = shape.min_area_rect.size.width, height = shape.min_area_rect.size.height;
+    shape.aspect_ratio = (height > 0.0f) ? width/height : 0.0f;
+    if (shape.aspect_ratio > 1.0) {
+        shape.aspect_ratio = 1.0/shape.aspect_ratio;
+    }
+    shape.diameter = (float) sqrt(width*width + height*height);
+    return shape;
+}
+
+void computeShapeDescriptors(const ContourStore &contours, 
+                                const std::vector<int> &selected, 
+                                std::vector<ShapeDescriptor> *descriptors) {
+
+    descriptors->assign(contours.size(), ShapeDescriptor());
+    for (auto index : selected) {
+        (*descriptors)[index] = shapeDescriptor(contours.contour(index));
+    }
+}
@@ -0,0 +1,34 @@
+#ifndef SHAPE_DESCRIPTORS_HPP
+#define SHAPE_DESCRIPTORS_HPP
+
+/* Shape descriptors calculation
+   Area, centroid, second moments, equivalent ellipse, oriented aspect ratio 
+   and perimeter of each object, computed once and shared by every consumer.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ContourStore.hpp"
+
+struct ShapeDescriptor {
+    double area = 0.0;              // Polygon area (m00)
+    cv::Point2f centroid;           // Mass center (m10/m00, m01/m00)
+    double mu20 = 0.0, mu11 = 0.0, mu02 = 0.0; // Central second moments
+    cv::RotatedRect ellipse;        // Ellipse with the same second moments
+    cv::RotatedRect min_area_rect;  // Oriented bounding rectangle
+    float aspect_ratio = 0.0;       // Short over long side of min_area_rect
+    float diameter = 0.0;           // Diagonal of min_area_rect
+    double perimeter = 0.0;         // Closed contour arc length
+};
+
+/* Compute the descriptors of the selected contours in a single pass over 
+   their points. descriptors is indexed like contours. */
+void computeShapeDescriptors(const ContourStore &contours, 
+                                const std::vector<int> &selected, 
+                                std::vector<ShapeDescriptor> *descriptors);
+
+/* Compute the descriptors of one contour */
+ShapeDescriptor shapeDescriptor(ContourView contour);
+
+#endif
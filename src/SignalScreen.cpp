@@ -0,0 +1,68 @@
+#include <algorithm>
+
+#include "SignalScreen.hpp"
+
+LayerSignal screenLayer(const cv::Mat &plane, unsigned int bit_depth) {
+
+    LayerSignal layer;
+    if (plane.empty()) return layer;
+    CV_Assert((plane.channels() == 3) &&
+                ((plane.depth() == CV_8U) || (plane.depth() == CV_16U)));
+    float range = (plane.depth() == CV_8U) ? 256.0f : (float)(1 << bit_depth);
+
+    // Reduced plane on the 8-bit scale for the focus
+    cv::Mat reduced = plane;
+    if ((plane.cols >= 2*SCREEN_FOCUS_DOWNSAMPLE) && (plane.rows >= 2*SCREEN_FOCUS_DOWNSAMPLE)) {
+        cv::resize(plane, reduced, cv::Size(plane.cols/SCREEN_FOCUS_DOWNSAMPLE,
+                            plane.rows/SCREEN_FOCUS_DOWNSAMPLE), 0, 0, cv::INTER_AREA);
+    }
+    reduced.convertTo(reduced, CV_32F, 256.0/range);
+    std::vector<cv::Mat> reduced_channels;
+    cv::split(reduced, reduced_channels);
+
+    int bins = SCREEN_HISTOGRAM_BINS;
+    float hist_range[] = {0.0f, range};
+    const float *ranges[] = {hist_range};
+    double total = (double)plane.total();
+    for (int c = 0; c < 3; c++) {
+
+        // Median and bright end of the channel histogram
+        cv::Mat hist;
+        cv::calcHist(&plane, 1, &c, cv::Mat(), hist, 1, &bins, ranges);
+        double seen = 0.0;
+        int median = -1, high = -1;
+        for (int i = 0; (i < bins) && (high < 0); i++) {
+            seen += hist.at<float>(i);
+            if ((median < 0) && (seen >= 0.5*total)) median = i;
+            if (seen >= SCREEN_SIGNAL_PERCENTILE*total) high = i;
+        }
+        if (high < 0) high = bins - 1;
+        layer.signal[c] = (float)(high - std::max(median, 0))/bins;
+
+        // Variance of the Laplacian
+        cv::Mat laplacian;
+        cv::Laplacian(reduced_channels[c], laplacian, CV_32F);
+        cv::Scalar mean, stddev;
+        cv::meanStdDev(laplacian, mean, stddev);
+        layer.focus[c] = (float)(stddev[0]*stddev[0]);
+    }
+    return layer;
+}
+
+WindowSignal screenWindow(const std::vector<LayerSignal> &layers,
+                                        const ScreenThresholds &thresholds) {
+
+    WindowSignal window;
+    window.skipped = true;
+    for (auto& layer : layers) {
+        for (int c = 0; c < 3; c++) {
+            window.signal = std::max(window.signal, layer.signal[c]);
+            window.focus = std::max(window.focus, layer.focus[c]);
+            if ((layer.signal[c] >= thresholds.min_signal) &&
+                                (layer.focus[c] >= thresholds.min_focus)) {
+                window.skipped = false;
+            }
+        }
+    }
+    return window;
+}
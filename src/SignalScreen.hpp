@@ -0,0 +1,50 @@
+#ifndef SIGNAL_SCREEN_HPP
+#define SIGNAL_SCREEN_HPP
+
+/* Signal screening
+   Cheap statistics of a plane, computed as it is read, that tell blank and
+   out of focus planes apart before a window is analyzed. The signal of a
+   channel is the distance from its median to its SCREEN_SIGNAL_PERCENTILE
+   sample, read from the channel histogram, as a fraction of the sample
+   range. The focus is the variance of the Laplacian of the channel at
+   1/SCREEN_FOCUS_DOWNSAMPLE of the plane resolution, on the 8-bit sample
+   scale, so that the sensor noise of a blank plane does not pass for
+   detail. A window is skipped when no plane of any of its channels reaches
+   both thresholds.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define SCREEN_HISTOGRAM_BINS       256     // Histogram bins of a channel
+#define SCREEN_SIGNAL_PERCENTILE    0.995   // Bright end of the channel signal
+#define SCREEN_FOCUS_DOWNSAMPLE     2       // Focus is measured at this reduction
+#define SCREEN_MIN_SIGNAL           0.05    // Default signal threshold
+
+/* Signal and focus of the blue, green and red channels of a plane */
+struct LayerSignal {
+    float signal[3] = {0.0, 0.0, 0.0}; // Fraction of the sample range
+    float focus[3] = {0.0, 0.0, 0.0}; // Laplacian variance on the 8-bit scale
+};
+
+/* Smallest signal and focus of an analyzed channel plane */
+struct ScreenThresholds {
+    float min_signal = SCREEN_MIN_SIGNAL;
+    float min_focus = 0.0;
+};
+
+/* Screening result of a window */
+struct WindowSignal {
+    float signal = 0.0; // Highest channel signal of its planes
+    float focus = 0.0; // Highest channel focus of its planes
+    bool skipped = false; // No channel plane reached both thresholds
+};
+
+/* Statistics of an 8 or 16-bit BGR plane */
+LayerSignal screenLayer(const cv::Mat &plane, unsigned int bit_depth);
+
+/* Screen the planes of a window */
+WindowSignal screenWindow(const std::vector<LayerSignal> &layers,
+                                        const ScreenThresholds &thresholds);
+
+#endif
@@ -0,0 +1,154 @@
+#include <algorithm>
+#include <iostream>
+
+#include "StackLabeler.hpp"
+
+StackLabeler::StackLabeler(std::string channel, int connectivity,
+                                unsigned int num_bins, double voxel_scale) :
+    channel_(channel),
+    connectivity_((connectivity == 6) ? 6 : 26),
+    num_bins_(std::max(1u, num_bins)),
+    voxel_scale_(voxel_scale) {
+
+    bins_.volume_bins.assign(num_bins_, 0);
+    bins_.z_extent_bins.assign(num_bins_, 0);
+}
+
+const std::string& StackLabeler::channel() const {
+    return channel_;
+}
+
+int StackLabeler::find(int id) {
+    int root = id;
+    while (parent_[root] != root) {
+        root = parent_[root];
+    }
+    while (parent_[id] != root) {
+        int next = parent_[id];
+        parent_[id] = root;
+        id = next;
+    }
+    return root;
+}
+
+void StackLabeler::unite(int a, int b) {
+    a = find(a);
+    b = find(b);
+    if (a == b) return;
+
+    // The older id stays the root and collects the object
+    if (b < a) std::swap(a, b);
+    Object &kept = objects_[a];
+    const Object &merged = objects_[b];
+    kept.voxels += merged.voxels;
+    kept.z_begin = std::min(kept.z_begin, merged.z_begin);
+    kept.z_end = std::max(kept.z_end, merged.z_end);
+    objects_.erase(b);
+    parent_[b] = a;
+}
+
+void StackLabeler::close(const Object &object) {
+    unsigned int volume = (unsigned int)(object.voxels/VOLUME_BIN_VOXELS);
+    unsigned int extent = (unsigned int)(object.z_end - object.z_begin);
+    bins_.volume_bins[std::min(volume, num_bins_-1)]++;
+    bins_.z_extent_bins[std::min(extent, num_bins_-1)]++;
+    bins_.count++;
+}
+
+bool StackLabeler::addSlice(const cv::Mat &mask) {
+
+    if ((mask.type() != CV_8UC1) || (!previous_.empty() && (mask.size() != previous_.size()))) {
+        std::cerr << "Stack slices must be 8-bit masks of the same size" << std::endl;
+        return false;
+    }
+
+    // Objects of the slice, 4 or 8-connected in the plane
+    cv::Mat labels, stats, centroids;
+    int label_cnt = cv::connectedComponentsWithStats(mask, labels, stats, centroids,
+                                                (connectivity_ == 6) ? 4 : 8, CV_32S);
+    int base_id = next_id_ - 1;
+    next_id_ += label_cnt - 1;
+    for (int label = 1; label < label_cnt; label++) {
+        Object object;
+        object.voxels = stats.at<int>(label, cv::CC_STAT_AREA)*voxel_scale_;
+        object.z_begin = object.z_end = z_;
+        parent_[base_id + label] = base_id + label;
+        objects_[base_id + label] = object;
+    }
+
+    // Join them to the objects of the previous slice they touch, through
+    // the face only (6) or through the faces, edges and corners (26)
+    if (!previous_.empty()) {
+        int reach = (connectivity_ == 6) ? 0 : 1;
+        int last_current = 0, last_previous = 0;
+        for (int y = 0; y < labels.rows; y++) {
+            const int *current = labels.ptr<int>(y);
+            for (int x = 0; x < labels.cols; x++) {
+                if (!current[x]) continue;
+                for (int yy = std::max(0, y - reach); yy <= std::min(labels.rows-1, y + reach); yy++) {
+                    const int *previous = previous_.ptr<int>(yy);
+                    for (int xx = std::max(0, x - reach);
+                                xx <= std::min(labels.cols-1, x + reach); xx++) {
+                        if (!previous[xx]) continue;
+                        if ((current[x] == last_current) && (previous[xx] == last_previous)) {
+                            continue;
+                        }
+                        last_current = current[x];
+                        last_previous = previous[xx];
+                        unite(base_id + current[x], previous[xx]);
+                    }
+                }
+            }
+        }
+    }
+
+    // Roots reaching this slice, the objects of the last slice left out are complete
+    std::vector<int> root_of(label_cnt, 0);
+    std::vector<int> roots;
+    for (int label = 1; label < label_cnt; label++) {
+        root_of[label] = find(base_id + label);
+        roots.push_back(root_of[label]);
+    }
+    std::sort(roots.begin(), roots.end());
+    roots.erase(std::unique(roots.begin(), roots.end()), roots.end());
+    for (auto root : open_roots_) {
+        if ((find(root) == root) && !std::binary_search(roots.begin(), roots.end(), root)) {
+            close(objects_[root]);
+        }
+    }
+
+    // Keep only the root ids of this slice and their objects
+    for (int y = 0; y < labels.rows; y++) {
+        int *ptr = labels.ptr<int>(y);
+        for (int x = 0; x < labels.cols; x++) {
+            ptr[x] = root_of[ptr[x]];
+        }
+    }
+    previous_ = labels;
+    std::unordered_map<int, int> parent;
+    std::unordered_map<int, Object> objects;
+    for (auto root : roots) {
+        parent[root] = root;
+        objects[root] = objects_[root];
+    }
+    parent_.swap(parent);
+    objects_.swap(objects);
+    open_roots_ = roots;
+    z_++;
+    return true;
+}
+
+const StackObjectBins& StackLabeler::finish() {
+    for (auto root : open_roots_) {
+        close(objects_[root]);
+    }
+    open_roots_.clear();
+    parent_.clear();
+    objects_.clear();
+    previous_.release();
+    return bins_;
+}
+
+size_t StackLabeler::openObjects() const {
+    return open_roots_.size();
+}
@@ -0,0 +1,70 @@
+#ifndef STACK_LABELER_HPP
+#define STACK_LABELER_HPP
+
+/* Streaming 3D connected-component labeling
+   Labels the objects of a channel across the z planes of a stack, one mask
+   slice at a time, with 6 or 26 connectivity. Only the labels of the last
+   slice and the equivalences of the objects that reach it are kept, so the
+   memory does not grow with the stack depth. An object is binned by volume
+   and z-extent as soon as a slice no longer touches it.
+ */
+
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#define VOLUME_BIN_VOXELS   100 // Volume covered by one bin, at full xy resolution
+
+/* Object count and histograms of one channel */
+struct StackObjectBins {
+    unsigned int count = 0;
+    std::vector<unsigned int> volume_bins; // Voxels, VOLUME_BIN_VOXELS per bin
+    std::vector<unsigned int> z_extent_bins; // Slices spanned, one per bin
+};
+
+class StackLabeler {
+
+public:
+    /* voxel_scale converts the slice pixels to full resolution pixels */
+    StackLabeler(std::string channel, int connectivity = 26,
+                    unsigned int num_bins = 21, double voxel_scale = 1.0);
+
+    const std::string& channel() const;
+
+    /* Label the next slice, an 8-bit mask given in z order */
+    bool addSlice(const cv::Mat &mask);
+
+    /* Close the objects that reach the last slice and return the bins */
+    const StackObjectBins& finish();
+
+    /* Objects that reach the last slice */
+    size_t openObjects() const;
+
+private:
+    struct Object {
+        double voxels;
+        int z_begin;
+        int z_end;
+    };
+
+    int find(int id);
+
+    void unite(int a, int b);
+
+    void close(const Object &object);
+
+    std::string channel_;
+    int connectivity_;
+    unsigned int num_bins_;
+    double voxel_scale_;
+    int z_ = 0;
+    int next_id_ = 1;
+    cv::Mat previous_; // Root ids of the last slice, CV_32S, 0 for background
+    std::vector<int> open_roots_; // Roots present in the last slice
+    std::unordered_map<int, int> parent_;
+    std::unordered_map<int, Object> objects_; // Held by the roots only
+    StackObjectBins bins_;
+};
+
+#endif
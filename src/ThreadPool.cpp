@@ -0,0 +1,61 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(unsigned int workers, WorkerStart worker_start) {
+    if (!workers) workers = 1;
+    for (unsigned int i = 0; i < workers; i++) {
+        workers_.push_back(std::thread(&ThreadPool::workerLoop, this, i, worker_start));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    task_cv_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+void ThreadPool::submit(std::function<void()> task, int priority) {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        Task entry;
+        entry.priority = priority;
+        entry.seq = seq_++;
+        entry.run = task;
+        tasks_.push(entry);
+    }
+    task_cv_.notify_one();
+}
+
+void ThreadPool::wait() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    idle_cv_.wait(lock, [this] { return tasks_.empty() && !active_; });
+}
+
+unsigned int ThreadPool::size() const {
+    return (unsigned int)workers_.size();
+}
+
+void ThreadPool::workerLoop(unsigned int worker, WorkerStart worker_start) {
+    if (worker_start) worker_start(worker);
+    while (true) {
+        Task task;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            task_cv_.wait(lock, [this] { return stop_ || !tasks_.empty(); });
+            if (tasks_.empty()) return; // stopping and drained
+            task = tasks_.top();
+            tasks_.pop();
+            active_++;
+        }
+        task.run();
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            active_--;
+            if (tasks_.empty() && !active_) idle_cv_.notify_all();
+        }
+    }
+}
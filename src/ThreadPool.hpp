@@ -0,0 +1,61 @@
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+/* Thread pool
+   A fixed set of long lived workers serving a priority queue of tasks. 
+   Tasks of equal priority run in submission order. An optional hook runs 
+   on each worker thread before it takes its first task.
+ */
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+
+public:
+    /* Called on each worker thread with its index, when the worker starts */
+    typedef std::function<void(unsigned int worker)> WorkerStart;
+
+    ThreadPool(unsigned int workers, WorkerStart worker_start = WorkerStart());
+    ~ThreadPool();
+
+    /* Queue a task, higher priorities run first */
+    void submit(std::function<void()> task, int priority = 0);
+
+    /* Block until the queue is empty and every worker is idle */
+    void wait();
+
+    unsigned int size() const;
+
+private:
+    struct Task {
+        int priority;
+        uint64_t seq;
+        std::function<void()> run;
+    };
+
+    struct TaskOrder {
+        bool operator()(const Task &a, const Task &b) const {
+            return (a.priority < b.priority) || 
+                        ((a.priority == b.priority) && (a.seq > b.seq));
+        }
+    };
+
+    void workerLoop(unsigned int worker, WorkerStart worker_start);
+
+    std::vector<std::thread> workers_;
+    std::priority_queue<Task, std::vector<Task>, TaskOrder> tasks_;
+    std::mutex mutex_;
+    std::condition_variable task_cv_;
+    std::condition_variable idle_cv_;
+    uint64_t seq_ = 0;
+    unsigned int active_ = 0;
+    bool stop_ = false;
+};
+
+#endif
@@ -0,0 +1,264 @@
+#include <chrono>
+#include <dirent.h>
+#include <errno.h>
+#include <iostream>
+#include <poll.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "DatasetManifest.hpp"
+#include "WatchFolder.hpp"
+
+#define WATCH_POLL_MS       250     // stat poll period of the pending planes
+#define WATCH_SETTLE_MS     1000    // unchanged size needed before a read
+#define WATCH_READ_ATTEMPTS 5       // decode attempts before a plane is dropped
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void requestStop(int) {
+    stop_requested = 1;
+}
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+WatchFolder::WatchFolder(unsigned int window_size, std::string layer_pattern, 
+                            PlaneReader read_plane, WindowProcessor process_window) :
+    window_size_(window_size),
+    layer_pattern_(layer_pattern),
+    read_plane_(read_plane),
+    process_window_(process_window) {
+
+    inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd_ < 0) {
+        std::cerr << "Could not initialize inotify: " << strerror(errno) << std::endl;
+    }
+}
+
+WatchFolder::~WatchFolder() {
+    if (inotify_fd_ >= 0) close(inotify_fd_);
+}
+
+void WatchFolder::addDirectory(std::string dir) {
+    if ((dir.empty()) || (dir.back() != '/')) dir += "/";
+    dirs_[dir];
+}
+
+std::vector<std::string> WatchFolder::failedDirectories() {
+    std::vector<std::string> failed;
+    for (auto& entry : dirs_) {
+        if (entry.second.failed) failed.push_back(entry.first);
+    }
+    return failed;
+}
+
+bool WatchFolder::startWatch(std::string dir, DirState *state) {
+    struct stat st;
+    if ((stat(dir.c_str(), &st) != 0) || !S_ISDIR(st.st_mode)) return false;
+
+    state->watch = inotify_add_watch(inotify_fd_, dir.c_str(),
+                                        IN_CREATE | IN_CLOSE_WRITE | IN_MOVED_TO);
+    if (state->watch < 0) {
+        std::cerr << "Could not watch " << dir << ": " << strerror(errno) << std::endl;
+        state->failed = true;
+        return false;
+    }
+    watches_[state->watch] = dir;
+
+    // Planes written before the watch was set up
+    scanDirectory(dir, state);
+    return true;
+}
+
+void WatchFolder::scanDirectory(std::string dir, DirState *state) {
+    DIR *dir_handle = opendir(dir.c_str());
+    if (!dir_handle) return;
+    struct dirent *entry;
+    while ((entry = readdir(dir_handle)) != NULL) {
+        noteFile(dir, entry->d_name, state);
+    }
+    closedir(dir_handle);
+}
+
+void WatchFolder::noteFile(std::string dir, std::string file_name, DirState *state) {
+    std::string base_name;
+    int z = DatasetManifest::planeIndex(dir, layer_pattern_, file_name, &base_name);
+    if ((z < (int)state->next_window) || state->planes.count(z) || state->dropped.count(z)) {
+        return;
+    }
+    if (!state->pending.count(file_name)) {
+        PendingFile pending;
+        pending.size = -1;
+        pending.stable_since = nowMs();
+        pending.attempts = 0;
+        state->pending[file_name] = pending;
+    }
+}
+
+bool WatchFolder::ingestPending(std::string dir, DirState *state, int64_t now) {
+    bool ingested = false;
+    for (auto it = state->pending.begin(); it != state->pending.end(); ) {
+        struct stat st;
+        if (stat((dir + it->first).c_str(), &st) != 0) {
+            it = state->pending.erase(it);
+            continue;
+        }
+
+        // Wait until the microscope stopped growing the file
+        if (st.st_size != it->second.size) {
+            it->second.size = st.st_size;
+            it->second.stable_since = now;
+            ++it;
+            continue;
+        }
+        if (now - it->second.stable_since < WATCH_SETTLE_MS) {
+            ++it;
+            continue;
+        }
+
+        std::string base_name;
+        unsigned int z = (unsigned int) DatasetManifest::planeIndex(dir, layer_pattern_, 
+                                                                it->first, &base_name);
+        cv::Mat plane;
+        if (read_plane_(dir + base_name, &plane)) {
+            if (z >= state->next_window) state->planes[z] = plane;
+            it = state->pending.erase(it);
+            ingested = true;
+            continue;
+        }
+
+        // A truncated plane is retried until the attempts run out
+        it->second.stable_since = now;
+        if (++it->second.attempts >= WATCH_READ_ATTEMPTS) {
+            std::cerr << "Could not read " << dir << it->first << std::endl;
+            state->failed = true;
+            if (z >= state->next_window) state->dropped.insert(z);
+            it = state->pending.erase(it);
+
+            // The windows waiting on the plane can be skipped now
+            ingested = true;
+            continue;
+        }
+        ++it;
+    }
+    return ingested;
+}
+
+void WatchFolder::processWindows(std::string dir, DirState *state) {
+    while (true) {
+        unsigned int first = state->next_window;
+        std::vector<cv::Mat> window(window_size_);
+
+        // A window holding a dropped plane is skipped, the later ones go on
+        auto dropped = state->dropped.lower_bound(first);
+        if ((dropped != state->dropped.end()) && (*dropped < first + window_size_)) {
+            std::cerr << "Skipped window " << first << " of " << dir << ", plane " 
+                      << *dropped << " could not be read" << std::endl;
+            state->planes.erase(first);
+            state->dropped.erase(state->dropped.begin(), dropped);
+            state->next_window++;
+            continue;
+        }
+        for (unsigned int z = first; z < first + window_size_; z++) {
+            auto plane = state->planes.find(z);
+            if (plane == state->planes.end()) return;
+            window[(z-1)%window_size_] = plane->second;
+        }
+        if (!process_window_(dir, window, first)) {
+            std::cerr << "Could not process window " << first << " of " << dir << std::endl;
+            state->failed = true;
+        }
+
+        // The oldest plane is not part of any later window
+        state->planes.erase(first);
+        state->next_window++;
+    }
+}
+
+bool WatchFolder::run(unsigned int idle_timeout) {
+    if (inotify_fd_ < 0) return false;
+
+    // Interrupt the poll instead of restarting it
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = requestStop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    int64_t last_activity = nowMs();
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    while (!stop_requested) {
+        struct pollfd fds;
+        fds.fd = inotify_fd_;
+        fds.events = POLLIN;
+        int ready = poll(&fds, 1, WATCH_POLL_MS);
+        if ((ready < 0) && (errno != EINTR)) {
+            std::cerr << "Watch poll failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // Record the new and the completed plane files
+        bool overflow = false;
+        if ((ready > 0) && (fds.revents & POLLIN)) {
+            ssize_t len;
+            while ((len = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+                for (char *ptr = buffer; ptr < buffer + len;
+                        ptr += sizeof(struct inotify_event) + ((struct inotify_event *) ptr)->len) {
+                    struct inotify_event *event = (struct inotify_event *) ptr;
+                    if (event->mask & IN_Q_OVERFLOW) overflow = true;
+                    auto watch = watches_.find(event->wd);
+                    if ((watch == watches_.end()) || !event->len) continue;
+                    DirState *state = &dirs_[watch->second];
+                    noteFile(watch->second, event->name, state);
+
+                    // A closed or renamed file is complete, skip the settle delay
+                    auto pending = state->pending.find(event->name);
+                    struct stat st;
+                    if ((pending != state->pending.end()) &&
+                            (event->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)) &&
+                            (stat((watch->second + event->name).c_str(), &st) == 0)) {
+                        pending->second.size = st.st_size;
+                        pending->second.stable_since = nowMs() - WATCH_SETTLE_MS;
+                    }
+                }
+            }
+        }
+
+        // Events were lost, every watched directory is listed again. The 
+        // planes found are settled by size since their close is not known.
+        if (overflow) {
+            std::cerr << "Watch event queue overflowed, rescanning the directories" 
+                      << std::endl;
+            for (auto& entry : dirs_) {
+                if (entry.second.watch >= 0) scanDirectory(entry.first, &entry.second);
+            }
+        }
+
+        int64_t now = nowMs();
+        bool pending = false;
+        for (auto& entry : dirs_) {
+            DirState *state = &entry.second;
+            if ((state->watch < 0) && !state->failed) {
+                if (!startWatch(entry.first, state)) continue;
+            }
+            if (ingestPending(entry.first, state, now)) {
+                last_activity = now;
+                processWindows(entry.first, state);
+            }
+            if (!state->pending.empty()) pending = true;
+        }
+
+        if (idle_timeout && !pending &&
+                    (now - last_activity >= (int64_t) idle_timeout * 1000)) {
+            break;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,83 @@
+#ifndef WATCH_FOLDER_HPP
+#define WATCH_FOLDER_HPP
+
+/* Watch folder ingestion
+   Follows image directories while the microscope is still writing them.
+   A z plane, named after the layer pattern of the dataset manifest, is
+   read once its size has settled and it decodes. A window of consecutive
+   z planes is analyzed as soon as all of its planes have arrived, and the
+   oldest plane is released right after, so only one window per directory
+   is held in memory. The windows holding a plane that could not be read
+   are skipped and logged.
+ */
+
+#include <functional>
+#include <map>
+#include <set>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include <opencv2/core/core.hpp>
+
+class WatchFolder {
+
+public:
+    /* Decode a z plane given its file name without the extension */
+    typedef std::function<bool(std::string base_name, cv::Mat *plane)> PlaneReader;
+
+    /* Analyze a window, the planes are in ring buffer order ((z-1) % size) */
+    typedef std::function<bool(std::string dir, const std::vector<cv::Mat> &window,
+                                    unsigned int window_index)> WindowProcessor;
+
+    /* The plane names follow the layer pattern, see DatasetManifest */
+    WatchFolder(unsigned int window_size, std::string layer_pattern, 
+                    PlaneReader read_plane, WindowProcessor process_window);
+    ~WatchFolder();
+
+    /* Follow a directory, it does not need to exist yet */
+    void addDirectory(std::string dir);
+
+    /* Ingest planes until SIGINT/SIGTERM, or until no plane arrived for
+       idle_timeout seconds (0 waits forever) */
+    bool run(unsigned int idle_timeout);
+
+    /* Directories in which a plane or a window could not be processed */
+    std::vector<std::string> failedDirectories();
+
+private:
+    struct PendingFile {
+        off_t size;
+        int64_t stable_since;
+        unsigned int attempts;
+    };
+
+    struct DirState {
+        int watch = -1;
+        unsigned int next_window = 1;
+        bool failed = false;
+        std::map<unsigned int, cv::Mat> planes;
+        std::set<unsigned int> dropped; // Planes given up on, from the next window on
+        std::map<std::string, PendingFile> pending;
+    };
+
+    bool startWatch(std::string dir, DirState *state);
+
+    void scanDirectory(std::string dir, DirState *state);
+
+    void noteFile(std::string dir, std::string file_name, DirState *state);
+
+    bool ingestPending(std::string dir, DirState *state, int64_t now);
+
+    void processWindows(std::string dir, DirState *state);
+
+    unsigned int window_size_;
+    std::string layer_pattern_;
+    PlaneReader read_plane_;
+    WindowProcessor process_window_;
+    int inotify_fd_;
+    std::map<std::string, DirState> dirs_;
+    std::map<int, std::string> watches_;
+};
+
+#endif
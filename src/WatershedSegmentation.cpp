@@ -0,0 +1,137 @@
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include "WatershedSegmentation.hpp"
+
+/* Split the flagged contours, one bounding box per parallel job */
+class WatershedBody : public cv::ParallelLoopBody {
+
+public:
+    WatershedBody(std::function<void(int)> job) : job_(job) {}
+
+    void operator()(const cv::Range& range) const {
+        for (int i = range.start; i < range.end; i++) {
+            job_(i);
+        }
+    }
+
+private:
+    std::function<void(int)> job_;
+};
+
+WatershedSegmentation::WatershedSegmentation(double min_area) : 
+    min_area_(min_area) {}
+
+std::vector<bool> WatershedSegmentation::flagSuspicious(
+        const ContourStore &contours, const std::vector<int> &selected) {
+
+    std::vector<bool> flags(selected.size(), false);
+    if (selected.empty()) return flags;
+
+    // Median and median absolute deviation of the area in this window
+    std::vector<double> areas(selected.size());
+    for (size_t i = 0; i < selected.size(); i++) {
+        areas[i] = contours.area(selected[i]);
+    }
+    std::vector<double> sorted = areas;
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    double median = sorted[sorted.size()/2];
+    for (auto& area : sorted) {
+        area = fabs(area - median);
+    }
+    std::nth_element(sorted.begin(), sorted.begin() + sorted.size()/2, sorted.end());
+    double mad = 1.4826 * sorted[sorted.size()/2];
+    double area_limit = median + area_mad_factor_ * mad;
+
+    for (size_t i = 0; i < selected.size(); i++) {
+
+        // Merged cells are larger than the rest of the window
+        if ((selected.size() > 2) && (areas[i] > area_limit) && (areas[i] > 1.5*median)) {
+            flags[i] = true;
+            continue;
+        }
+
+        // Or concave where they touch
+        std::vector<cv::Point> hull;
+        cv::convexHull(contours.contour(selected[i]).mat(), hull);
+        double hull_area = cv::contourArea(hull);
+        if ((hull_area > 0.0) && (areas[i]/hull_area < min_solidity_)) {
+            flags[i] = true;
+        }
+    }
+    return flags;
+}
+
+void WatershedSegmentation::setMarkers(cv::Mat distance, cv::Mat blob, 
+                                            cv::Mat *markers, int *marker_cnt) {
+
+    // Seed one marker per distance peak, and one for the background
+    double max_distance = 0.0;
+    cv::minMaxLoc(distance, NULL, &max_distance);
+    cv::Mat peaks;
+    cv::threshold(distance, peaks, peak_ratio_ * max_distance, 255, cv::THRESH_BINARY);
+    peaks.convertTo(peaks, CV_8U);
+    *marker_cnt = cv::connectedComponents(peaks, *markers, 8, CV_32S) - 1;
+    markers->setTo(cv::Scalar(*marker_cnt + 1), blob == 0);
+}
+
+void WatershedSegmentation::process(ContourView contour, 
+                                        std::vector<std::vector<cv::Point>> *pieces) {
+
+    // Work only inside the padded bounding box of the blob
+    cv::Rect bound = cv::boundingRect(contour.mat());
+    cv::Rect roi(bound.x - 2, bound.y - 2, bound.width + 4, bound.height + 4);
+    std::vector<cv::Mat> blob_contour(1, contour.mat());
+    cv::Mat blob = cv::Mat::zeros(roi.size(), CV_8UC1);
+    cv::drawContours(blob, blob_contour, -1, cv::Scalar::all(255), cv::FILLED, 
+                        cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point(-roi.x, -roi.y));
+
+    cv::Mat distance;
+    cv::distanceTransform(blob, distance, cv::DIST_L2, cv::DIST_MASK_5);
+    cv::Mat markers;
+    int marker_cnt = 0;
+    setMarkers(distance, blob, &markers, &marker_cnt);
+    if (marker_cnt < 2) return;
+
+    // Flood the inverted distance map from the markers
+    cv::Mat topography;
+    cv::normalize(distance, topography, 0, 255, cv::NORM_MINMAX, CV_8U);
+    cv::bitwise_not(topography, topography);
+    cv::cvtColor(topography, topography, cv::COLOR_GRAY2BGR);
+    cv::watershed(topography, markers);
+
+    // Each marker basin inside the blob becomes a cell
+    std::vector<std::vector<cv::Point>> split;
+    for (int label = 1; label <= marker_cnt; label++) {
+        cv::Mat basin = (markers == label);
+        std::vector<std::vector<cv::Point>> basin_contours;
+        cv::findContours(basin, basin_contours, cv::RETR_EXTERNAL, 
+                            cv::CHAIN_APPROX_SIMPLE, roi.tl());
+        for (auto& basin_contour : basin_contours) {
+            if (fabs(cv::contourArea(basin_contour)) >= min_area_) {
+                split.push_back(basin_contour);
+            }
+        }
+    }
+    if (split.size() >= 2) {
+        *pieces = split;
+    }
+}
+
+void WatershedSegmentation::apply(const ContourStore &contours, 
+                                    const std::vector<int> &selected, 
+                                    std::vector<std::vector<std::vector<cv::Point>>> *pieces) {
+
+    pieces->assign(selected.size(), std::vector<std::vector<cv::Point>>());
+    std::vector<bool> flags = flagSuspicious(contours, selected);
+    std::vector<int> suspicious;
+    for (size_t i = 0; i < flags.size(); i++) {
+        if (flags[i]) suspicious.push_back((int)i);
+    }
+    if (suspicious.empty()) return;
+
+    WatershedBody body([&](int i) {
+        process(contours.contour(selected[suspicious[i]]), &(*pieces)[suspicious[i]]);
+    });
+    cv::parallel_for_(cv::Range(0, (int)suspicious.size()), body);
+}
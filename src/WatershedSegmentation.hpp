@@ -0,0 +1,39 @@
+#ifndef WATERSHED_SEGMENTATION_HPP
+#define WATERSHED_SEGMENTATION_HPP
+
+/* Watershed segmentation algorithm
+   Splits touching cells by running a marker watershed only inside the 
+   bounding boxes of the blobs that look merged.
+ */
+
+#include <vector>
+#include "opencv2/imgproc/imgproc.hpp"
+
+#include "ContourStore.hpp"
+
+class WatershedSegmentation {
+
+public:
+    WatershedSegmentation(double min_area);
+
+    /* Flag the suspicious selected contours and split them in parallel. 
+       pieces[i] holds the split contours of selected[i], empty if not split. */
+    void apply(const ContourStore &contours, const std::vector<int> &selected, 
+                std::vector<std::vector<std::vector<cv::Point>>> *pieces);
+
+private:
+    std::vector<bool> flagSuspicious(const ContourStore &contours, 
+                                        const std::vector<int> &selected);
+
+    void setMarkers(cv::Mat distance, cv::Mat blob, cv::Mat *markers, int *marker_cnt);
+
+    void process(ContourView contour, 
+                    std::vector<std::vector<cv::Point>> *pieces);
+
+    double min_area_ = 0.0;
+    double area_mad_factor_ = 3.0;   // Area outlier = median + factor*MAD
+    double min_solidity_ = 0.85;     // Contour area over convex hull area
+    double peak_ratio_ = 0.5;        // Marker = distance >= ratio*max distance
+};
+
+#endif
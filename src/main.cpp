@@ -1,816 +1,949 @@
 #include <iostream>
-#include <dirent.h>
+#include <algorithm>
+#include <chrono>
+#include <malloc.h>
 #include <sys/stat.h>
 #include <fstream>
+#include <iomanip>
+#include <map>
 #include <math.h>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <sstream>
+#include <stdlib.h>
+#include <thread>
 
 #include "opencv2/imgproc/imgproc.hpp"
 //#include "opencv2/highgui/highgui.hpp"
-#include "opencv2/photo/photo.hpp"
 #include "opencv2/imgcodecs.hpp"
 
-#define NUM_Z_LAYERS            3   // Merge a certain number of z layers
-#define NUM_SYNAPSE_AREA_BINS   21  // Number of bins
-#define SYNAPSE_BIN_AREA        25  // Bin area
-#define NEURON_ROI_FACTOR       3   // Roi of neuron = roi_factor*mean_neuron_diameter
+#include "Benchmark.hpp"
+#include "CoreScheduler.hpp"
+#include "DatasetManifest.hpp"
+#include "EquivalenceCheck.hpp"
+#include "MaskVolume.hpp"
+#include "MemoryGovernor.hpp"
+#include "NeuronSeg.hpp"
+#include "ParameterSweep.hpp"
+#include "PlateAggregator.hpp"
+#include "Server.hpp"
+#include "SignalScreen.hpp"
+#include "StackLabeler.hpp"
+#include "ThreadPool.hpp"
+#include "WatchFolder.hpp"
+
+#define WINDOW_INTERMEDIATES    36  // Single channel images alive in a window
+#define SWEEP_POINT_MASK_BYTES  11  // Cached masks and green labels of a grid point, per pixel
+#define SWEEP_POINT_FLOORS      4   // Cached blurred floors of a grid point, at the sample size
+#define SWEEP_POINT_CONTOURS    5   // Cached contour stores of a grid point
+#define CONTOUR_STORE_BYTES     4   // Estimated contour store bytes per pixel
 #define DEBUG_FLAG              0   // Debug flag for image channels
-
-/* Channel type */
-enum class ChannelType : unsigned char {
-    BLUE = 0,
-    GREEN_LOW,
-    GREEN_HIGH,
-    GREEN_COMBINED,
-    ENHANCE_AXON,
-    RED_LOW,
-    RED_HIGH
+#define SERVER_MMAP_THRESHOLD   (32 << 20)  // Smaller server buffers come from the heap
+#define SERVER_TRIM_THRESHOLD   (512 << 20) // Freed heap kept by the server for reuse
+
+/* Run time options */
+struct RunOptions {
+    unsigned int preview_scale = 1; // Decode and analyze at 1/preview_scale resolution
+    unsigned int bit_depth = 8; // Significant bits of the camera samples (8, 12 or 16)
+    unsigned int pyramid_levels = 0; // Detect nuclei on a 1/2^levels pyramid level first
+    bool neuron_roi = false; // Analyze synapses only in the tiles around the neurons
+    bool colocalization = false; // Write the green overlap of every red object
+    bool split_nuclei = false; // Split touching nuclei with a local watershed
+    float sample_error = 0.0; // Target relative error of the sampled synapse counts
+    unsigned int sample_seed = 1; // Seed of the synapse tile sampling
+    bool screen = false; // Skip the windows without signal in any channel
+    ScreenThresholds screen_thresholds; // Signal and focus a channel plane must reach
+    std::string serve; // Serve jobs on this Unix socket ("-" for stdin)
+    unsigned int workers = 0; // Directories processed concurrently (0 = from the policy)
+    std::string parallel; // outer, inner or hybrid (empty = hybrid with workers, else inner)
+    unsigned int opencv_threads = 0; // OpenCV threads per worker (0 = from the policy)
+    bool pin = false; // Pin each worker to its own cores
+    unsigned int scaling_bench = 0; // Benchmark the policies up to this many cores
+    std::string bench; // Throughput benchmark JSON output ("-" for stdout)
+    BenchPlate bench_plate; // Synthetic plate of the throughput benchmark
+    std::vector<unsigned int> bench_threads; // Benchmarked thread counts
+    std::string bench_label; // Version label of the benchmark results
+    bool watch = false; // Follow the directories while the z planes are written
+    unsigned int watch_idle = 0; // Stop watching after this many idle seconds (0 = never)
+    size_t memory_budget = 0; // Bytes the concurrent directories may reserve (0 = no limit)
+    bool memory_report = false; // Print the peak resident memory of each stage
+    bool verify = false; // Compare these options against the reference pipeline
+    unsigned int synthetic = 0; // Synthetic windows added to the comparison
+    VerifyTolerance tolerance; // Allowed metric column and mask differences
+    std::vector<std::string> volume_channels; // Masks exported to the 3D volume file
+    unsigned int volume_downsample = 1; // X and y downsampling of the volume masks
+    bool volume_mesh = false; // Write the mesh of the first volume channel
+    std::vector<std::string> stack_channels; // Masks labeled in 3D across the windows
+    int stack_connectivity = 26; // 6 or 26 connected objects in the stack
+    bool stack_check = false; // Check the 3D labeling on objects of known shape
+    std::string manifest; // Index of the directory planes, reused by later runs
+    std::string layer_pattern = DEFAULT_LAYER_PATTERN; // Plane names, {dir} and {z} filled in
+    std::string aggregate; // Prefix of the plate summary and heatmap files
+    std::vector<std::string> aggregate_shards; // Summaries of other shards of the plate
+    ParameterSweep sweep; // Grid of segmentation parameters, each point gets its own output
 };
 
-/* Hierarchy type */
-enum class HierarchyType : unsigned char {
-    INVALID_CNTR = 0,
-    CHILD_CNTR,
-    PARENT_CNTR
-};
+/* Serializes the rows appended to the output files by concurrent directories */
+static std::mutex output_mutex;
 
-/* Canny Edge Detection */
-void CannyThreshold(cv::Mat src, cv::Mat *dst) {
-
-    cv::Mat detected_edges;
-    blur(src, detected_edges, cv::Size(3,3));
-    Canny(detected_edges, detected_edges, 0, 255, 3);
-    *dst = cv::Scalar::all(0);
-    src.copyTo(*dst, detected_edges);
-}
-
-/* Enhance the image */
-bool enhanceImage(cv::Mat src, ChannelType channel_type, cv::Mat *dst) {
-
-    // Convert to grayscale
-    cv::Mat src_gray;
-    cvtColor (src, src_gray, cv::COLOR_BGR2GRAY);
-
-    // Enhance the image using Gaussian blur and thresholding
-    cv::Mat enhanced;
-    switch(channel_type) {
-        case ChannelType::BLUE: {
-            // Enhance the blue channel
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
-
-            // Invert the mask
-            bitwise_not(enhanced, enhanced);
-        } break;
-
-        case ChannelType::GREEN_LOW: {
-            // Enhance the green channel low intensities
-            cv::Mat green_low = src_gray;
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 200, 255, cv::THRESH_BINARY);
-
-            // Enhance the low intensity features
-            cv::Mat green_low_gauss;
-            cv::GaussianBlur(green_low, green_low_gauss, cv::Size(3,3), 0, 0);
-            bitwise_and(green_low_gauss, enhanced, enhanced);
-            cv::threshold(enhanced, enhanced, 250, 255, cv::THRESH_TOZERO_INV);
-            cv::threshold(enhanced, enhanced, 1, 255, cv::THRESH_BINARY);
-        } break;
-
-        case ChannelType::GREEN_HIGH: {
-            // Enhance the green channel high intensities
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 50, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 200, 255, cv::THRESH_BINARY);
-
-            // Invert the mask
-            bitwise_not(enhanced, enhanced);
-        } break;
-
-        case ChannelType::GREEN_COMBINED: {
-            // Enhance the green channel (high and low combined)
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 25, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
-
-            // Invert the mask
-            bitwise_not(enhanced, enhanced);
-        } break;
-
-        case ChannelType::ENHANCE_AXON: {
-            // Create and enhance the axon boundary mask
-
-            cv::fastNlMeansDenoising(src_gray, src_gray, 3.0);
-            cv::threshold(src_gray, src_gray, 5, 255, cv::THRESH_BINARY);
-            CannyThreshold(src_gray, &enhanced);
-        } break;
-
-        case ChannelType::RED_LOW: {
-            // Enhance the red channel low intensities
-            cv::Mat red_low = src_gray;
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 80, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
-
-            // Enhance the low intensity features
-            cv::Mat red_low_gauss;
-            cv::GaussianBlur(red_low, red_low_gauss, cv::Size(3,3), 0, 0);
-            bitwise_and(red_low_gauss, enhanced, enhanced);
-            cv::threshold(enhanced, enhanced, 240, 255, cv::THRESH_TOZERO_INV);
-            cv::threshold(enhanced, enhanced, 50, 255, cv::THRESH_BINARY);
-        } break;
-
-        case ChannelType::RED_HIGH: {
-            // Enhance the red channel higher intensities
-
-            // Create the mask
-            cv::threshold(src_gray, src_gray, 80, 255, cv::THRESH_TOZERO);
-            bitwise_not(src_gray, src_gray);
-            cv::GaussianBlur(src_gray, enhanced, cv::Size(3,3), 0, 0);
-            cv::threshold(enhanced, enhanced, 220, 255, cv::THRESH_BINARY);
-
-            // Invert the mask
-            bitwise_not(enhanced, enhanced);
-        } break;
-
-        default: {
-            std::cerr << "Invalid channel type" << std::endl;
-            return false;
+/* Admits directories against the memory budget and tracks the stage peaks */
+static MemoryGovernor memory_governor;
+
+/* Running statistics of the wells, merged under the output mutex */
+static PlateAggregator plate_aggregate;
+
+/* Time spent in each pipeline stage, for the throughput benchmark */
+static StageProfiler stage_profiler;
+
+/* Largest sample value of a bit depth */
+double sampleMax(unsigned int bit_depth) {
+    return (double)((1 << bit_depth) - 1);
+}
+
+/* Widen 8-bit planes to the 16-bit samples of a bit depth above 8 */
+void widenPlanes(unsigned int bit_depth, std::vector<cv::Mat> *planes) {
+
+    if (bit_depth <= 8) return;
+    for (auto& plane : *planes) {
+        if (plane.depth() == CV_8U) {
+            plane.convertTo(plane, CV_16U, sampleMax(bit_depth)/255.0);
         }
     }
-    *dst = enhanced;
-    return true;
 }
 
-/* Find the contours in the image */
-void contourCalc(cv::Mat src, ChannelType channel_type, 
-                    double min_area, cv::Mat *dst, 
-                    std::vector<std::vector<cv::Point>> *contours, 
-                    std::vector<cv::Vec4i> *hierarchy, 
-                    std::vector<HierarchyType> *validity_mask, 
-                    std::vector<double> *parent_area) {
-
-    cv::Mat temp_src;
-    src.copyTo(temp_src);
-    switch(channel_type) {
-        case ChannelType::BLUE: {
-            findContours(temp_src, *contours, *hierarchy, cv::RETR_EXTERNAL, 
-                                                        cv::CHAIN_APPROX_SIMPLE);
-        } break;
-
-        case ChannelType::RED_LOW : 
-        case ChannelType::RED_HIGH: 
-        case ChannelType::GREEN_LOW: 
-        case ChannelType::GREEN_HIGH: {
-            findContours(temp_src, *contours, *hierarchy, cv::RETR_CCOMP, 
-                                                        cv::CHAIN_APPROX_SIMPLE);
-        } break;
-
-        default: return;
-    }
-
-    *dst = cv::Mat::zeros(temp_src.size(), CV_8UC3);
-    if (!contours->size()) return;
-    validity_mask->assign(contours->size(), HierarchyType::INVALID_CNTR);
-    parent_area->assign(contours->size(), 0.0);
-
-    // Keep the contours whose size is >= than min_area
-    cv::RNG rng(12345);
-    for (int index = 0 ; index < (int)contours->size(); index++) {
-        if ((*hierarchy)[index][3] > -1) continue; // ignore child
-        auto cntr_external = (*contours)[index];
-        double area_external = fabs(contourArea(cv::Mat(cntr_external)));
-        if (area_external < min_area) continue;
-
-        std::vector<int> cntr_list;
-        cntr_list.push_back(index);
-
-        int index_hole = (*hierarchy)[index][2];
-        double area_hole = 0.0;
-        while (index_hole > -1) {
-            std::vector<cv::Point> cntr_hole = (*contours)[index_hole];
-            double temp_area_hole = fabs(contourArea(cv::Mat(cntr_hole)));
-            if (temp_area_hole) {
-                cntr_list.push_back(index_hole);
-                area_hole += temp_area_hole;
-            }
-            index_hole = (*hierarchy)[index_hole][0];
-        }
-        double area_contour = area_external - area_hole;
-        if (area_contour >= min_area) {
-            (*validity_mask)[cntr_list[0]] = HierarchyType::PARENT_CNTR;
-            (*parent_area)[cntr_list[0]] = area_contour;
-            for (unsigned int i = 1; i < cntr_list.size(); i++) {
-                (*validity_mask)[cntr_list[i]] = HierarchyType::CHILD_CNTR;
-            }
-            cv::Scalar color = cv::Scalar(rng.uniform(0, 255), rng.uniform(0,255), 
-                                            rng.uniform(0,255));
-            drawContours(*dst, *contours, index, color, cv::FILLED, cv::LINE_8, *hierarchy);
-        }
-    }
-}
-
-/* Classify Neurons and Astrocytes */
-void classifyNeuronsAndAstrocytes(std::vector<std::vector<cv::Point>> blue_contours,
-                                    std::vector<HierarchyType> blue_contour_mask,
-                                    cv::Mat blue_green_intersection,
-                                    std::vector<std::vector<cv::Point>> *astrocyte_contours,
-                                    std::vector<std::vector<cv::Point>> *neuron_contours) {
-
-    for (size_t i = 0; i < blue_contours.size(); i++) {
-
-        if (blue_contour_mask[i] != HierarchyType::PARENT_CNTR) continue;
-
-        // Eliminate small contours via contour arc calculation
-        if ((arcLength(blue_contours[i], true) >= 250) && (blue_contours[i].size() >= 5)) {
-
-            // Determine whether cell is a neuron by calculating blue-green coverage area
-            std::vector<std::vector<cv::Point>> specific_contour (1, blue_contours[i]);
-            cv::Mat drawing = cv::Mat::zeros(blue_green_intersection.size(), CV_8UC1);
-            drawContours(drawing, specific_contour, -1, cv::Scalar::all(255), cv::FILLED, 
-                            cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
-            int contour_count_before = countNonZero(drawing);
-            cv::Mat contour_intersection;
-            bitwise_and(drawing, blue_green_intersection, contour_intersection);
-            int contour_count_after = countNonZero(contour_intersection);
-            float coverage_ratio = ((float)contour_count_after)/contour_count_before;
-            if (coverage_ratio < 0.25) {
-                astrocyte_contours->push_back(blue_contours[i]);
-            } else {
-                // Calculate the aspect ratio of the blue contour,
-                // categorize as astrocytes if aspect ratio is very low.
-                cv::RotatedRect min_area_rect = minAreaRect(cv::Mat(blue_contours[i]));
-                float aspect_ratio = float(min_area_rect.size.width)/min_area_rect.size.height;
-                if (aspect_ratio > 1.0) {
-                    aspect_ratio = 1.0/aspect_ratio;
-                }
-                if (aspect_ratio <= 0.1) {
-                    astrocyte_contours->push_back(blue_contours[i]);
-                } else {
-                    neuron_contours->push_back(blue_contours[i]);
-                }
-            }
+/* Read an image layer, decoded at 1/scale of its resolution */
+cv::Mat readLayer(std::string base_name, unsigned int scale, unsigned int bit_depth = 8) {
+
+    // High bit depth samples are kept, reduced decoding would cut them to 8 bits
+    if (bit_depth > 8) {
+        int flags = cv::IMREAD_ANYDEPTH | cv::IMREAD_COLOR;
+        cv::Mat img = cv::imread(base_name + ".tif", flags);
+        if (img.empty()) {
+            img = cv::imread(base_name + ".jpg", flags);
         }
+        if (img.empty()) return img;
+        std::vector<cv::Mat> planes(1, img);
+        widenPlanes(bit_depth, &planes);
+        img = planes[0];
+        if (scale > 1) {
+            cv::resize(img, img, cv::Size(img.cols/scale, img.rows/scale), 0, 0, cv::INTER_AREA);
+        }
+        return img;
+    }
+
+    // Reduced decoding uses the scaled IDCT for JPEG and decimation for TIFF
+    int flags = cv::IMREAD_COLOR;
+    switch(scale) {
+        case 2: flags = cv::IMREAD_REDUCED_COLOR_2; break;
+        case 4: flags = cv::IMREAD_REDUCED_COLOR_4; break;
+        case 8: flags = cv::IMREAD_REDUCED_COLOR_8; break;
+        default: break;
+    }
+    cv::Mat img = cv::imread(base_name + ".tif", flags);
+    if (img.empty()) {
+        img = cv::imread(base_name + ".jpg", flags);
+    }
+    return img;
+}
+
+/* Output file placed next to the data output file, the suffix goes before the extension */
+std::string siblingFilename(std::string out_file, std::string suffix) {
+
+    std::size_t found = out_file.find_last_of(".");
+    if ((found == std::string::npos) || (found < out_file.find_last_of("/") + 1)) {
+        return out_file + suffix;
+    }
+    return out_file.substr(0, found) + suffix + out_file.substr(found);
+}
+
+/* Per neuron synapse output file */
+std::string neuronBinsFilename(std::string out_file) {
+    return siblingFilename(out_file, "_neurons");
+}
+
+/* Per red object colocalization output file */
+std::string colocalizationFilename(std::string out_file) {
+    return siblingFilename(out_file, "_coloc");
+}
+
+/* Per stack 3D object output file */
+std::string stackBinsFilename(std::string out_file) {
+    return siblingFilename(out_file, "_3d");
+}
+
+/* Data output file of a sweep grid point, or the grid index without a point */
+std::string sweepFilename(std::string out_file, std::string point = "") {
+    return siblingFilename(out_file, "_sweep" + point);
+}
+
+/* Segmentation parameters of a run */
+SegmentationConfig segmentationConfig(RunOptions options) {
+
+    SegmentationConfig config;
+    config.scale = options.preview_scale;
+    config.bit_depth = options.bit_depth;
+    config.pyramid_levels = options.pyramid_levels;
+    config.split_nuclei = options.split_nuclei;
+    config.neuron_roi = options.neuron_roi;
+    config.colocalization = options.colocalization;
+    config.sample_error = options.sample_error;
+    config.sample_seed = options.sample_seed;
+    config.debug_images = DEBUG_FLAG;
+    return config;
+}
+
+/* Segmenter of a run, reporting its stages to the memory governor */
+NeuronSegmenter runSegmenter(RunOptions options, const ParameterSweep *sweep = NULL, 
+                                size_t point = 0) {
+
+    SegmentationConfig config = segmentationConfig(options);
+    NeuronSegmenter segmenter(sweep ? sweep->config(point, config) : config);
+    segmenter.setStageHook([](const std::string &stage) {
+        memory_governor.sampleStage(stage);
+        stage_profiler.stageDone(stage);
+    });
+    return segmenter;
+}
+
+/* Core scheduler of a run */
+CoreScheduler runScheduler(RunOptions options) {
+
+    ParallelPolicy policy = (options.workers > 1) ? ParallelPolicy::HYBRID 
+                                                   : ParallelPolicy::INNER;
+    if (!options.parallel.empty()) {
+        CoreScheduler::parsePolicy(options.parallel, &policy);
+    }
+    return CoreScheduler(policy, 0, options.workers, options.opencv_threads, options.pin);
+}
+
+/* Csv cells of an area histogram */
+std::string formatBins(const AreaBins &bins) {
+
+    std::string cells;
+    for (auto& count : bins.bins) {
+        cells += std::to_string(count) + ",";
+    }
+    return cells;
+}
+
+/* Data row of a window, with the screening columns when screen is not NULL */
+std::string dataRow(std::string window_name, const WindowMetrics &metrics, 
+                        const SegmentationConfig &config, const WindowSignal *screen) {
+
+    std::ostringstream row_stream;
+    row_stream << window_name << "," 
+                << metrics.astrocyte_count + metrics.neuron_count << "," 
+                << metrics.astrocyte_count << "," << metrics.neuron_count << "," 
+                << metrics.mean_astrocyte_proximity << "," 
+                << metrics.stddev_astrocyte_proximity << "," 
+                << metrics.red_low.count + metrics.red_high.count << "," 
+                << metrics.red_low.count << "," << metrics.red_high.count << "," 
+                << formatBins(metrics.red_low) << formatBins(metrics.red_high) 
+                << metrics.green_red_high.count << "," << formatBins(metrics.green_red_high) 
+                << metrics.green_red_low.count << "," << formatBins(metrics.green_red_low) 
+                << metrics.green_high.count << "," << formatBins(metrics.green_high) 
+                << metrics.green_low.count << "," << formatBins(metrics.green_low);
+    if (config.sample_error > 0.0) {
+        row_stream << metrics.sampled_fraction << "," 
+                    << metrics.red_low.count_ci << "," << metrics.red_high.count_ci << "," 
+                    << metrics.green_red_high.count_ci << "," 
+                    << metrics.green_red_low.count_ci << ",";
+    }
+    if (screen) {
+        row_stream << screen->signal << "," << screen->focus << "," << screen->skipped << ",";
+    }
+    row_stream << std::endl;
+    return row_stream.str();
+}
+
+/* Zero counts and blank masks of a window skipped by the screening */
+void emptyWindow(const SegmentationConfig &config, cv::Size size, 
+                    WindowMetrics *metrics, WindowImages *images) {
+
+    AreaBins *bins[] = {&metrics->red_low, &metrics->red_high, 
+                        &metrics->green_red_high, &metrics->green_red_low, 
+                        &metrics->green_high, &metrics->green_low};
+    for (auto channel : bins) {
+        channel->bins.assign(config.synapse_area_bins, 0);
+    }
+    metrics->sampled_fraction = 0.0;
+    for (auto& name : windowMaskNames()) {
+        images->masks.push_back(std::make_pair(name, cv::Mat(cv::Mat::zeros(size, CV_8UC1))));
     }
 }
 
-/* Astrocytes-neurons separation metrics */
-void neuronAstroSepMetrics(std::vector<std::vector<cv::Point>> astrocyte_contours, 
-                                std::vector<std::vector<cv::Point>> neuron_contours,
-                                float *mean_astrocyte_proximity_cnt,
-                                float *stddev_astrocyte_proximity_cnt) {
+/* Screen the planes of a window as they were read */
+WindowSignal screenPlanes(const std::vector<cv::Mat> &planes, RunOptions options) {
 
-    // Calculate the mid point of all astrocytes
-    std::vector<cv::Point2f> mc_astrocyte(astrocyte_contours.size());
-    for (size_t i = 0; i < astrocyte_contours.size(); i++) {
-        cv::Moments mu = moments(astrocyte_contours[i], true);
-        mc_astrocyte[i] = cv::Point2f(static_cast<float>(mu.m10/mu.m00), 
-                                            static_cast<float>(mu.m01/mu.m00));
+    std::vector<LayerSignal> layers;
+    for (auto& plane : planes) {
+        layers.push_back(screenLayer(plane, options.bit_depth));
     }
+    return screenWindow(layers, options.screen_thresholds);
+}
 
-    // Calculate the mid point and diameter of all neurons
-    std::vector<cv::Point2f> mc_neuron(neuron_contours.size());
-    std::vector<float> neuron_diameter(neuron_contours.size());
-    for (size_t i = 0; i < neuron_contours.size(); i++) {
-        cv::Moments mu = moments(neuron_contours[i], true);
-        mc_neuron[i] = cv::Point2f(static_cast<float>(mu.m10/mu.m00), 
-                                            static_cast<float>(mu.m01/mu.m00));
-        cv::RotatedRect min_area_rect = minAreaRect(cv::Mat(neuron_contours[i]));
-        neuron_diameter[i] = (float) sqrt(pow(min_area_rect.size.width, 2) + 
-                                                pow(min_area_rect.size.height, 2));
+/* Analyze a window of consecutive z layers, write its rows and images.
+   A window skipped by the screening gets a zero count row and blank masks. */
+bool processWindow(const NeuronSegmenter &segmenter, std::vector<cv::Mat> original, 
+                    const WindowSignal *screen, unsigned int window_index, 
+                    std::string dir_name_modified, std::string out_directory, 
+                    std::ofstream *data_stream, 
+                    std::ofstream *neuron_stream, std::ofstream *coloc_stream, 
+                    MaskVolumeWriter *volume, WellAggregate *well) {
+
+    const SegmentationConfig &config = segmenter.config();
+    WindowMetrics metrics;
+    WindowImages images;
+    bool skipped = screen && screen->skipped;
+    if (skipped) {
+        emptyWindow(config, original[0].size(), &metrics, &images);
+    } else if (!segmenter.analyzeWindow(original, &metrics, &images)) {
+        return false;
+    }
+    std::string window_name = dir_name_modified + std::to_string(window_index);
+
+    std::string data_row = dataRow(window_name, metrics, config, screen);
+
+    // Per neuron synapse rows
+    std::ostringstream neuron_row_stream, coloc_row_stream;
+    for (size_t i = 0; i < metrics.neurons.size(); i++) {
+        const NeuronSynapses &neuron = metrics.neurons[i];
+        neuron_row_stream << window_name << "," << i << "," 
+                          << neuron.center.x << "," << neuron.center.y << "," 
+                          << neuron.red_low.count + neuron.red_high.count << "," 
+                          << neuron.red_low.count << "," << neuron.red_high.count << "," 
+                          << formatBins(neuron.red_low) << formatBins(neuron.red_high) 
+                          << std::endl;
     }
-    cv::Scalar mean_diameter, stddev_diameter;
-    cv::meanStdDev(neuron_diameter, mean_diameter, stddev_diameter);
 
-    // Compute the normal distribution parameters of astrocyte count per neuron
-    float neuron_roi = (NEURON_ROI_FACTOR * mean_diameter.val[0])/2;
-    std::vector<float> count(neuron_contours.size(), 0.0);
-    for (size_t i = 0; i < neuron_contours.size(); i++) {
-        for (size_t j = 0; j < astrocyte_contours.size(); j++) {
-            if (cv::norm(mc_neuron[i] - mc_astrocyte[j]) <= neuron_roi) {
-                count[i]++;
+    // Green overlap rows of the red objects
+    auto addOverlapRows = [&](std::string channel, const std::vector<ObjectOverlap> &overlaps) {
+        for (size_t i = 0; i < overlaps.size(); i++) {
+            const ObjectOverlap &overlap = overlaps[i];
+            coloc_row_stream << window_name << "," << channel << "," << i << "," 
+                             << overlap.center.x << "," << overlap.center.y << "," 
+                             << overlap.area << "," << overlap.green_objects << "," 
+                             << overlap.overlap_area << "," 
+                             << overlap.overlap_area/std::max(overlap.area, 1.0f) << "," 
+                             << overlap.green_object << std::endl;
+        }
+    };
+    addOverlapRows("red_low", metrics.red_low_overlaps);
+    addOverlapRows("red_high", metrics.red_high_overlaps);
+
+    // Append the rows in one piece, directories may be processed concurrently
+    {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        *data_stream << data_row << std::flush;
+        if (config.neuron_roi) *neuron_stream << neuron_row_stream.str() << std::flush;
+        if (config.colocalization) *coloc_stream << coloc_row_stream.str() << std::flush;
+    }
+
+    // The zero counts of a skipped window are not measurements of the well
+    if (well && !skipped) well->addWindow(window_index, metrics);
+
+    // Previews are written as small JPEGs instead of full size TIFFs
+    std::string out_ext = (config.scale > 1) ? "_preview.jpg" : ".tif";
+    std::vector<int> out_params;
+    if (config.scale > 1) {
+        out_params.push_back(cv::IMWRITE_JPEG_QUALITY);
+        out_params.push_back(80);
+    }
+    std::string out_prefix = out_directory + "z" + std::to_string(window_index) + "_";
+    for (auto& debug : images.debug) {
+        cv::imwrite(out_prefix + debug.first + ".tif", debug.second);
+    }
+    std::string window_layers = std::to_string(config.z_layers) + "layers";
+    if (!skipped) {
+        cv::imwrite(out_prefix + window_layers + "_processed" + out_ext, 
+                                                    images.processed, out_params);
+        cv::Mat original_image = images.original;
+        if ((config.scale > 1) && (original_image.depth() != CV_8U)) {
+            original_image.convertTo(original_image, CV_8U, 255.0/sampleMax(config.bit_depth));
+        }
+        cv::imwrite(out_prefix + window_layers + "_original" + out_ext, 
+                                                    original_image, out_params);
+    }
+
+    // Slice of the 3D mask volume
+    if (volume) {
+        std::vector<cv::Mat> slice;
+        for (auto& channel : volume->channels()) {
+            for (auto& mask : images.masks) {
+                if (mask.first == channel) slice.push_back(mask.second);
             }
         }
+        if (!volume->addSlice(window_index, slice)) {
+            std::cerr << "Could not write the mask volume slice" << std::endl;
+            return false;
+        }
     }
-    cv::Scalar mean, stddev;
-    cv::meanStdDev(count, mean, stddev);
-    *mean_astrocyte_proximity_cnt = static_cast<float>(mean.val[0]);
-    *stddev_astrocyte_proximity_cnt = static_cast<float>(stddev.val[0]);
+
+    stage_profiler.stageDone("write");
+    return true;
 }
 
-/* Group synapse area into bins */
-void binSynapseArea(std::vector<HierarchyType> contour_mask, 
-                    std::vector<double> contour_area, 
-                    std::string *contour_bins,
-                    unsigned int *contour_cnt) {
+/* 3D labelers of a directory, one per labeled channel */
+std::vector<StackLabeler> openStackLabelers(RunOptions options) {
 
-    std::vector<unsigned int> count(NUM_SYNAPSE_AREA_BINS, 0);
-    *contour_cnt = 0;
-    for (size_t i = 0; i < contour_mask.size(); i++) {
-        if (contour_mask[i] != HierarchyType::PARENT_CNTR) continue;
-        unsigned int area = static_cast<unsigned int>(round(contour_area[i]));
-        unsigned int bin_index = (area/SYNAPSE_BIN_AREA < NUM_SYNAPSE_AREA_BINS) ? 
-                                        area/SYNAPSE_BIN_AREA : NUM_SYNAPSE_AREA_BINS-1;
-        count[bin_index]++;
+    // The plane masks are labeled at the decoding scale, volumes are in full 
+    // resolution voxels
+    std::vector<StackLabeler> stacks;
+    for (auto& channel : options.stack_channels) {
+        stacks.push_back(StackLabeler(channel, options.stack_connectivity, 
+                                        NUM_SYNAPSE_AREA_BINS, 
+                                        options.preview_scale*options.preview_scale));
     }
+    return stacks;
+}
+
+/* Label the next z planes of the 3D objects. The masks of a window are a 
+   projection of its overlapping planes, so the masks of each plane are 
+   enhanced alone, for the labeled channels only. */
+bool labelPlanes(const NeuronSegmenter &segmenter, const std::vector<cv::Mat> &planes, 
+                    std::vector<StackLabeler> *stacks) {
 
-    for (size_t i = 0; i < count.size(); i++) {
-        *contour_cnt += count[i];
-        *contour_bins += std::to_string(count[i]) + ",";
+    if (stacks->empty()) return true;
+    std::vector<std::string> channels;
+    for (auto& stack : *stacks) {
+        channels.push_back(stack.channel());
+    }
+    for (auto& plane : planes) {
+        std::vector<cv::Mat> masks;
+        if (!segmenter.planeMasks(plane, channels, &masks)) return false;
+        for (size_t i = 0; i < stacks->size(); i++) {
+            if (!(*stacks)[i].addSlice(masks[i])) return false;
+        }
     }
+    return true;
 }
 
-/* Process the images inside each directory */
-bool processDir(std::string dir_name, std::string out_file) {
-
-    /* Create the data output file for images that were processed */
-    std::ofstream data_stream;
-    data_stream.open(out_file, std::ios::app);
-    if (!data_stream.is_open()) {
-        std::cerr << "Could not open the data output file." << std::endl;
-        return false;
+/* 3D labeling check - objects of known shape are labeled slice by slice 
+   with both connectivities, and the objects of the masks of a synthetic 
+   plane between blank planes must span one plane */
+bool stackLabelCheck(RunOptions options, std::ostream &out) {
+
+    // Squares in each slice, given as x, y, side triples
+    struct StackCase {
+        std::string name;
+        std::vector<std::vector<int>> slices;
+        unsigned int count[2]; // Objects expected with 6 and 26 connectivity
+        unsigned int extent[2]; // Slices spanned by the longest object
+    };
+    std::vector<StackCase> cases = {
+        {"span", {{8, 8, 10}, {8, 8, 10}, {10, 10, 10}, {12, 12, 10}}, {1, 1}, {4, 4}},
+        {"merge", {{4, 4, 8, 30, 4, 8}, {4, 4, 8, 30, 4, 8}, {4, 4, 34}}, {1, 1}, {3, 3}},
+        {"split", {{4, 4, 34}, {4, 4, 8, 30, 4, 8}, {30, 4, 8}}, {1, 1}, {3, 3}},
+        {"diagonal", {{4, 4, 8}, {12, 12, 8}}, {2, 1}, {1, 2}},
+        {"apart", {{4, 4, 8}, {}, {4, 4, 8}}, {2, 2}, {1, 1}}};
+    bool pass = true;
+    for (auto& stack_case : cases) {
+        for (int connectivity : {6, 26}) {
+            StackLabeler stack(stack_case.name, connectivity, NUM_SYNAPSE_AREA_BINS);
+            for (auto& squares : stack_case.slices) {
+                cv::Mat slice = cv::Mat::zeros(48, 48, CV_8UC1);
+                for (size_t i = 0; i + 2 < squares.size(); i += 3) {
+                    slice(cv::Rect(squares[i], squares[i+1], squares[i+2], 
+                                    squares[i+2])).setTo(255);
+                }
+                stack.addSlice(slice);
+            }
+            const StackObjectBins &bins = stack.finish();
+            unsigned int extent = 0;
+            for (unsigned int i = 0; i < bins.z_extent_bins.size(); i++) {
+                if (bins.z_extent_bins[i]) extent = i + 1;
+            }
+            int expected = (connectivity == 6) ? 0 : 1;
+            bool case_pass = (bins.count == stack_case.count[expected]) && 
+                                (extent == stack_case.extent[expected]);
+            out << "3D " << stack_case.name << " " << connectivity << "-connected: " 
+                << bins.count << " objects spanning up to " << extent << " planes" 
+                << (case_pass ? "" : " - FAILED") << std::endl;
+            pass = pass && case_pass;
+        }
     }
 
-    // Create a alternative directory name for the data collection
-    // Replace '/' and ' ' with '_'
-    std::string dir_name_modified = dir_name;
-    std::size_t found = dir_name_modified.find("/");
-    dir_name_modified.replace(found, 1, "_");
-    found = dir_name_modified.find("/");
-    dir_name_modified.replace(found, 1, "_");
-    found = dir_name_modified.find(" ");
-    dir_name_modified.replace(found, 1, "_");
-
-    DIR *read_dir = opendir(dir_name.c_str());
-    if (!read_dir) {
-        std::cerr << "Could not open directory '" << dir_name << "'" << std::endl;
-        return false;
+    // The masks of a plane alone, with the labeled channels
+    if (options.stack_channels.empty()) options.stack_channels.push_back("blue");
+    std::vector<cv::Mat> planes = EquivalenceCheck::syntheticWindow(
+                                cv::Size(1024/options.preview_scale, 1024/options.preview_scale), 
+                                1, 1);
+    widenPlanes(options.bit_depth, &planes);
+    cv::Mat blank = cv::Mat::zeros(planes[0].size(), planes[0].type());
+    planes = {blank, planes[0], blank};
+
+    NeuronSegmenter segmenter(segmentationConfig(options));
+    std::vector<StackLabeler> stacks = openStackLabelers(options);
+    if (!labelPlanes(segmenter, planes, &stacks)) return false;
+    for (auto& stack : stacks) {
+        const StackObjectBins &bins = stack.finish();
+        bool case_pass = (bins.z_extent_bins[0] == bins.count);
+        out << "3D " << stack.channel() << ": " << bins.count << " objects, " 
+            << bins.z_extent_bins[0] << " with a z extent of 1 plane" 
+            << (case_pass ? "" : " - FAILED") << std::endl;
+        pass = pass && case_pass;
     }
+    return pass;
+}
 
-    // Count the number of images
-    uint8_t z_count = 0;
-    struct dirent *dir = NULL;
-    while ((dir = readdir(read_dir))) {
-        if (!strcmp (dir->d_name, ".") || !strcmp (dir->d_name, "..")) {
-            continue;
+/* Close the 3D objects of a directory and append a row per channel */
+bool writeStackRows(std::string dir_name_modified, std::string out_file, 
+                        std::vector<StackLabeler> *stacks) {
+
+    if (stacks->empty()) return true;
+    std::ostringstream row_stream;
+    for (auto& stack : *stacks) {
+        const StackObjectBins &bins = stack.finish();
+        row_stream << dir_name_modified << "," << stack.channel() << "," << bins.count << ",";
+        for (auto& count : bins.volume_bins) {
+            row_stream << count << ",";
+        }
+        for (auto& count : bins.z_extent_bins) {
+            row_stream << count << ",";
         }
-        z_count++;
+        row_stream << std::endl;
     }
-    closedir(read_dir);
 
-    if (z_count < NUM_Z_LAYERS) {
-        std::cerr << "Not enough z layers in the image." << std::endl;
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::ofstream stack_stream(stackBinsFilename(out_file), std::ios::app);
+    if (!stack_stream.is_open()) {
+        std::cerr << "Could not open the 3D object output file." << std::endl;
         return false;
     }
+    stack_stream << row_stream.str();
+    return true;
+}
+
+/* 3D mask volume of a directory, NULL when no channel is exported */
+std::unique_ptr<MaskVolumeWriter> openMaskVolume(RunOptions options, 
+                                        std::string out_directory, std::string token) {
+
+    std::unique_ptr<MaskVolumeWriter> volume;
+    if (options.volume_channels.empty()) return volume;
+    volume.reset(new MaskVolumeWriter(options.volume_channels, options.volume_downsample, 
+                    options.volume_mesh ? options.volume_channels[0] : ""));
+    if (!volume->open(out_directory + token + "_masks.nsv")) {
+        volume.reset();
+    }
+    return volume;
+}
+
+/* Finish the 3D mask volume of a directory and write its mesh */
+bool closeMaskVolume(MaskVolumeWriter *volume, std::string out_directory, std::string token) {
+
+    if (!volume) return true;
+    return volume->close(out_directory + token + "_" + volume->channels()[0] + ".ply");
+}
+
+/* Estimated peak memory of a directory, in bytes, from the frame size */
+size_t windowFootprint(cv::Size frame_size, size_t sample_size) {
+
+    // Color ring buffer and the merged channel windows at the sample size, 
+    // plus the 8-bit single channel masks and the two color overlays
+    size_t pixel_bytes = sample_size*(3*NUM_Z_LAYERS + 3*NUM_Z_LAYERS) + 
+                                                WINDOW_INTERMEDIATES + 2*3;
+    return (size_t) frame_size.area() * pixel_bytes;
+}
+
+/* Estimated peak memory of a directory, from the plane size of its stack */
+size_t stackFootprint(const StackEntry &stack, RunOptions options) {
+
+    cv::Size decoded(stack.size.width/options.preview_scale, 
+                        stack.size.height/options.preview_scale);
+    return windowFootprint(decoded, (options.bit_depth > 8) ? 2 : 1);
+}
+
+/* Estimated peak memory of a parameter sweep over a directory. The planes
+   of the largest window are kept, each window size caches its channel
+   windows and every grid point may add its own masks, floors and contours
+   to the cache of its window size. */
+size_t sweepFootprint(const StackEntry &stack, RunOptions options, 
+                        const std::vector<NeuronSegmenter> &segmenters) {
+
+    size_t sample_size = (options.bit_depth > 8) ? 2 : 1;
+    unsigned int max_layers = 0;
+    std::set<unsigned int> window_sizes;
+    for (auto& segmenter : segmenters) {
+        max_layers = std::max(max_layers, segmenter.config().z_layers);
+        window_sizes.insert(segmenter.config().z_layers);
+    }
+
+    // Recent planes, then the merged channel windows and grayscale windows
+    size_t pixel_bytes = sample_size*3*max_layers;
+    for (auto layers : window_sizes) {
+        pixel_bytes += sample_size*3*(layers + 1);
+    }
+    pixel_bytes += segmenters.size()*(SWEEP_POINT_MASK_BYTES + 
+                                        sample_size*SWEEP_POINT_FLOORS + 
+                                        SWEEP_POINT_CONTOURS*CONTOUR_STORE_BYTES);
+
+    // Plus the uncached intermediates of the window being analyzed
+    cv::Size decoded(stack.size.width/options.preview_scale, 
+                        stack.size.height/options.preview_scale);
+    return (size_t) decoded.area()*pixel_bytes + stackFootprint(stack, options);
+}
+
+/* Image name prefix of a directory, its second path component */
+std::string dirToken(std::string dir_name) {
 
-    // Extract the input directory name
-    std::istringstream iss(dir_name);
     std::string token;
+    std::istringstream iss(dir_name);
     getline(iss, token, '/');
     getline(iss, token, '/');
+    return token;
+}
+
+/* Output names of an image directory, the output directory is created */
+void dirOutputNames(std::string dir_name, std::string *dir_name_modified, 
+                        std::string *token, std::string *out_directory) {
+
+    // Create a alternative directory name for the data collection
+    // Replace '/' and ' ' with '_'
+    *dir_name_modified = dir_name;
+    std::size_t found = dir_name_modified->find("/");
+    if (found != std::string::npos) dir_name_modified->replace(found, 1, "_");
+    found = dir_name_modified->find("/");
+    if (found != std::string::npos) dir_name_modified->replace(found, 1, "_");
+    found = dir_name_modified->find(" ");
+    if (found != std::string::npos) dir_name_modified->replace(found, 1, "_");
+
+    // Extract the input directory name
+    *token = dirToken(dir_name);
 
     // Create the output directory
-    std::string out_directory = "result/" + token + "/";
+    *out_directory = "result/" + *token + "/";
     struct stat st = {0};
-    if (stat(out_directory.c_str(), &st) == -1) {
-        mkdir(out_directory.c_str(), 0700);
+    if (stat(out_directory->c_str(), &st) == -1) {
+        mkdir(out_directory->c_str(), 0700);
     }
+}
 
-    std::vector<cv::Mat> blue(NUM_Z_LAYERS), green(NUM_Z_LAYERS), 
-                                red(NUM_Z_LAYERS), original(NUM_Z_LAYERS);
-    for (uint8_t z_index = 1; z_index <= z_count; z_index++) {
+/* Z planes of a directory, from the manifest or scanned now */
+bool stackPlanes(std::string dir_name, RunOptions options, const StackEntry *indexed, 
+                    StackEntry *stack) {
 
-        // Create the input filename and rgb stream output filenames
-        std::string in_filename;
-        if (z_count < 10) {
-            in_filename  = dir_name + token + "_z" + std::to_string(z_index) + "c1+2+3.tif";
-        } else {
-            if (z_index < 10) {
-                in_filename  = dir_name + token + "_z0" + std::to_string(z_index) + "c1+2+3.tif";
-            } else if (z_index < 100) {
-                in_filename  = dir_name + token + "_z" + std::to_string(z_index) + "c1+2+3.tif";
-            } else { // assuming number of z plane layers will never exceed 99
-                std::cerr << "Does not support more than 99 z layers curently" << std::endl;
-                return false;
-            }
+    if (indexed) {
+        *stack = *indexed;
+    } else {
+        DatasetManifest::scanStack(dir_name, options.layer_pattern, stack);
+    }
+    if (!stack->error.empty()) {
+        std::cerr << stack->error << std::endl;
+        return false;
+    }
+    if (stack->planes.size() < NUM_Z_LAYERS) {
+        std::cerr << "Not enough z layers in '" << dir_name << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+/* Process the images inside each directory */
+bool processDir(std::string dir_name, std::string out_file, RunOptions options, 
+                    const StackEntry *indexed = NULL) {
+
+    /* Create the data output file for images that were processed */
+    std::ofstream data_stream;
+    data_stream.open(out_file, std::ios::app);
+    if (!data_stream.is_open()) {
+        std::cerr << "Could not open the data output file." << std::endl;
+        return false;
+    }
+    std::ofstream neuron_stream;
+    if (options.neuron_roi) {
+        neuron_stream.open(neuronBinsFilename(out_file), std::ios::app);
+        if (!neuron_stream.is_open()) {
+            std::cerr << "Could not open the neuron data output file." << std::endl;
+            return false;
+        }
+    }
+    std::ofstream coloc_stream;
+    if (options.colocalization) {
+        coloc_stream.open(colocalizationFilename(out_file), std::ios::app);
+        if (!coloc_stream.is_open()) {
+            std::cerr << "Could not open the colocalization output file." << std::endl;
+            return false;
         }
+    }
+
+    // Planes of the stack, checked before any of them is decoded
+    StackEntry stack;
+    if (!stackPlanes(dir_name, options, indexed, &stack)) return false;
+    int z_count = (int) stack.planes.size();
+
+    // Wait for room in the memory budget before the first plane is decoded
+    MemoryReservation reservation(&memory_governor, stackFootprint(stack, options));
+
+    // Output names and directory
+    std::string dir_name_modified, token, out_directory;
+    dirOutputNames(dir_name, &dir_name_modified, &token, &out_directory);
+    std::unique_ptr<MaskVolumeWriter> volume = openMaskVolume(options, out_directory, token);
+    if (!options.volume_channels.empty() && !volume) return false;
+
+    std::vector<StackLabeler> stacks = openStackLabelers(options);
+    WellAggregate well;
+
+    NeuronSegmenter segmenter = runSegmenter(options);
+    stage_profiler.start();
+    std::vector<cv::Mat> original(NUM_Z_LAYERS);
+    std::vector<LayerSignal> signals(NUM_Z_LAYERS);
+    unsigned int skipped_windows = 0;
+    for (int z_index = 1; z_index <= z_count; z_index++) {
+
+        // Create the input filename and rgb stream output filenames
+        std::string in_filename = stack.baseName(z_index-1);
 
         // Extract the bgr streams for each input image
-        cv::Mat img = cv::imread(in_filename.c_str());
+        cv::Mat img = readLayer(in_filename, options.preview_scale, options.bit_depth);
         if (img.empty()) {
             std::cerr << "Invalid input filename" << std::endl;
             return false;
         }
-        original[(z_index-1)%NUM_Z_LAYERS] = img;
+        memory_governor.sampleStage("read");
+        stage_profiler.stageDone("read");
+        if (!labelPlanes(segmenter, {img}, &stacks)) return false;
 
-        std::vector<cv::Mat> channel(3);
-        cv::split(img, channel);
+        original[(z_index-1)%NUM_Z_LAYERS] = img;
 
-        blue[(z_index-1)%NUM_Z_LAYERS] = channel[0];
-        green[(z_index-1)%NUM_Z_LAYERS] = channel[1];
-        red[(z_index-1)%NUM_Z_LAYERS] = channel[2];
+        // Histogram and focus of the layer, kept with it in the ring buffer
+        if (options.screen) {
+            signals[(z_index-1)%NUM_Z_LAYERS] = screenLayer(img, options.bit_depth);
+        }
 
         // Manipulate RGB channels and extract features for a certain number of Z layers
         if (z_index >= NUM_Z_LAYERS) {
-
-            /* Gather RGB channel information needed for feature extraction */
-
-            // Blue channel
-            cv::Mat blue_merge, blue_enhanced, blue_segmented;
-            std::vector<std::vector<cv::Point>> contours_blue;
-            std::vector<cv::Vec4i> hierarchy_blue;
-            std::vector<HierarchyType> blue_contour_mask;
-            std::vector<double> blue_contour_area;
-
-            cv::merge(blue, blue_merge);
-            std::string out_blue = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_blue_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_blue.c_str(), blue_merge);
-            if(!enhanceImage(blue_merge, ChannelType::BLUE, &blue_enhanced)) {
-                return false;
+            WindowSignal screen;
+            if (options.screen) {
+                screen = screenWindow(signals, options.screen_thresholds);
+                if (screen.skipped) skipped_windows++;
             }
-            out_blue.insert(out_blue.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_blue.c_str(), blue_enhanced);
-            contourCalc(blue_enhanced, ChannelType::BLUE, 100.0, &blue_segmented, 
-                            &contours_blue, &hierarchy_blue, &blue_contour_mask, 
-                            &blue_contour_area);
-            out_blue.insert(out_blue.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_blue.c_str(), blue_segmented);
-
-            // Green channel
-            cv::Mat green_merge, green_enhanced;
-            cv::merge(green, green_merge);
-            std::string out_green = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_green_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_green.c_str(), green_merge);
-            if(!enhanceImage(green_merge, ChannelType::GREEN_COMBINED, &green_enhanced)) {
+            if (!processWindow(segmenter, original, options.screen ? &screen : NULL, 
+                                z_index-NUM_Z_LAYERS+1, 
+                                dir_name_modified, out_directory, 
+                                &data_stream, &neuron_stream, &coloc_stream, 
+                                volume.get(), 
+                                options.aggregate.empty() ? NULL : &well)) {
                 return false;
             }
-            out_green.insert(out_green.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_green.c_str(), green_enhanced);
+        }
+    }
+    data_stream.close();
+    if (options.neuron_roi) neuron_stream.close();
+    if (options.colocalization) coloc_stream.close();
+    if (options.screen && (z_count >= NUM_Z_LAYERS)) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << dir_name << ": " << skipped_windows << " of " 
+                  << z_count-NUM_Z_LAYERS+1 << " windows skipped" << std::endl;
+    }
+    if (!writeStackRows(dir_name_modified, out_file, &stacks)) return false;
+    if (!options.aggregate.empty()) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        plate_aggregate.addWell(token, well);
+    }
+    return closeMaskVolume(volume.get(), out_directory, token);
+}
 
-            // Axon boundary mask
-            cv::Mat axon_enhanced;
-            if(!enhanceImage(green_merge, ChannelType::ENHANCE_AXON, &axon_enhanced)) {
-                return false;
-            }
-            std::string out_axon = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_axon_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_axon.c_str(), axon_enhanced);
-
-            // Green channel - Low intensity
-            cv::Mat green_low_enhanced, green_low_segmented;
-            std::vector<std::vector<cv::Point>> contours_green_low;
-            std::vector<cv::Vec4i> hierarchy_green_low;
-            std::vector<HierarchyType> green_low_contour_mask;
-            std::vector<double> green_low_contour_area;
-            if(!enhanceImage(green_merge, ChannelType::GREEN_LOW, &green_low_enhanced)) {
-                return false;
-            }
-            std::string out_green_low = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_green_low_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            out_green_low.insert(out_green_low.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_green_low.c_str(), green_low_enhanced);
-            contourCalc(green_low_enhanced, ChannelType::GREEN_LOW, 1.0, &green_low_segmented, 
-                            &contours_green_low, &hierarchy_green_low, &green_low_contour_mask, 
-                            &green_low_contour_area);
-            out_green_low.insert(out_green_low.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_green_low.c_str(), green_low_segmented);
-
-            // Green channel - High intensity
-            cv::Mat green_high_enhanced, green_high_segmented;
-            std::vector<std::vector<cv::Point>> contours_green_high;
-            std::vector<cv::Vec4i> hierarchy_green_high;
-            std::vector<HierarchyType> green_high_contour_mask;
-            std::vector<double> green_high_contour_area;
-            if(!enhanceImage(green_merge, ChannelType::GREEN_HIGH, &green_high_enhanced)) {
-                return false;
-            }
-            std::string out_green_high = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_green_high_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            out_green_high.insert(out_green_high.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_green_high.c_str(), green_high_enhanced);
-            contourCalc(green_high_enhanced, ChannelType::GREEN_HIGH, 1.0, &green_high_segmented, 
-                            &contours_green_high, &hierarchy_green_high, &green_high_contour_mask, 
-                            &green_high_contour_area);
-            out_green_high.insert(out_green_high.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_green_high.c_str(), green_high_segmented);
-
-            // Red channel
-            cv::Mat red_merge;
-            cv::merge(red, red_merge);
-            std::string out_red = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_red_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_red.c_str(), red_merge);
-
-            // Red channel - Lower intensity
-            cv::Mat red_low_enhanced, red_low_segmented;
-            std::vector<std::vector<cv::Point>> contours_red_low;
-            std::vector<cv::Vec4i> hierarchy_red_low;
-            std::vector<HierarchyType> red_low_contour_mask;
-            std::vector<double> red_low_contour_area;
-
-            std::string out_red_low = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_red_low_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if(!enhanceImage(red_merge, ChannelType::RED_LOW, &red_low_enhanced)) {
-                return false;
+/* Analyze the windows of a directory at every point of the parameter grid.
+   Each plane is decoded once, and the grid points share the intermediates
+   of a window through one cache per window size. */
+bool sweepDir(std::string dir_name, RunOptions options, const StackEntry *indexed, 
+                std::vector<std::unique_ptr<std::ofstream>> *streams) {
+
+    StackEntry stack;
+    if (!stackPlanes(dir_name, options, indexed, &stack)) return false;
+    int z_count = (int) stack.planes.size();
+    std::string dir_name_modified, token, out_directory;
+    dirOutputNames(dir_name, &dir_name_modified, &token, &out_directory);
+
+    std::vector<NeuronSegmenter> segmenters;
+    unsigned int max_layers = 0;
+    for (size_t i = 0; i < options.sweep.size(); i++) {
+        segmenters.push_back(runSegmenter(options, &options.sweep, i));
+        max_layers = std::max(max_layers, segmenters.back().config().z_layers);
+    }
+
+    // The windows and their caches of intermediates of every window size
+    MemoryReservation reservation(&memory_governor, 
+                                    sweepFootprint(stack, options, segmenters));
+
+    std::vector<cv::Mat> recent; // Last max_layers planes, oldest first
+    unsigned int reused = 0, computed = 0;
+    for (int z_index = 1; z_index <= z_count; z_index++) {
+        cv::Mat img = readLayer(stack.baseName(z_index-1), options.preview_scale, 
+                                                            options.bit_depth);
+        if (img.empty()) {
+            std::cerr << "Invalid input filename" << std::endl;
+            return false;
+        }
+        recent.push_back(img);
+        if (recent.size() > max_layers) recent.erase(recent.begin());
+
+        // Windows ending at this plane, in ring buffer order
+        std::map<unsigned int, std::unique_ptr<WindowCache>> caches;
+        std::vector<std::string> rows(segmenters.size());
+        for (size_t i = 0; i < segmenters.size(); i++) {
+            unsigned int layers = segmenters[i].config().z_layers;
+            if (z_index < (int)layers) continue;
+            std::vector<cv::Mat> window(layers);
+            for (unsigned int back = 0; back < layers; back++) {
+                window[(z_index-1-back)%layers] = recent[recent.size()-1-back];
             }
-            out_red_low.insert(out_red_low.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_red_low.c_str(), red_low_enhanced);
-            contourCalc(red_low_enhanced, ChannelType::RED_LOW, 1.0, &red_low_segmented, 
-                            &contours_red_low, &hierarchy_red_low, &red_low_contour_mask, 
-                            &red_low_contour_area);
-            out_red_low.insert(out_red_low.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_red_low.c_str(), red_low_segmented);
-
-            // Red channel - High intensity
-            cv::Mat red_high_enhanced, red_high_segmented;
-            std::vector<std::vector<cv::Point>> contours_red_high;
-            std::vector<cv::Vec4i> hierarchy_red_high;
-            std::vector<HierarchyType> red_high_contour_mask;
-            std::vector<double> red_high_contour_area;
-
-            std::string out_red_high = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_red_high_" + std::to_string(NUM_Z_LAYERS) + "layers.tif";
-            if(!enhanceImage(red_merge, ChannelType::RED_HIGH, &red_high_enhanced)) {
+            if (!caches[layers]) caches[layers].reset(new WindowCache());
+
+            WindowMetrics metrics;
+            if (!segmenters[i].analyzeWindow(window, &metrics, NULL, caches[layers].get())) {
                 return false;
             }
-            out_red_high.insert(out_red_high.find_first_of("."), "_enhanced", 9);
-            if (DEBUG_FLAG) cv::imwrite(out_red_high.c_str(), red_high_enhanced);
-            contourCalc(red_high_enhanced, ChannelType::RED_HIGH, 1.0, &red_high_segmented, 
-                            &contours_red_high, &hierarchy_red_high, &red_high_contour_mask, 
-                            &red_high_contour_area);
-            out_red_high.insert(out_red_high.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_red_high.c_str(), red_high_segmented);
-
-            // Draw the red high-low regions after categorization
-            cv::Mat drawing_red = cv::Mat::zeros(red_low_enhanced.size(), CV_8UC1);
-            for (size_t i = 0; i < contours_red_high.size(); i++) {
-                drawContours(drawing_red, contours_red_high, (int)i, 255, 
-                                cv::FILLED, cv::LINE_8, hierarchy_red_high);
-            }
-            for (size_t i = 0; i < contours_red_low.size(); i++) {
-                drawContours(drawing_red, contours_red_low, (int)i, 100, 
-                                cv::FILLED, cv::LINE_8, hierarchy_red_low);
-            }
-            std::string out_red_final = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_" + std::to_string(NUM_Z_LAYERS) + "layers_red.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_red_final.c_str(), drawing_red);
-
-
-            /** Extract multi-dimensional features for analysis **/
-
-            // Blue-green channel intersection
-            cv::Mat blue_green_intersection;
-            bitwise_and(blue_enhanced, green_enhanced, blue_green_intersection);
-            out_green.insert(out_green.find_first_of("."), "_blue_intersection", 18);
-            if (DEBUG_FLAG) cv::imwrite(out_green.c_str(), blue_green_intersection);
-
-            // Classify astrocytes and neurons
-            std::vector<std::vector<cv::Point>> astrocyte_contours, neuron_contours;
-            classifyNeuronsAndAstrocytes(contours_blue, blue_contour_mask, blue_green_intersection, 
-                                                &astrocyte_contours, &neuron_contours);
-            data_stream << dir_name_modified << std::to_string(z_index-NUM_Z_LAYERS+1) << "," 
-                        << astrocyte_contours.size() + neuron_contours.size() << "," 
-                        << astrocyte_contours.size() << "," << neuron_contours.size() << ",";
-
-            // Draw the categorized cells
-            cv::Mat drawing_blue = cv::Mat::zeros(blue_enhanced.size(), CV_8UC1);
-            for (size_t i = 0; i < neuron_contours.size(); i++) {
-                drawContours(drawing_blue, neuron_contours, (int)i, 255, cv::FILLED, 
-                                cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
-            }
-            for (size_t i = 0; i < astrocyte_contours.size(); i++) {
-                drawContours(drawing_blue, astrocyte_contours, (int)i, 100, cv::FILLED, 
-                                cv::LINE_8, std::vector<cv::Vec4i>(), 0, cv::Point());
-            }
-            std::string out_blue_final = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_" + std::to_string(NUM_Z_LAYERS) + "layers_cells.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_blue_final.c_str(), drawing_blue);
-
-            // Calculate metrics for astrocytes-neurons separation
-            float mean_astrocyte_proximity_cnt = 0.0, stddev_astrocyte_proximity_cnt = 0.0;
-            neuronAstroSepMetrics(astrocyte_contours, neuron_contours, 
-                                    &mean_astrocyte_proximity_cnt, 
-                                    &stddev_astrocyte_proximity_cnt);
-            data_stream << mean_astrocyte_proximity_cnt << "," 
-                        << stddev_astrocyte_proximity_cnt << ",";
-
-            // Classify synapses
-            std::string red_low_synapse_bins, red_high_synapse_bins;
-            unsigned int red_low_contour_cnt, red_high_contour_cnt;
-            binSynapseArea(red_low_contour_mask, red_low_contour_area, 
-                                &red_low_synapse_bins, &red_low_contour_cnt);
-            binSynapseArea(red_high_contour_mask, red_high_contour_area, 
-                                &red_high_synapse_bins, &red_high_contour_cnt);
-            data_stream << red_low_contour_cnt + red_high_contour_cnt << "," 
-                        << red_low_contour_cnt << "," << red_high_contour_cnt << "," 
-                        << red_low_synapse_bins << red_high_synapse_bins;
-
-            // Green-red high channel intersection
-            cv::Mat green_red_high_intersection;
-            std::string out_green_red_high;
-            out_green_red_high.assign(out_green);
-            bitwise_and(green_enhanced, red_high_enhanced, green_red_high_intersection);
-            out_green_red_high.replace(out_green_red_high.find("blue"), 4, "red_high");
-            if (DEBUG_FLAG) cv::imwrite(out_green_red_high.c_str(), green_red_high_intersection);
-
-            // Calculate metrics for green-red high common regions
-            cv::Mat green_red_high_segmented;
-            std::vector<std::vector<cv::Point>> contours_green_red_high;
-            std::vector<cv::Vec4i> hierarchy_green_red_high;
-            std::vector<HierarchyType> green_red_high_contour_mask;
-            std::vector<double> green_red_high_contour_area;
-            contourCalc(green_red_high_intersection, ChannelType::RED_HIGH, 1.0, 
-                            &green_red_high_segmented, &contours_green_red_high, 
-                            &hierarchy_green_red_high, &green_red_high_contour_mask, 
-                            &green_red_high_contour_area);
-            out_green_red_high.insert(out_green_red_high.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_green_red_high.c_str(), green_red_high_segmented);
-
-            std::string green_red_high_intersection_bins;
-            unsigned int green_red_high_contour_cnt;
-            binSynapseArea(green_red_high_contour_mask, green_red_high_contour_area, 
-                                &green_red_high_intersection_bins, &green_red_high_contour_cnt);
-            data_stream << green_red_high_contour_cnt << "," << green_red_high_intersection_bins;
-
-            // Green-red low channel intersection
-            cv::Mat green_red_low_intersection;
-            std::string out_green_red_low;
-            out_green_red_low.assign(out_green);
-            bitwise_and(green_enhanced, red_low_enhanced, green_red_low_intersection);
-            out_green_red_low.replace(out_green_red_low.find("blue"), 4, "red_low");
-            if (DEBUG_FLAG) cv::imwrite(out_green_red_low.c_str(), green_red_low_intersection);
-
-            // Calculate metrics for green-red low common regions
-            cv::Mat green_red_low_segmented;
-            std::vector<std::vector<cv::Point>> contours_green_red_low;
-            std::vector<cv::Vec4i> hierarchy_green_red_low;
-            std::vector<HierarchyType> green_red_low_contour_mask;
-            std::vector<double> green_red_low_contour_area;
-            contourCalc(green_red_low_intersection, ChannelType::RED_LOW, 1.0, 
-                            &green_red_low_segmented, &contours_green_red_low, 
-                            &hierarchy_green_red_low, &green_red_low_contour_mask, 
-                            &green_red_low_contour_area);
-            out_green_red_low.insert(out_green_red_low.find_first_of("."), "_segmented", 10);
-            if (DEBUG_FLAG) cv::imwrite(out_green_red_low.c_str(), green_red_low_segmented);
-
-            std::string green_red_low_intersection_bins;
-            unsigned int green_red_low_contour_cnt;
-            binSynapseArea(green_red_low_contour_mask, green_red_low_contour_area, 
-                                &green_red_low_intersection_bins, &green_red_low_contour_cnt);
-            data_stream << green_red_low_contour_cnt << "," << green_red_low_intersection_bins;
-
-            // Draw the green-red intersection areas after categorization
-            cv::Mat drawing_green_red = cv::Mat::zeros(green_enhanced.size(), CV_8UC1);
-            for (size_t i = 0; i < contours_green_red_high.size(); i++) {
-                drawContours(drawing_green_red, contours_green_red_high, (int)i, 255, 
-                                cv::FILLED, cv::LINE_8, hierarchy_green_red_high);
-            }
-            for (size_t i = 0; i < contours_green_red_low.size(); i++) {
-                drawContours(drawing_green_red, contours_green_red_low, (int)i, 100, 
-                                cv::FILLED, cv::LINE_8, hierarchy_green_red_low);
-            }
-            std::string out_green_red_final = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_" + std::to_string(NUM_Z_LAYERS) + "layers_green_red.tif";
-            if (DEBUG_FLAG) cv::imwrite(out_green_red_final.c_str(), drawing_green_red);
-
-            // Calculate the metrics for green regions
-            std::string green_high_bins, green_low_bins;
-            unsigned int green_high_contour_cnt, green_low_contour_cnt;
-
-            binSynapseArea(green_high_contour_mask, green_high_contour_area, 
-                                    &green_high_bins, &green_high_contour_cnt);
-            data_stream << green_high_contour_cnt << "," << green_high_bins;
-
-            binSynapseArea(green_low_contour_mask, green_low_contour_area, 
-                                    &green_low_bins, &green_low_contour_cnt);
-            data_stream << green_low_contour_cnt << "," << green_low_bins;
-
-            cv::Mat drawing_green = cv::Mat::zeros(green_high_enhanced.size(), CV_8UC1);
-            for (size_t i = 0; i < contours_green_high.size(); i++) {
-                drawContours(drawing_green, contours_green_high, (int)i, 255, 
-                                    cv::FILLED, cv::LINE_8, hierarchy_green_high);
-            }
-            for (size_t i = 0; i < contours_green_low.size(); i++) {
-                drawContours(drawing_green, contours_green_low, (int)i, 255, 
-                                    cv::FILLED, cv::LINE_8, hierarchy_green_low);
-            }
-            data_stream << std::endl;
-
-            /** Analyzed image - blue, green-red intersection (high and low) and red (high and low) **/
-
-            // Draw neuron boundaries
-            for (size_t i = 0; i < neuron_contours.size(); i++) {
-                cv::RotatedRect min_ellipse = fitEllipse(cv::Mat(neuron_contours[i]));
-                ellipse(drawing_blue, min_ellipse, 0, 4, 8);
-                ellipse(drawing_green, min_ellipse, 0, 4, 8);
-                ellipse(drawing_red, min_ellipse, 255, 4, 8);
-            }
-
-            // Draw astrocyte boundaries
-            for (size_t i = 0; i < astrocyte_contours.size(); i++) {
-                cv::RotatedRect min_ellipse = fitEllipse(cv::Mat(astrocyte_contours[i]));
-                ellipse(drawing_blue, min_ellipse, 0, 4, 8);
-                ellipse(drawing_green, min_ellipse, 255, 4, 8);
-                ellipse(drawing_red, min_ellipse, 0, 4, 8);
-            }
-
-            // Draw upper layer axon boundaries
-            for (size_t i = 0; i < contours_green_high.size(); i++) {
-                drawContours(drawing_blue, contours_green_high, (int)i, 255, 
-                                    2, cv::LINE_8, hierarchy_green_high);
-                drawContours(drawing_green, contours_green_high, (int)i, 0, 
-                                    2, cv::LINE_8, hierarchy_green_high);
-                drawContours(drawing_red, contours_green_high, (int)i, 128, 
-                                    2, cv::LINE_8, hierarchy_green_high);
-            }
-
-            // Merge the modified red, blue and green layers
-            std::vector<cv::Mat> merge_analysis;
-            merge_analysis.push_back(drawing_blue);
-            merge_analysis.push_back(drawing_green);
-            merge_analysis.push_back(drawing_red);
-            cv::Mat color_analysis;
-            cv::merge(merge_analysis, color_analysis);
-            std::string out_processed = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_" + std::to_string(NUM_Z_LAYERS) + "layers_processed.tif";
-            cv::imwrite(out_processed.c_str(), color_analysis);
-
-            // Original image - blue, green and red
-            cv::Mat color_original = original[0];
-            for (unsigned int i = 1; i < NUM_Z_LAYERS; i++) {
-                double beta = 1.0/(i+1);
-                addWeighted(color_original, 1.0 - beta, original[i], beta, 0.0, color_original);
-            }
-            std::string out_original = out_directory + "z" + std::to_string(z_index-NUM_Z_LAYERS+1) 
-                                    + "_" + std::to_string(NUM_Z_LAYERS) + "layers_original.tif";
-            cv::imwrite(out_original.c_str(), color_original);
+            rows[i] = dataRow(dir_name_modified + std::to_string(z_index-layers+1), 
+                                metrics, segmenters[i].config(), NULL);
+        }
+        for (auto& cache : caches) {
+            reused += cache.second->hits();
+            computed += cache.second->misses();
+        }
+
+        std::lock_guard<std::mutex> lock(output_mutex);
+        for (size_t i = 0; i < rows.size(); i++) {
+            *(*streams)[i] << rows[i] << std::flush;
         }
     }
-    data_stream.close();
+    std::lock_guard<std::mutex> lock(output_mutex);
+    std::cout << dir_name << ": " << reused << " of " << reused + computed 
+              << " intermediates reused across " << segmenters.size() 
+              << " grid points" << std::endl;
     return true;
 }
 
-/* Main - create the threads and start the processing */
-int main(int argc, char *argv[]) {
+/* Merge the shard summaries and write the plate summary, heatmap and plate map */
+bool writeAggregate(RunOptions options) {
 
-    /* Check for argument count */
-    if (argc != 5) {
-        std::cerr << "Invalid number of arguments." << std::endl;
-        return -1;
+    if (options.aggregate.empty()) return true;
+    for (auto& shard : options.aggregate_shards) {
+        if (!plate_aggregate.readSummary(shard)) return false;
     }
+    if (!plate_aggregate.writeSummary(options.aggregate + "_summary.csv")) return false;
+    return plate_aggregate.empty() || 
+                (plate_aggregate.writeHeatmap(options.aggregate + "_heatmap.png") && 
+                plate_aggregate.writePlateMap(options.aggregate + "_plate.png"));
+}
 
-    /* Read the path to the data */
-    std::string path(argv[1]);
+/* Compare the reference and the configured pipeline on a directory */
+bool verifyDir(std::string dir_name, RunOptions options, EquivalenceCheck *check) {
+
+    StackEntry stack;
+    if (!stackPlanes(dir_name, options, NULL, &stack)) return false;
+    int z_count = (int) stack.planes.size();
+
+    // The reference windows are held at full resolution next to the variant ones
+    MemoryReservation reservation(&memory_governor, 
+                                    windowFootprint(stack.size, 1) + 
+                                    stackFootprint(stack, options));
+    std::vector<cv::Mat> reference(NUM_Z_LAYERS), variant(NUM_Z_LAYERS);
+    for (int z_index = 1; z_index <= z_count; z_index++) {
+        std::string in_filename = stack.baseName(z_index-1);
+
+        // The reference always runs at full resolution
+        reference[(z_index-1)%NUM_Z_LAYERS] = readLayer(in_filename, 1);
+        variant[(z_index-1)%NUM_Z_LAYERS] = 
+                    ((options.preview_scale > 1) || (options.bit_depth > 8)) ? 
+                    readLayer(in_filename, options.preview_scale, options.bit_depth) : 
+                    reference[(z_index-1)%NUM_Z_LAYERS];
+        if (reference[(z_index-1)%NUM_Z_LAYERS].empty() || 
+                                variant[(z_index-1)%NUM_Z_LAYERS].empty()) {
+            std::cerr << "Invalid input filename" << std::endl;
+            return false;
+        }
+        if (z_index >= NUM_Z_LAYERS) {
+            check->compareWindow(dir_name + " z" + std::to_string(z_index-NUM_Z_LAYERS+1), 
+                                    reference, variant);
+        }
+    }
+    return true;
+}
 
-    /* Read the list of directories to process */
-    std::vector<std::string> files;
-    FILE *file = fopen(argv[2], "r");
+/* Throughput of each parallel policy against the core count */
+void scalingBenchmark(RunOptions options, std::ostream &out) {
+
+    // Distinct synthetic windows, analyzed round robin
+    unsigned int distinct = options.synthetic ? options.synthetic : 8;
+    std::vector<std::vector<cv::Mat>> windows;
+    for (unsigned int i = 0; i < distinct; i++) {
+        windows.push_back(EquivalenceCheck::syntheticWindow(
+                                cv::Size(1024/options.preview_scale, 1024/options.preview_scale), 
+                                NUM_Z_LAYERS, i + 1));
+        widenPlanes(options.bit_depth, &windows.back());
+    }
+    NeuronSegmenter segmenter(segmentationConfig(options));
+
+    // Powers of two up to the largest core count, and the largest itself
+    std::vector<unsigned int> core_counts;
+    for (unsigned int cores = 1; cores < options.scaling_bench; cores *= 2) {
+        core_counts.push_back(cores);
+    }
+    core_counts.push_back(options.scaling_bench);
+    unsigned int window_cnt = std::max(8u, 2*options.scaling_bench);
+
+    out << std::setw(6) << "cores" << std::setw(8) << "policy" << std::setw(9) << "workers" 
+        << std::setw(12) << "cv threads" << std::setw(12) << "windows/s" 
+        << std::setw(9) << "speedup" << std::endl;
+    std::vector<ParallelPolicy> policies = {ParallelPolicy::OUTER, ParallelPolicy::INNER, 
+                                                ParallelPolicy::HYBRID};
+    for (auto policy : policies) {
+        double single_core = 0.0;
+        for (auto cores : core_counts) {
+            CoreScheduler scheduler(policy, cores, 0, 
+                        (policy == ParallelPolicy::HYBRID) ? options.opencv_threads : 0, 
+                        options.pin);
+            scheduler.apply();
+            auto start = std::chrono::steady_clock::now();
+            {
+                ThreadPool pool(scheduler.workers(), scheduler.workerStart());
+                for (unsigned int i = 0; i < window_cnt; i++) {
+                    pool.submit([&, i]() {
+                        WindowMetrics metrics;
+                        WindowImages images;
+                        segmenter.analyzeWindow(windows[i % windows.size()], 
+                                                    &metrics, &images);
+                    });
+                }
+                pool.wait();
+            }
+            double seconds = std::chrono::duration<double>(
+                                    std::chrono::steady_clock::now() - start).count();
+            double throughput = window_cnt/std::max(seconds, 1e-6);
+            if (cores == 1) single_core = throughput;
+            out << std::setw(6) << cores << std::setw(8) << CoreScheduler::policyName(policy) 
+                << std::setw(9) << scheduler.workers() 
+                << std::setw(12) << scheduler.opencvThreads() 
+                << std::fixed << std::setprecision(2) << std::setw(12) << throughput 
+                << std::setw(9) << throughput/std::max(single_core, 1e-6) << std::endl;
+            out.unsetf(std::ios::fixed);
+        }
+    }
+}
+
+/* Read the list of directories to process */
+bool readDirList(std::string path, std::string list_file, std::vector<std::string> *files) {
+
+    FILE *file = fopen(list_file.c_str(), "r");
     if (!file) {
         std::cerr << "Could not open the file list." << std::endl;
-        return -1;
+        return false;
     }
     char line[128];
     while (fgets(line, sizeof(line), file) != NULL) {
         line[strlen(line)-1] = '/';
         std::string temp_str(line);
         std::string image_name = path + temp_str;
-        files.push_back(image_name);
+        files->push_back(image_name);
     }
     fclose(file);
+    return true;
+}
 
-    /* Create the error log for images that could not be processed */
-    std::ofstream err_file(argv[3]);
-    if (!err_file.is_open()) {
-        std::cerr << "Could not open the error log file." << std::endl;
-        return -1;
-    }
-
-    /* Process each image directory */
-    std::string out_file(argv[4]);
-    std::ofstream data_stream;
-    data_stream.open(out_file, std::ios::out);
-    if (!data_stream.is_open()) {
-        std::cerr << "Could not create the data output file." << std::endl;
-        return -1;
-    }
+/* Header line of a data output file */
+void writeDataColumns(std::ostream &data_stream, RunOptions options) {
 
     data_stream << "path_image_frame,total cell count,astrocyte count,neuron count,\
                     astrocytes per neuron - mean,astrocytes per neuron - std dev,\
@@ -863,16 +996,732 @@ int main(int argc, char *argv[]) {
     data_stream << "green low area >= " 
                 << (NUM_SYNAPSE_AREA_BINS-1)*SYNAPSE_BIN_AREA << ",";
 
+    if (options.sample_error > 0.0) {
+        data_stream << "sampled synapse tile fraction,\
+                        low intensity synapse count 95% ci,\
+                        high intensity synapse count 95% ci,\
+                        green-red high intensity common area count 95% ci,\
+                        green-red low intensity common area count 95% ci,";
+    }
+    if (options.screen) {
+        data_stream << "window signal,window focus,skipped,";
+    }
+
     data_stream << std::endl;
+}
+
+/* Create the data output files and write their headers */
+bool writeDataHeader(std::string out_file, RunOptions options) {
+
+    std::ofstream data_stream;
+    data_stream.open(out_file, std::ios::out);
+    if (!data_stream.is_open()) {
+        std::cerr << "Could not create the data output file." << std::endl;
+        return false;
+    }
+
+    writeDataColumns(data_stream, options);
     data_stream.close();
 
-    for (auto& file_name : files) {
-        std::cout << file_name << std::endl;
-        if (!processDir(file_name, out_file)) {
+    /* Create the per neuron synapse output file */
+    if (options.neuron_roi) {
+        std::ofstream neuron_stream(neuronBinsFilename(out_file), std::ios::out);
+        if (!neuron_stream.is_open()) {
+            std::cerr << "Could not create the neuron data output file." << std::endl;
+            return false;
+        }
+        neuron_stream << "path_image_frame,neuron index,neuron center x,neuron center y,\
+                        synapse count,low intensity synapse count,\
+                        high intensity synapse count,";
+        for (unsigned int i = 0; i < NUM_SYNAPSE_AREA_BINS-1; i++) {
+            neuron_stream << i*SYNAPSE_BIN_AREA << " <= low intensity synapse area < " 
+                          << (i+1)*SYNAPSE_BIN_AREA << ",";
+        }
+        neuron_stream << "low intensity synapse area >= " 
+                      << (NUM_SYNAPSE_AREA_BINS-1)*SYNAPSE_BIN_AREA << ",";
+        for (unsigned int i = 0; i < NUM_SYNAPSE_AREA_BINS-1; i++) {
+            neuron_stream << i*SYNAPSE_BIN_AREA << " <= high intensity synapse area < " 
+                          << (i+1)*SYNAPSE_BIN_AREA << ",";
+        }
+        neuron_stream << "high intensity synapse area >= " 
+                      << (NUM_SYNAPSE_AREA_BINS-1)*SYNAPSE_BIN_AREA << ",";
+        neuron_stream << std::endl;
+        neuron_stream.close();
+    }
+
+    /* Create the per red object colocalization output file */
+    if (options.colocalization) {
+        std::ofstream coloc_stream(colocalizationFilename(out_file), std::ios::out);
+        if (!coloc_stream.is_open()) {
+            std::cerr << "Could not create the colocalization output file." << std::endl;
+            return false;
+        }
+        coloc_stream << "path_image_frame,channel,red object,red center x,red center y,\
+                        red area,green objects,green overlap area,green overlap fraction,\
+                        largest overlap green object," << std::endl;
+        coloc_stream.close();
+    }
+
+    /* Create the per stack 3D object output file */
+    if (!options.stack_channels.empty()) {
+        std::ofstream stack_stream(stackBinsFilename(out_file), std::ios::out);
+        if (!stack_stream.is_open()) {
+            std::cerr << "Could not create the 3D object output file." << std::endl;
+            return false;
+        }
+        stack_stream << "path_image_stack,channel,object count,";
+        for (unsigned int i = 0; i < NUM_SYNAPSE_AREA_BINS-1; i++) {
+            stack_stream << i*VOLUME_BIN_VOXELS << " <= object volume < " 
+                         << (i+1)*VOLUME_BIN_VOXELS << ",";
+        }
+        stack_stream << "object volume >= " 
+                     << (NUM_SYNAPSE_AREA_BINS-1)*VOLUME_BIN_VOXELS << ",";
+        for (unsigned int i = 0; i < NUM_SYNAPSE_AREA_BINS-1; i++) {
+            stack_stream << "object z extent = " << i+1 << " planes,";
+        }
+        stack_stream << "object z extent >= " << NUM_SYNAPSE_AREA_BINS << " planes,";
+        stack_stream << std::endl;
+        stack_stream.close();
+    }
+    return true;
+}
+
+/* Write the sweep grid index and the header of each grid point output file, 
+   and open the grid point files for the rows */
+bool openSweepFiles(std::string out_file, RunOptions options, 
+                        std::vector<std::unique_ptr<std::ofstream>> *streams) {
+
+    if (!options.sweep.writeIndex(sweepFilename(out_file))) {
+        std::cerr << "Could not create the sweep index file." << std::endl;
+        return false;
+    }
+    for (size_t i = 0; i < options.sweep.size(); i++) {
+        std::unique_ptr<std::ofstream> stream(
+                new std::ofstream(sweepFilename(out_file, std::to_string(i))));
+        if (!stream->is_open()) {
+            std::cerr << "Could not create the sweep data output files." << std::endl;
+            return false;
+        }
+        writeDataColumns(*stream, options);
+        streams->push_back(std::move(stream));
+    }
+    return true;
+}
+
+/* Throughput of the full pipeline on a synthetic plate at each thread count, 
+   written as JSON */
+bool throughputBenchmark(RunOptions options) {
+
+    std::vector<std::string> wells;
+    if (!writeBenchPlate(options.bench_plate, options.layer_pattern, &wells)) return false;
+    mkdir("result", 0700);
+
+    // Powers of two up to the online cores, and the cores themselves
+    std::vector<unsigned int> thread_counts = options.bench_threads;
+    if (thread_counts.empty()) {
+        unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned int threads = 1; threads < cores; threads *= 2) {
+            thread_counts.push_back(threads);
+        }
+        thread_counts.push_back(cores);
+    }
+
+    std::vector<BenchRun> runs;
+    for (auto threads : thread_counts) {
+        ParallelPolicy policy = (threads > 1) ? ParallelPolicy::HYBRID 
+                                              : ParallelPolicy::INNER;
+        if (!options.parallel.empty()) {
+            CoreScheduler::parsePolicy(options.parallel, &policy);
+        }
+        CoreScheduler scheduler(policy, threads, 0, options.opencv_threads, options.pin);
+        scheduler.apply();
+        std::string out_file = options.bench_plate.dir + "bench_" + 
+                                    std::to_string(threads) + "threads.csv";
+        if (!writeDataHeader(out_file, options)) return false;
+
+        BenchRun run;
+        run.threads = threads;
+        run.workers = scheduler.workers();
+        run.opencv_threads = scheduler.opencvThreads();
+        stage_profiler.reset();
+        IoCounters io_start = IoCounters::current();
+        auto start = std::chrono::steady_clock::now();
+        {
+            ThreadPool pool(scheduler.workers(), scheduler.workerStart());
+            for (auto& well : wells) {
+                pool.submit([&, well]() {
+                    if (!processDir(well, out_file, options)) {
+                        std::lock_guard<std::mutex> lock(output_mutex);
+                        run.failed++;
+                    }
+                });
+            }
+            pool.wait();
+        }
+        run.seconds = std::chrono::duration<double>(
+                                std::chrono::steady_clock::now() - start).count();
+        IoCounters io_end = IoCounters::current();
+        run.io.read_bytes = io_end.read_bytes - io_start.read_bytes;
+        run.io.written_bytes = io_end.written_bytes - io_start.written_bytes;
+        run.start_resident = stage_profiler.startResident();
+        run.peak_resident = stage_profiler.peakResident();
+        run.stages = stage_profiler.stageSeconds();
+        runs.push_back(run);
+        std::cerr << threads << " threads: " << wells.size() << " wells in " 
+                  << run.seconds << " s" << std::endl;
+    }
+
+    if (options.bench == "-") {
+        writeBenchJson(options.bench_plate, options.bench_label, runs, std::cout);
+        return true;
+    }
+    std::ofstream out(options.bench);
+    if (!out.is_open()) {
+        std::cerr << "Could not create the benchmark output file." << std::endl;
+        return false;
+    }
+    writeBenchJson(options.bench_plate, options.bench_label, runs, out);
+    return true;
+}
+
+/* Main - create the threads and start the processing */
+int main(int argc, char *argv[]) {
+
+    /* Separate the positional and the optional arguments */
+    std::vector<std::string> args;
+    RunOptions options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg(argv[i]);
+        if (arg.compare(0, 2, "--") != 0) {
+            args.push_back(arg);
+        } else if (arg.compare(0, 10, "--preview=") == 0) {
+            options.preview_scale = (unsigned int) strtoul(arg.substr(10).c_str(), NULL, 10);
+            if ((options.preview_scale != 2) && (options.preview_scale != 4) && 
+                                                (options.preview_scale != 8)) {
+                std::cerr << "Preview scale must be 2, 4 or 8." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 12, "--bit-depth=") == 0) {
+            options.bit_depth = (unsigned int) strtoul(arg.substr(12).c_str(), NULL, 10);
+            if ((options.bit_depth != 8) && (options.bit_depth != 12) && 
+                                                (options.bit_depth != 16)) {
+                std::cerr << "Bit depth must be 8, 12 or 16." << std::endl;
+                return -1;
+            }
+        } else if (arg == "--split-nuclei") {
+            options.split_nuclei = true;
+        } else if (arg == "--neuron-roi") {
+            options.neuron_roi = true;
+        } else if (arg == "--colocalization") {
+            options.colocalization = true;
+        } else if ((arg == "--approximate") || (arg.compare(0, 14, "--approximate=") == 0)) {
+            options.sample_error = (arg.size() > 14) ? strtof(arg.substr(14).c_str(), NULL) : 0.1;
+            if (options.sample_error <= 0.0) {
+                std::cerr << "Approximate mode needs a positive relative error." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 15, "--screen-focus=") == 0) {
+            options.screen = true;
+            options.screen_thresholds.min_focus = strtof(arg.substr(15).c_str(), NULL);
+        } else if ((arg == "--screen") || (arg.compare(0, 9, "--screen=") == 0)) {
+            options.screen = true;
+            if (arg.size() > 9) {
+                options.screen_thresholds.min_signal = strtof(arg.substr(9).c_str(), NULL);
+            }
+        } else if (arg.compare(0, 14, "--sample-seed=") == 0) {
+            options.sample_seed = (unsigned int) strtoul(arg.substr(14).c_str(), NULL, 10);
+        } else if (arg.compare(0, 10, "--pyramid=") == 0) {
+            options.pyramid_levels = (unsigned int) strtoul(arg.substr(10).c_str(), NULL, 10);
+            if ((options.pyramid_levels < 1) || (options.pyramid_levels > 4)) {
+                std::cerr << "Pyramid levels must be between 1 and 4." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 8, "--serve=") == 0) {
+            options.serve = arg.substr(8);
+        } else if (arg.compare(0, 10, "--workers=") == 0) {
+            options.workers = (unsigned int) strtoul(arg.substr(10).c_str(), NULL, 10);
+        } else if (arg.compare(0, 11, "--parallel=") == 0) {
+            ParallelPolicy policy;
+            options.parallel = arg.substr(11);
+            if (!CoreScheduler::parsePolicy(options.parallel, &policy)) {
+                std::cerr << "Parallel policy must be outer, inner or hybrid." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 13, "--cv-threads=") == 0) {
+            options.opencv_threads = (unsigned int) strtoul(arg.substr(13).c_str(), NULL, 10);
+        } else if (arg == "--pin") {
+            options.pin = true;
+        } else if ((arg == "--scaling-bench") || (arg.compare(0, 16, "--scaling-bench=") == 0)) {
+            options.scaling_bench = (arg.size() > 16) ? 
+                        (unsigned int) strtoul(arg.substr(16).c_str(), NULL, 10) : 
+                        std::max(1u, std::thread::hardware_concurrency());
+            if (!options.scaling_bench) {
+                std::cerr << "Scaling benchmark needs at least one core." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 14, "--bench-wells=") == 0) {
+            options.bench_plate.wells = 
+                        (unsigned int) strtoul(arg.substr(14).c_str(), NULL, 10);
+            if (!options.bench_plate.wells) {
+                std::cerr << "Benchmark plates need at least one well." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 14, "--bench-depth=") == 0) {
+            options.bench_plate.depth = 
+                        (unsigned int) strtoul(arg.substr(14).c_str(), NULL, 10);
+            if (options.bench_plate.depth < NUM_Z_LAYERS) {
+                std::cerr << "Benchmark wells need at least " << NUM_Z_LAYERS 
+                          << " z planes." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 13, "--bench-size=") == 0) {
+            options.bench_plate.frame_size = atoi(arg.substr(13).c_str());
+            if (options.bench_plate.frame_size < 64) {
+                std::cerr << "Benchmark frames must be at least 64 pixels." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 16, "--bench-density=") == 0) {
+            options.bench_plate.density = strtod(arg.substr(16).c_str(), NULL);
+        } else if (arg.compare(0, 16, "--bench-threads=") == 0) {
+            std::istringstream counts(arg.substr(16));
+            std::string count;
+            while (getline(counts, count, ',')) {
+                unsigned int threads = (unsigned int) strtoul(count.c_str(), NULL, 10);
+                if (!threads) {
+                    std::cerr << "Benchmark thread counts must be positive." << std::endl;
+                    return -1;
+                }
+                options.bench_threads.push_back(threads);
+            }
+        } else if (arg.compare(0, 12, "--bench-dir=") == 0) {
+            options.bench_plate.dir = arg.substr(12);
+            if (options.bench_plate.dir.empty() || (options.bench_plate.dir.back() != '/')) {
+                options.bench_plate.dir += "/";
+            }
+        } else if (arg.compare(0, 14, "--bench-label=") == 0) {
+            options.bench_label = arg.substr(14);
+        } else if ((arg == "--bench") || (arg.compare(0, 8, "--bench=") == 0)) {
+            options.bench = (arg.size() > 8) ? arg.substr(8) : "bench.json";
+        } else if (arg.compare(0, 13, "--mem-budget=") == 0) {
+            options.memory_budget = (size_t) strtoul(arg.substr(13).c_str(), NULL, 10) 
+                                                                    * 1024 * 1024;
+            if (!options.memory_budget) {
+                std::cerr << "Memory budget must be a positive number of MB." << std::endl;
+                return -1;
+            }
+        } else if (arg == "--mem-report") {
+            options.memory_report = true;
+        } else if (arg == "--verify") {
+            options.verify = true;
+        } else if (arg.compare(0, 12, "--synthetic=") == 0) {
+            options.synthetic = (unsigned int) strtoul(arg.substr(12).c_str(), NULL, 10);
+        } else if (arg.compare(0, 13, "--verify-tol=") == 0) {
+            options.tolerance.column = strtod(arg.substr(13).c_str(), NULL);
+        } else if (arg.compare(0, 18, "--verify-mask-tol=") == 0) {
+            options.tolerance.mask = strtod(arg.substr(18).c_str(), NULL);
+        } else if (arg.compare(0, 14, "--verify-skip=") == 0) {
+            std::istringstream prefixes(arg.substr(14));
+            std::string prefix;
+            while (getline(prefixes, prefix, ',')) {
+                if (!prefix.empty()) options.tolerance.skip.push_back(prefix);
+            }
+        } else if (arg.compare(0, 9, "--volume=") == 0) {
+            std::istringstream channels(arg.substr(9));
+            std::string channel;
+            while (getline(channels, channel, ',')) {
+                const std::vector<std::string> &names = windowMaskNames();
+                if (std::find(names.begin(), names.end(), channel) == names.end()) {
+                    std::cerr << "Unknown volume channel '" << channel << "'." << std::endl;
+                    return -1;
+                }
+                options.volume_channels.push_back(channel);
+            }
+        } else if (arg.compare(0, 20, "--volume-downsample=") == 0) {
+            options.volume_downsample = (unsigned int) strtoul(arg.substr(20).c_str(), NULL, 10);
+        } else if (arg == "--volume-mesh") {
+            options.volume_mesh = true;
+        } else if (arg.compare(0, 5, "--3d=") == 0) {
+            std::istringstream channels(arg.substr(5));
+            std::string channel;
+            while (getline(channels, channel, ',')) {
+                const std::vector<std::string> &names = windowMaskNames();
+                if (std::find(names.begin(), names.end(), channel) == names.end()) {
+                    std::cerr << "Unknown 3D channel '" << channel << "'." << std::endl;
+                    return -1;
+                }
+                options.stack_channels.push_back(channel);
+            }
+        } else if (arg == "--3d-check") {
+            options.stack_check = true;
+        } else if (arg.compare(0, 18, "--3d-connectivity=") == 0) {
+            options.stack_connectivity = atoi(arg.substr(18).c_str());
+            if ((options.stack_connectivity != 6) && (options.stack_connectivity != 26)) {
+                std::cerr << "3D connectivity must be 6 or 26." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 11, "--manifest=") == 0) {
+            options.manifest = arg.substr(11);
+        } else if (arg.compare(0, 16, "--layer-pattern=") == 0) {
+            options.layer_pattern = arg.substr(16);
+            if (!DatasetManifest::validPattern(options.layer_pattern)) {
+                std::cerr << "Layer pattern must hold one {z}." << std::endl;
+                return -1;
+            }
+        } else if (arg.compare(0, 12, "--aggregate=") == 0) {
+            options.aggregate = arg.substr(12);
+        } else if (arg.compare(0, 18, "--aggregate-merge=") == 0) {
+            std::istringstream shards(arg.substr(18));
+            std::string shard;
+            while (getline(shards, shard, ',')) {
+                options.aggregate_shards.push_back(shard);
+            }
+        } else if (arg.compare(0, 8, "--sweep=") == 0) {
+            if (!options.sweep.addAxis(arg.substr(8))) {
+                return -1;
+            }
+        } else if (arg == "--watch") {
+            options.watch = true;
+        } else if (arg.compare(0, 13, "--watch-idle=") == 0) {
+            options.watch = true;
+            options.watch_idle = (unsigned int) strtoul(arg.substr(13).c_str(), NULL, 10);
+        } else {
+            std::cerr << "Unknown option '" << arg << "'." << std::endl;
+            return -1;
+        }
+    }
+    memory_governor.setBudget(options.memory_budget);
+    if (options.neuron_roi && (options.sample_error > 0.0)) {
+        std::cerr << "Approximate mode cannot bin the synapses per neuron." << std::endl;
+        return -1;
+    }
+    if (options.colocalization && (options.sample_error > 0.0)) {
+        std::cerr << "Approximate mode cannot report the overlap of every object." << std::endl;
+        return -1;
+    }
+    if (!options.sweep.empty() && (options.neuron_roi || options.colocalization || 
+                options.screen || options.watch || !options.volume_channels.empty() || 
+                !options.stack_channels.empty() || !options.aggregate.empty())) {
+        std::cerr << "A parameter sweep writes the data rows of each grid point only." 
+                  << std::endl;
+        return -1;
+    }
+
+    if (!options.serve.empty() && (!options.aggregate.empty() || !options.sweep.empty())) {
+        std::cerr << "Server jobs cannot aggregate the plate or sweep the parameters." 
+                  << std::endl;
+        return -1;
+    }
+
+    /* Scaling benchmark - throughput of each parallel policy */
+    if (options.scaling_bench) {
+        scalingBenchmark(options, std::cout);
+        return 0;
+    }
+
+    /* 3D labeling check - objects spanning and merging across the slices */
+    if (options.stack_check) {
+        return stackLabelCheck(options, std::cout) ? 0 : 1;
+    }
+
+    /* Throughput benchmark - the full pipeline on a synthetic plate */
+    if (!options.bench.empty()) {
+        return throughputBenchmark(options) ? 0 : -1;
+    }
+
+    /* Server mode - keep the workers warm and take jobs until shutdown */
+    if (!options.serve.empty()) {
+        if (!options.workers && options.parallel.empty()) {
+            options.workers = std::max(1u, std::thread::hardware_concurrency());
+        }
+        CoreScheduler scheduler = runScheduler(options);
+        scheduler.apply();
+
+        // The plane and window buffers freed after a directory stay in the 
+        // heap instead of going back to the system, so the next job reuses 
+        // pages that are already mapped
+        mallopt(M_MMAP_THRESHOLD, SERVER_MMAP_THRESHOLD);
+        mallopt(M_TRIM_THRESHOLD, SERVER_TRIM_THRESHOLD);
+
+        // Each worker analyzes a synthetic window once before its first job
+        ThreadPool::WorkerStart enter_worker = scheduler.workerStart();
+        auto warm_worker = [enter_worker, options](unsigned int worker) {
+            enter_worker(worker);
+            std::vector<cv::Mat> window = EquivalenceCheck::syntheticWindow(
+                            cv::Size(1024/options.preview_scale, 1024/options.preview_scale), 
+                            NUM_Z_LAYERS, worker + 1);
+            widenPlanes(options.bit_depth, &window);
+            WindowMetrics metrics;
+            WindowImages images;
+            NeuronSegmenter(segmentationConfig(options)).analyzeWindow(window, &metrics, 
+                                                                        &images);
+        };
+        Server server(scheduler.workers(), 
+            [options](ServerJob *job, std::string *error) {
+                if (job->out_file.empty()) {
+                    *error = "missing output file";
+                    return false;
+                }
+                if (!job->list_file.empty() && 
+                        !readDirList(job->path, job->list_file, &job->dirs)) {
+                    *error = "could not open the file list";
+                    return false;
+                }
+                if (job->list_file.empty()) {
+                    for (auto& dir : job->dirs) {
+                        dir = job->path + dir + ((!dir.empty() && (dir.back() == '/')) ? "" : "/");
+                    }
+                }
+                if (!job->err_file.empty()) {
+                    std::ofstream err_file(job->err_file);
+                }
+                if (!writeDataHeader(job->out_file, options)) {
+                    *error = "could not create the data output file";
+                    return false;
+                }
+                return true;
+            },
+            [options](const ServerJob &job, std::string dir) {
+                return processDir(dir, job.out_file, options);
+            }, 
+            warm_worker);
+        int status = (options.serve == "-") ? server.serveStream(std::cin, std::cout) 
+                                            : server.serveSocket(options.serve);
+        if (options.memory_budget || options.memory_report) {
+            memory_governor.report(std::cerr);
+        }
+        return status;
+    }
+
+    /* Verify mode - compare the options against the reference pipeline */
+    if (options.verify) {
+        if ((args.size() != 0) && (args.size() != 2)) {
+            std::cerr << "Verify mode takes an image directory and an image list, " 
+                        << "or synthetic windows only." << std::endl;
+            return -1;
+        }
+        SegmentationConfig variant_config = segmentationConfig(options);
+        variant_config.debug_images = true;
+        EquivalenceCheck check(variant_config, options.tolerance);
+
+        // Synthetic windows, decoded at the preview scale by downsampling
+        unsigned int synthetic = (args.empty() && !options.synthetic) ? 4 : options.synthetic;
+        for (unsigned int i = 0; i < synthetic; i++) {
+            std::vector<cv::Mat> reference = EquivalenceCheck::syntheticWindow(
+                                            cv::Size(1024, 1024), NUM_Z_LAYERS, i + 1);
+            std::vector<cv::Mat> variant = reference;
+            if (options.preview_scale > 1) {
+                for (auto& plane : variant) {
+                    cv::resize(plane, plane, cv::Size(), 1.0/options.preview_scale, 
+                                    1.0/options.preview_scale, cv::INTER_AREA);
+                }
+            }
+            widenPlanes(options.bit_depth, &variant);
+
+            // Above 8 bits the reference is the two-step pipeline, the camera 
+            // samples reduced to 8 bits before the analysis
+            double reduce_ms = 0.0;
+            if ((options.bit_depth > 8) && (options.preview_scale == 1)) {
+                auto start = std::chrono::steady_clock::now();
+                for (size_t z = 0; z < variant.size(); z++) {
+                    variant[z].convertTo(reference[z], CV_8U, 
+                                            255.0/sampleMax(options.bit_depth));
+                }
+                reduce_ms = std::chrono::duration<double, std::milli>(
+                                std::chrono::steady_clock::now() - start).count();
+            }
+            check.compareWindow("synthetic " + std::to_string(i + 1), reference, variant, 
+                                    reduce_ms);
+        }
+
+        // Recorded stacks
+        if (!args.empty()) {
+            std::vector<std::string> files;
+            if (!readDirList(args[0], args[1], &files)) {
+                return -1;
+            }
+            for (auto& file_name : files) {
+                verifyDir(file_name, options, &check);
+            }
+        }
+        check.report(std::cout);
+        return check.passed() ? 0 : 1;
+    }
+
+    /* Shard merge - combine the plate summaries of separate runs */
+    if (args.empty() && !options.aggregate_shards.empty()) {
+        if (options.aggregate.empty()) {
+            std::cerr << "Shard merge needs an --aggregate output prefix." << std::endl;
+            return -1;
+        }
+        return writeAggregate(options) ? 0 : -1;
+    }
+
+    /* Check for argument count */
+    if (args.size() != 4) {
+        std::cerr << "Invalid number of arguments." << std::endl;
+        return -1;
+    }
+
+    /* Read the path to the data */
+    std::string path(args[0]);
+
+    /* Read the list of directories to process */
+    std::vector<std::string> files;
+    if (!readDirList(path, args[1], &files)) {
+        return -1;
+    }
+
+    /* Create the error log for images that could not be processed */
+    std::ofstream err_file(args[2]);
+    if (!err_file.is_open()) {
+        std::cerr << "Could not open the error log file." << std::endl;
+        return -1;
+    }
+
+    /* Process each image directory */
+    std::string out_file(args[3]);
+    std::vector<std::unique_ptr<std::ofstream>> sweep_streams;
+    if (options.sweep.empty() ? !writeDataHeader(out_file, options) 
+                              : !openSweepFiles(out_file, options, &sweep_streams)) {
+        return -1;
+    }
+
+    /* Share the cores between the directories and the OpenCV threads */
+    CoreScheduler scheduler = runScheduler(options);
+    scheduler.apply();
+
+    /* Index the planes of every directory up front, incomplete stacks are logged now */
+    DatasetManifest manifest(options.layer_pattern);
+    if (!options.manifest.empty() && !options.watch) {
+        manifest.load(options.manifest);
+        manifest.update(files);
+        manifest.save(options.manifest);
+        std::vector<std::string> complete;
+        for (auto& file_name : files) {
+            const StackEntry *stack = manifest.find(file_name);
+            if (!stack->error.empty() || (stack->planes.size() < NUM_Z_LAYERS)) {
+                std::cerr << (stack->error.empty() ? "Not enough z layers in '" + file_name + "'" 
+                                                    : stack->error) << std::endl;
+                err_file << file_name << std::endl;
+            } else {
+                complete.push_back(file_name);
+            }
+        }
+        files.swap(complete);
+    }
+
+    /* Watch mode - analyze each window as soon as its z planes are written */
+    if (options.watch) {
+        std::ofstream data_stream(out_file, std::ios::app);
+        std::ofstream neuron_stream, coloc_stream;
+        if (options.neuron_roi) {
+            neuron_stream.open(neuronBinsFilename(out_file), std::ios::app);
+        }
+        if (options.colocalization) {
+            coloc_stream.open(colocalizationFilename(out_file), std::ios::app);
+        }
+        if (!data_stream.is_open() || (options.neuron_roi && !neuron_stream.is_open()) || 
+                                (options.colocalization && !coloc_stream.is_open())) {
+            std::cerr << "Could not open the data output file." << std::endl;
+            return -1;
+        }
+        NeuronSegmenter segmenter = runSegmenter(options);
+        std::map<std::string, std::unique_ptr<MaskVolumeWriter>> volumes;
+        std::map<std::string, std::vector<StackLabeler>> stacks;
+        std::map<std::string, unsigned int> labeled_planes;
+        std::map<std::string, WellAggregate> wells;
+        WatchFolder watcher(NUM_Z_LAYERS, options.layer_pattern, 
+            [options](std::string base_name, cv::Mat *plane) {
+                *plane = readLayer(base_name, options.preview_scale, options.bit_depth);
+                return !plane->empty();
+            },
+            [&](std::string dir, const std::vector<cv::Mat> &window, 
+                                                unsigned int window_index) {
+                std::string dir_name_modified, token, out_directory;
+                dirOutputNames(dir, &dir_name_modified, &token, &out_directory);
+                if (!volumes.count(dir)) {
+                    volumes[dir] = openMaskVolume(options, out_directory, token);
+                    stacks[dir] = openStackLabelers(options);
+                }
+                std::cout << dir << " window " << window_index << std::endl;
+
+                // Planes of the window not labeled in 3D yet, in z order
+                std::vector<cv::Mat> new_planes;
+                unsigned int last = window_index + NUM_Z_LAYERS - 1;
+                for (unsigned int z = std::max(labeled_planes[dir] + 1, window_index); 
+                                                                    z <= last; z++) {
+                    new_planes.push_back(window[(z-1)%NUM_Z_LAYERS]);
+                }
+                labeled_planes[dir] = last;
+                if (!labelPlanes(segmenter, new_planes, &stacks[dir])) return false;
+                WindowSignal screen;
+                if (options.screen) screen = screenPlanes(window, options);
+                return processWindow(segmenter, window, options.screen ? &screen : NULL, 
+                                        window_index, 
+                                        dir_name_modified, out_directory, 
+                                        &data_stream, &neuron_stream, &coloc_stream, 
+                                        volumes[dir].get(), 
+                                        options.aggregate.empty() ? NULL : &wells[dir]);
+            });
+        for (auto& file_name : files) {
+            watcher.addDirectory(file_name);
+        }
+        if (!watcher.run(options.watch_idle)) {
+            return -1;
+        }
+        for (auto& file_name : watcher.failedDirectories()) {
             err_file << file_name << std::endl;
         }
+        for (auto& volume : volumes) {
+            std::string dir_name_modified, token, out_directory;
+            dirOutputNames(volume.first, &dir_name_modified, &token, &out_directory);
+            closeMaskVolume(volume.second.get(), out_directory, token);
+            writeStackRows(dir_name_modified, out_file, &stacks[volume.first]);
+            if (wells.count(volume.first)) plate_aggregate.addWell(token, wells[volume.first]);
+        }
+        writeAggregate(options);
+        err_file.close();
+        if (options.memory_budget || options.memory_report) {
+            memory_governor.report(std::cout);
+        }
+        return 0;
+    }
+
+    // Each directory is analyzed once, or at every point of the sweep grid
+    auto analyzeDir = [&](std::string file_name) {
+        const StackEntry *indexed = manifest.find(file_name);
+        return options.sweep.empty() ? processDir(file_name, out_file, options, indexed) 
+                                     : sweepDir(file_name, options, indexed, &sweep_streams);
+    };
+
+    if (scheduler.workers() > 1) {
+
+        // Concurrent directories, admitted by the memory governor
+        ThreadPool pool(scheduler.workers(), scheduler.workerStart());
+        for (auto& file_name : files) {
+            pool.submit([&, file_name]() {
+                {
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    std::cout << file_name << std::endl;
+                }
+                if (!analyzeDir(file_name)) {
+                    std::lock_guard<std::mutex> lock(output_mutex);
+                    err_file << file_name << std::endl;
+                }
+            });
+        }
+        pool.wait();
+    } else {
+        for (auto& file_name : files) {
+            std::cout << file_name << std::endl;
+            if (!analyzeDir(file_name)) {
+                err_file << file_name << std::endl;
+            }
+        }
     }
     err_file.close();
+    writeAggregate(options);
+    if (options.memory_budget || options.memory_report) memory_governor.report(std::cout);
 
     return 0;
 }
@@ -1,13 +1,10 @@
 clf;
 clear all;
 image = '1792Ap9 DMSOa';
-type = '_red_high_3layers_enhanced';
-startFrame = 1;
-endFrame = 12;
-for i = startFrame : endFrame
-    filename = [image, '\z', int2str(i), type, '.tif'];
-    slice(:,:,i) = imread(filename);
-end
+type = 'red_high';
+
+%one read of the mask volume written by segment --volume=red_high
+slice = uint8(readMaskVolume([image, '\', image, '_masks.nsv'], type)) * 255;
 
 %build the surface of constant fluro intensity
 p=patch(isosurface(slice, 100));
@@ -24,8 +21,8 @@ zscale=0.1;
 daspect([1,1,zscale]);
 axis on;
 set(gca,'color',[1,1,1]*0.8);
-set(gca,'xlim',[1 1024], 'ylim',[1 1024]);
+set(gca,'xlim',[1 size(slice,2)], 'ylim',[1 size(slice,1)]);
 
-videofile = [image, type];
+videofile = [image, '_', type];
 OptionZ.FrameRate=5; OptionZ.Duration=5.5; OptionZ.Periodic=true;
 CaptureFigVid([0,-90;0,-45;0,0;0,45;0,90], videofile, OptionZ);
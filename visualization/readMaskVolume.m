@@ -0,0 +1,87 @@
+function [volume, z, channels] = readMaskVolume(filename, channel)
+% [volume, z, channels] = readMaskVolume(filename, channel)
+% Reads one channel of a mask volume (.nsv) written by segment --volume.
+% volume:    logical height x width x slices array of the channel masks
+% z:         window index of each slice, in increasing order
+% channels:  names of all the channels stored in the file
+
+fid = fopen(filename, 'r', 'ieee-le');
+if fid < 0
+    error('Could not open %s', filename);
+end
+magic = fread(fid, [1 8], '*char');
+if ~strcmp(magic, 'NSVOL001')
+    fclose(fid);
+    error('%s is not a mask volume', filename);
+end
+dims = fread(fid, 4, 'uint32');
+width = dims(1);
+height = dims(2);
+channels = cell(1, dims(4));
+for i = 1 : dims(4)
+    len = fread(fid, 1, 'uint8');
+    channels{i} = fread(fid, [1 len], '*char');
+end
+index = find(strcmp(channels, channel)) - 1;
+if isempty(index)
+    fclose(fid);
+    error('Channel %s is not in %s', channel, filename);
+end
+
+% Slices of the other channels are skipped without decoding
+volume = false(height, width, 0);
+z = [];
+while true
+    head = fread(fid, 3, 'uint32');
+    if numel(head) < 3
+        break;
+    end
+    payload = fread(fid, head(3), '*uint8');
+    if head(2) ~= index
+        continue;
+    end
+    volume(:, :, end+1) = decodeRuns(payload, width, height);
+    z(end+1) = head(1);
+end
+fclose(fid);
+[z, order] = sort(z);
+volume = volume(:, :, order);
+end
+
+function mask = decodeRuns(payload, width, height)
+% Rows of alternating background and foreground LEB128 run lengths
+runs = zeros(1, numel(payload));
+n = 0;
+value = 0;
+shift = 0;
+for b = double(payload')
+    value = value + bitand(b, 127) * 2^shift;
+    if b < 128
+        n = n + 1;
+        runs(n) = value;
+        value = 0;
+        shift = 0;
+    else
+        shift = shift + 7;
+    end
+end
+
+% Filled transposed, so that each row is a contiguous column
+mask = false(width, height);
+row = 1;
+col = 0;
+foreground = false;
+for run = runs(1 : n)
+    if foreground
+        mask(col+1 : col+run, row) = true;
+    end
+    col = col + run;
+    foreground = ~foreground;
+    if col >= width
+        row = row + 1;
+        col = 0;
+        foreground = false;
+    end
+end
+mask = mask';
+end